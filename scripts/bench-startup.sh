@@ -0,0 +1,56 @@
+#!/bin/sh
+# Measure the start-up time of the simple mokutil commands.
+#
+# Usage: bench-startup.sh [-n runs] mokutil [mokutil...]
+#
+# Give more than one binary to compare the builds, e.g. one configured with
+# --disable-lazy-load and one with the default. Only the commands which
+# don't change any variable are run.
+
+runs=200
+
+while getopts "n:" opt; do
+	case $opt in
+	n) runs=$OPTARG ;;
+	*) echo "Usage: $0 [-n runs] mokutil [mokutil...]" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+	echo "Usage: $0 [-n runs] mokutil [mokutil...]" >&2
+	exit 1
+fi
+
+now_ns () {
+	date +%s%N
+}
+
+bench () {
+	bin=$1
+	shift
+
+	start=$(now_ns)
+	i=0
+	while [ $i -lt $runs ]; do
+		"$bin" "$@" >/dev/null 2>&1
+		i=$((i + 1))
+	done
+	end=$(now_ns)
+
+	echo $(( (end - start) / runs / 1000 ))
+}
+
+printf "%-28s" "command"
+for bin in "$@"; do
+	printf " %20s" "$(basename "$(dirname "$bin")")/$(basename "$bin")"
+done
+printf "\n"
+
+for cmd in "--version" "--sb-state" "--list-sbat-revocations" "--help"; do
+	printf "%-28s" "$cmd"
+	for bin in "$@"; do
+		printf " %17s us" "$(bench "$bin" $cmd)"
+	done
+	printf "\n"
+done
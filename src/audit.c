@@ -0,0 +1,839 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <openssl/sha.h>
+
+#include "audit.h"
+#include "efi_hash.h"
+#include "efi_x509.h"
+#include "util.h"
+#include "var_cache.h"
+
+/* The certificate fields of a database, parsed once for all the rules */
+typedef struct {
+	int      valid;
+	CertInfo info;
+	uint8_t  fingerprint[SHA256_DIGEST_LENGTH];
+} AuditCert;
+
+static struct {
+	AuditCert *certs;
+	uint32_t   cert_num;
+} audit_certs[DB_NAME_NUM];
+
+static const struct {
+	const char    *name;
+	AuditPredKind  kind;
+} audit_preds[] = {
+	{ "type",        AUDIT_PRED_TYPE },
+	{ "subject",     AUDIT_PRED_SUBJECT },
+	{ "issuer",      AUDIT_PRED_ISSUER },
+	{ "skid",        AUDIT_PRED_SKID },
+	{ "fingerprint", AUDIT_PRED_FINGERPRINT },
+	{ "hash",        AUDIT_PRED_HASH },
+	{ "key-bits",    AUDIT_PRED_KEY_BITS },
+	{ "key-type",    AUDIT_PRED_KEY_TYPE },
+	{ "expires",     AUDIT_PRED_EXPIRES },
+	{ "expired",     AUDIT_PRED_EXPIRED },
+};
+
+/*
+ * Split the next word off the line in place. Double quotes group words
+ * with spaces and are removed. Return 0 at the end of the line or at a
+ * comment.
+ */
+static int
+next_token (char **pos, char **token)
+{
+	char *src = *pos, *dst;
+	int quoted = 0;
+
+	while (*src == ' ' || *src == '\t')
+		src++;
+	if (*src == '\0' || *src == '#')
+		return 0;
+
+	*token = dst = src;
+	for (; *src != '\0'; src++) {
+		if (*src == '"') {
+			quoted = !quoted;
+			continue;
+		}
+		if (!quoted && (*src == ' ' || *src == '\t')) {
+			src++;
+			break;
+		}
+		*dst++ = *src;
+	}
+	*dst = '\0';
+	*pos = src;
+
+	return 1;
+}
+
+static int
+parse_op (const char **str, AuditOp *op)
+{
+	static const struct {
+		const char *str;
+		AuditOp     op;
+	} ops[] = {
+		/* The two-character operators first */
+		{ "!=", AUDIT_OP_NE },
+		{ "<=", AUDIT_OP_LE },
+		{ ">=", AUDIT_OP_GE },
+		{ "=",  AUDIT_OP_EQ },
+		{ "<",  AUDIT_OP_LT },
+		{ ">",  AUDIT_OP_GT },
+		{ "~",  AUDIT_OP_CONTAINS },
+	};
+
+	for (unsigned int i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+		size_t len = strlen (ops[i].str);
+
+		if (strncmp (*str, ops[i].str, len) == 0) {
+			*op = ops[i].op;
+			*str += len;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int
+parse_number (const char *str, int64_t *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoll (str, &end, 0);
+	if (errno != 0 || end == str || *end != '\0')
+		return -1;
+
+	return 0;
+}
+
+static int
+parse_hex (const char *str, uint8_t **bytesp, size_t *sizep)
+{
+	size_t len = strlen (str), size = 0;
+	uint8_t *bytes;
+	unsigned int byte;
+
+	bytes = malloc (len / 2 + 1);
+	if (!bytes)
+		return -1;
+
+	while (*str != '\0') {
+		/* Allow the colons of the fingerprints printed by openssl */
+		if (*str == ':') {
+			str++;
+			continue;
+		}
+		/* sscanf() would also take a sign or a space */
+		if (!isxdigit (str[0]) || !isxdigit (str[1]) ||
+		    sscanf (str, "%2x", &byte) != 1) {
+			free (bytes);
+			return -1;
+		}
+		bytes[size++] = byte;
+		str += 2;
+	}
+
+	if (size == 0) {
+		free (bytes);
+		return -1;
+	}
+
+	*bytesp = bytes;
+	*sizep = size;
+	return 0;
+}
+
+static int
+compare_num (const AuditOp op, const int64_t a, const int64_t b)
+{
+	switch (op) {
+	case AUDIT_OP_EQ:
+		return a == b;
+	case AUDIT_OP_NE:
+		return a != b;
+	case AUDIT_OP_LT:
+		return a < b;
+	case AUDIT_OP_LE:
+		return a <= b;
+	case AUDIT_OP_GT:
+		return a > b;
+	case AUDIT_OP_GE:
+		return a >= b;
+	default:
+		return 0;
+	}
+}
+
+static int
+is_numeric_op (const AuditOp op)
+{
+	return op <= AUDIT_OP_GE;
+}
+
+static const char *
+parse_pred (const char *token, AuditPred *pred)
+{
+	const char *str = token;
+	size_t len = strcspn (token, "!=<>~");
+	unsigned int i;
+
+	memset (pred, 0, sizeof(AuditPred));
+
+	for (i = 0; i < sizeof(audit_preds)/sizeof(audit_preds[0]); i++) {
+		if (strlen (audit_preds[i].name) == len &&
+		    strncmp (audit_preds[i].name, token, len) == 0)
+			break;
+	}
+	if (i == sizeof(audit_preds)/sizeof(audit_preds[0]))
+		return "unknown predicate";
+	pred->kind = audit_preds[i].kind;
+
+	str += len;
+	if (pred->kind == AUDIT_PRED_EXPIRED) {
+		pred->op = AUDIT_OP_NONE;
+		return *str == '\0' ? NULL : "\"expired\" takes no value";
+	}
+	if (parse_op (&str, &pred->op) < 0)
+		return "missing operator";
+
+	switch (pred->kind) {
+	case AUDIT_PRED_TYPE:
+	case AUDIT_PRED_SKID:
+	case AUDIT_PRED_KEY_TYPE:
+		if (pred->op != AUDIT_OP_EQ && pred->op != AUDIT_OP_NE)
+			return "only = and != apply";
+		break;
+	case AUDIT_PRED_SUBJECT:
+	case AUDIT_PRED_ISSUER:
+		if (pred->op != AUDIT_OP_EQ && pred->op != AUDIT_OP_NE &&
+		    pred->op != AUDIT_OP_CONTAINS)
+			return "only =, != and ~ apply";
+		break;
+	case AUDIT_PRED_FINGERPRINT:
+	case AUDIT_PRED_HASH:
+		if (pred->op != AUDIT_OP_EQ)
+			return "only = applies";
+		if (parse_hex (str, &pred->bytes, &pred->bytes_size) < 0)
+			return "invalid hex value";
+		if (pred->kind == AUDIT_PRED_FINGERPRINT &&
+		    pred->bytes_size != SHA256_DIGEST_LENGTH)
+			return "the fingerprint is a SHA256 digest";
+		return NULL;
+	case AUDIT_PRED_KEY_BITS:
+	case AUDIT_PRED_EXPIRES:
+		if (!is_numeric_op (pred->op))
+			return "a comparison applies";
+		if (parse_number (str, &pred->value) < 0)
+			return "invalid number";
+		return NULL;
+	case AUDIT_PRED_EXPIRED:
+		break;
+	}
+
+	pred->str = strdup (str);
+	if (!pred->str)
+		return "out of memory";
+
+	return NULL;
+}
+
+static int
+find_db_name (const char *name, DBName *db)
+{
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+		if (strcmp (get_db_var_name (i), name) == 0) {
+			*db = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static const char *
+parse_rule (char *line, AuditRule *rule)
+{
+	AuditPred *preds_new;
+	const char *error, *str;
+	char *pos = line, *token;
+
+	if (!next_token (&pos, &token))
+		return NULL;
+
+	if (strcmp (token, "require") == 0 || strcmp (token, "forbid") == 0) {
+		rule->kind = token[0] == 'r' ? AUDIT_REQUIRE : AUDIT_FORBID;
+		if (!next_token (&pos, &token))
+			return "missing database";
+		if (find_db_name (token, &rule->db) < 0)
+			return "unknown database";
+
+		while (next_token (&pos, &token)) {
+			preds_new = realloc (rule->preds, (rule->pred_num + 1) *
+					     sizeof(AuditPred));
+			if (!preds_new)
+				return "out of memory";
+			rule->preds = preds_new;
+
+			error = parse_pred (token, &rule->preds[rule->pred_num]);
+			rule->pred_num++;
+			if (error)
+				return error;
+
+			if (rule->preds[rule->pred_num - 1].kind != AUDIT_PRED_TYPE &&
+			    rule->preds[rule->pred_num - 1].kind != AUDIT_PRED_HASH)
+				rule->cert_only = 1;
+		}
+		return NULL;
+	}
+
+	if (strcmp (token, "sbat") == 0) {
+		rule->kind = AUDIT_SBAT;
+		if (!next_token (&pos, &token))
+			return "missing component";
+		rule->component = strdup (token);
+		if (!rule->component)
+			return "out of memory";
+	} else if (strcmp (token, "sbat-level") == 0) {
+		rule->kind = AUDIT_SBAT_LEVEL;
+	} else {
+		return "unknown rule";
+	}
+
+	if (!next_token (&pos, &token))
+		return "missing comparison";
+	str = token;
+	if (parse_op (&str, &rule->op) < 0 || !is_numeric_op (rule->op))
+		return "invalid operator";
+	/* Allow both ">= 3" and ">=3" */
+	if (*str == '\0') {
+		if (!next_token (&pos, &token))
+			return "missing value";
+		str = token;
+	}
+	if (parse_number (str, &rule->value) < 0)
+		return "invalid number";
+	if (next_token (&pos, &token))
+		return "trailing words";
+
+	return NULL;
+}
+
+static void
+free_rule (AuditRule *rule)
+{
+	for (unsigned int i = 0; i < rule->pred_num; i++) {
+		free (rule->preds[i].str);
+		free (rule->preds[i].bytes);
+	}
+	free (rule->preds);
+	free (rule->component);
+	free (rule->text);
+}
+
+/*
+ * Read and compile the rules file. Every rule is parsed once here so
+ * that evaluating it only compares the prepared values.
+ */
+int
+audit_load (const char *path, AuditRules *rules)
+{
+	AuditRule rule, *rules_new;
+	FILE *fp;
+	char *line = NULL, *text;
+	size_t line_size = 0;
+	ssize_t len;
+	unsigned int line_num = 0;
+	const char *error;
+	int ret = -1;
+
+	memset (rules, 0, sizeof(AuditRules));
+
+	fp = fopen (path, "r");
+	if (!fp) {
+		fprintf (stderr, "Failed to open %s: %m\n", path);
+		return -1;
+	}
+
+	while ((len = getline (&line, &line_size, fp)) >= 0) {
+		line_num++;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+				   line[len - 1] == ' ' || line[len - 1] == '\t'))
+			line[--len] = '\0';
+
+		for (text = line; *text == ' ' || *text == '\t'; text++);
+		if (*text == '\0' || *text == '#')
+			continue;
+
+		memset (&rule, 0, sizeof(rule));
+		rule.line = line_num;
+		rule.text = strdup (text);
+		if (!rule.text) {
+			fprintf (stderr, "Could not allocate space: %m\n");
+			goto error;
+		}
+
+		error = parse_rule (text, &rule);
+		if (error) {
+			fprintf (stderr, "%s:%u: %s: %s\n", path, line_num,
+				 error, rule.text);
+			free_rule (&rule);
+			goto error;
+		}
+
+		rules_new = realloc (rules->rules, (rules->rule_num + 1) *
+				     sizeof(AuditRule));
+		if (!rules_new) {
+			fprintf (stderr, "Could not allocate space: %m\n");
+			free_rule (&rule);
+			goto error;
+		}
+		rules->rules = rules_new;
+		rules->rules[rules->rule_num++] = rule;
+	}
+
+	ret = 0;
+error:
+	free (line);
+	fclose (fp);
+	if (ret < 0)
+		audit_free (rules);
+
+	return ret;
+}
+
+void
+audit_free (AuditRules *rules)
+{
+	for (unsigned int i = 0; i < rules->rule_num; i++)
+		free_rule (&rules->rules[i]);
+	free (rules->rules);
+	memset (rules, 0, sizeof(AuditRules));
+}
+
+/* Drop the parsed certificates, e.g. after the variables change */
+void
+audit_reset (void)
+{
+	for (unsigned int d = 0; d < DB_NAME_NUM; d++) {
+		for (uint32_t i = 0; i < audit_certs[d].cert_num; i++)
+			free_cert_info (&audit_certs[d].certs[i].info);
+		free (audit_certs[d].certs);
+		audit_certs[d].certs = NULL;
+		audit_certs[d].cert_num = 0;
+	}
+}
+
+/*
+ * Parse the certificates of the database once for all the rules. Return
+ * NULL with errno set on failure.
+ */
+static AuditCert *
+get_audit_certs (const DBName db, const CachedVar *var)
+{
+	AuditCert *certs;
+
+	if (audit_certs[db].certs || var->index.entry_num == 0)
+		return audit_certs[db].certs;
+
+	certs = calloc (var->index.entry_num, sizeof(AuditCert));
+	if (!certs)
+		return NULL;
+
+	for (uint32_t i = 0; i < var->index.entry_num; i++) {
+		const SigEntry *entry = &var->index.entries[i];
+
+		if (efi_guid_cmp (&entry->type, &efi_guid_x509_cert) != 0)
+			continue;
+		if (!SHA256 (entry->data, entry->data_size,
+			     certs[i].fingerprint)) {
+			for (uint32_t j = 0; j < i; j++)
+				free_cert_info (&certs[j].info);
+			free (certs);
+			return NULL;
+		}
+		if (get_cert_info (entry->data, entry->data_size,
+				   &certs[i].info) == 0)
+			certs[i].valid = 1;
+	}
+
+	audit_certs[db].certs = certs;
+	audit_certs[db].cert_num = var->index.entry_num;
+	return certs;
+}
+
+static int
+match_string (const AuditOp op, const char *str, const char *value)
+{
+	switch (op) {
+	case AUDIT_OP_EQ:
+		return strcmp (str, value) == 0;
+	case AUDIT_OP_NE:
+		return strcmp (str, value) != 0;
+	case AUDIT_OP_CONTAINS:
+		return strstr (str, value) != NULL;
+	default:
+		return 0;
+	}
+}
+
+static int
+match_pred (const AuditPred *pred, const SigEntry *entry,
+	    const AuditCert *cert)
+{
+	switch (pred->kind) {
+	case AUDIT_PRED_TYPE:
+		return match_string (pred->op, sig_type_name (&entry->type),
+				     pred->str);
+	case AUDIT_PRED_HASH:
+		/* The digest starts the entry of every hash type */
+		return efi_hash_size (&entry->type) == pred->bytes_size &&
+		       entry->data_size >= pred->bytes_size &&
+		       memcmp (entry->data, pred->bytes, pred->bytes_size) == 0;
+	case AUDIT_PRED_FINGERPRINT:
+		return cert && memcmp (cert->fingerprint, pred->bytes,
+				       SHA256_DIGEST_LENGTH) == 0;
+	default:
+		break;
+	}
+
+	/* The rest look into the certificate */
+	if (!cert || !cert->valid)
+		return 0;
+
+	switch (pred->kind) {
+	case AUDIT_PRED_SUBJECT:
+		return match_string (pred->op, cert->info.subject, pred->str);
+	case AUDIT_PRED_ISSUER:
+		return match_string (pred->op, cert->info.issuer, pred->str);
+	case AUDIT_PRED_SKID:
+		return cert->info.skid &&
+		       (strcasecmp (cert->info.skid, pred->str) == 0) ==
+		       (pred->op == AUDIT_OP_EQ);
+	case AUDIT_PRED_KEY_BITS:
+		return compare_num (pred->op, cert->info.key_bits, pred->value);
+	case AUDIT_PRED_KEY_TYPE:
+		return match_string (pred->op, cert->info.key_type, pred->str);
+	case AUDIT_PRED_EXPIRES:
+		return compare_num (pred->op, cert->info.not_after,
+				    pred->value * 86400);
+	case AUDIT_PRED_EXPIRED:
+		return cert->info.not_after < 0;
+	default:
+		return 0;
+	}
+}
+
+static int
+match_entry (const AuditRule *rule, const CachedVar *var,
+	     const AuditCert *certs, const uint32_t index)
+{
+	const SigEntry *entry = &var->index.entries[index];
+	const AuditCert *cert = NULL;
+
+	if (certs && efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0)
+		cert = &certs[index];
+
+	for (unsigned int i = 0; i < rule->pred_num; i++) {
+		if (!match_pred (&rule->preds[i], entry, cert))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * The entries of the X.509 TBS hash types hold the revocation time after
+ * the digest, so they can't be looked up by the digest alone
+ */
+static int
+find_hash_prefix (const AuditRule *rule, const CachedVar *var,
+		  const AuditCert *certs, const SigType *type)
+{
+	for (uint32_t i = 0; i < var->index.entry_num; i++) {
+		if (efi_guid_cmp (&var->index.entries[i].type, type->guid) == 0 &&
+		    match_entry (rule, var, certs, i))
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Return the index of the first entry matching all the predicates, or -1.
+ * A hash predicate is looked up in the index of the database instead of
+ * scanning the entries.
+ */
+static int
+find_entry (const AuditRule *rule, const CachedVar *var,
+	    const AuditCert *certs)
+{
+	const AuditPred *hash = NULL;
+	const SigType *type;
+	int found;
+
+	for (unsigned int i = 0; i < rule->pred_num; i++) {
+		if (rule->preds[i].kind == AUDIT_PRED_HASH)
+			hash = &rule->preds[i];
+	}
+
+	if (hash) {
+		for (unsigned int t = 0; (type = get_sig_type (t)); t++) {
+			if (type->hash_size != hash->bytes_size)
+				continue;
+			if (type->data_size != type->hash_size) {
+				found = find_hash_prefix (rule, var, certs, type);
+			} else {
+				found = sig_index_find (&var->index, type->guid,
+							hash->bytes,
+							hash->bytes_size);
+				if (found >= 0 &&
+				    !match_entry (rule, var, certs, found))
+					found = -1;
+			}
+			if (found >= 0)
+				return found;
+		}
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < var->index.entry_num; i++) {
+		if (match_entry (rule, var, certs, i))
+			return i;
+	}
+
+	return -1;
+}
+
+static char *
+describe_entry (const SigEntry *entry, const AuditCert *cert)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	char *desc = NULL;
+	size_t desc_size;
+	FILE *out;
+	const uint8_t *value = entry->data;
+	size_t value_size = entry->data_size;
+
+	out = open_memstream (&desc, &desc_size);
+	if (!out)
+		return NULL;
+
+	/* Certificates are shown by their fingerprint */
+	if (cert) {
+		value = cert->fingerprint;
+		value_size = sizeof(cert->fingerprint);
+	} else if (efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0) {
+		if (!SHA256 (entry->data, entry->data_size, digest)) {
+			fclose (out);
+			free (desc);
+			return NULL;
+		}
+		value = digest;
+		value_size = sizeof(digest);
+	} else if (efi_hash_size (&entry->type) &&
+		   efi_hash_size (&entry->type) < value_size) {
+		/* Leave out the revocation time of the X.509 TBS hashes */
+		value_size = efi_hash_size (&entry->type);
+	}
+
+	fprintf (out, "%s ", sig_type_name (&entry->type));
+	for (size_t i = 0; i < value_size; i++)
+		fprintf (out, "%02x", value[i]);
+	if (cert && cert->valid)
+		fprintf (out, " %s", cert->info.subject);
+	fclose (out);
+
+	return desc;
+}
+
+/* Read the generation of the component, or the date for "sbat" */
+static int
+get_sbat_value (const uint8_t *data, const size_t data_size,
+		const char *component, int64_t *value)
+{
+	size_t comp_len = strlen (component);
+	const char *line = (const char *)data, *end = line + data_size;
+	const char *field, *eol;
+	char num[32];
+	int is_sbat = strcmp (component, "sbat") == 0;
+
+	while (line < end) {
+		eol = memchr (line, '\n', end - line);
+		if (!eol)
+			eol = end;
+
+		if ((size_t)(eol - line) > comp_len && line[comp_len] == ',' &&
+		    strncmp (line, component, comp_len) == 0) {
+			field = line + comp_len + 1;
+			/* "sbat,1,2021030218": the date follows the version */
+			if (is_sbat) {
+				field = memchr (field, ',', eol - field);
+				if (!field)
+					return -1;
+				field++;
+			}
+			size_t len = strcspn (field, ",\n");
+			if (field + len > eol)
+				len = eol - field;
+			if (len == 0 || len >= sizeof(num))
+				return -1;
+			memcpy (num, field, len);
+			num[len] = '\0';
+			return parse_number (num, value);
+		}
+
+		line = eol + 1;
+	}
+
+	return -1;
+}
+
+/* Neither pass nor fail a rule whose database can't be checked */
+static void
+set_error (AuditResult *result, const int err)
+{
+	FILE *out;
+	size_t desc_size;
+
+	result->error = 1;
+	out = open_memstream (&result->detail, &desc_size);
+	if (out) {
+		fprintf (out, "failed to read the database: %s", strerror (err));
+		fclose (out);
+	}
+}
+
+static void
+eval_sbat (const AuditRule *rule, AuditResult *result)
+{
+	const char *component = rule->kind == AUDIT_SBAT_LEVEL ? "sbat" :
+							       rule->component;
+	uint8_t *data = NULL;
+	size_t data_size = 0;
+	int64_t value = 0;
+	FILE *out;
+	size_t desc_size;
+
+	result->db = "SbatLevelRT";
+
+	if (get_db_variable ("SbatLevelRT", efi_guid_shim, &data,
+			     &data_size) < 0) {
+		if (errno == ENOENT)
+			result->detail = strdup ("not set");
+		else
+			set_error (result, errno);
+		return;
+	}
+
+	/* A component without an entry isn't revoked at all */
+	if (get_sbat_value (data, data_size, component, &value) < 0 &&
+	    rule->kind == AUDIT_SBAT_LEVEL) {
+		result->detail = strdup ("no sbat entry");
+		free (data);
+		return;
+	}
+	free (data);
+
+	result->passed = compare_num (rule->op, value, rule->value);
+	out = open_memstream (&result->detail, &desc_size);
+	if (out) {
+		fprintf (out, "%s is %"PRId64, component, value);
+		fclose (out);
+	}
+}
+
+void
+audit_eval (const AuditRule *rule, AuditResult *result)
+{
+	const DBInfo *info;
+	const CachedVar *var;
+	const AuditCert *certs = NULL;
+	const SigEntry *entry;
+	int found;
+
+	memset (result, 0, sizeof(AuditResult));
+
+	if (rule->kind == AUDIT_SBAT || rule->kind == AUDIT_SBAT_LEVEL) {
+		eval_sbat (rule, result);
+		return;
+	}
+
+	info = get_db_info (rule->db);
+	result->db = info->var_name;
+
+	var = var_cache_get (info->var_name, *info->guid);
+	if (!var) {
+		set_error (result, errno);
+		return;
+	}
+
+	/* Only parse the certificates when a predicate looks into them */
+	if (rule->cert_only && var->index.entry_num) {
+		certs = get_audit_certs (rule->db, var);
+		if (!certs) {
+			set_error (result, errno);
+			return;
+		}
+	}
+
+	found = find_entry (rule, var, certs);
+	if (found >= 0) {
+		entry = &var->index.entries[found];
+		result->detail = describe_entry (entry,
+			(certs && efi_guid_cmp (&entry->type,
+						&efi_guid_x509_cert) == 0) ?
+			&certs[found] : NULL);
+		if (!result->detail) {
+			set_error (result, errno);
+			return;
+		}
+	}
+
+	if (rule->kind == AUDIT_REQUIRE)
+		result->passed = found >= 0;
+	else
+		result->passed = found < 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __AUDIT_H__
+#define __AUDIT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mokutil.h"
+
+typedef enum {
+	AUDIT_REQUIRE = 0,	/* an entry of the database matches */
+	AUDIT_FORBID,		/* no entry of the database matches */
+	AUDIT_SBAT,		/* the SBAT generation of a component */
+	AUDIT_SBAT_LEVEL,	/* the date of the SbatLevel */
+} AuditKind;
+
+typedef enum {
+	AUDIT_OP_EQ = 0,
+	AUDIT_OP_NE,
+	AUDIT_OP_LT,
+	AUDIT_OP_LE,
+	AUDIT_OP_GT,
+	AUDIT_OP_GE,
+	AUDIT_OP_CONTAINS,
+	AUDIT_OP_NONE,
+} AuditOp;
+
+typedef enum {
+	AUDIT_PRED_TYPE = 0,
+	AUDIT_PRED_SUBJECT,
+	AUDIT_PRED_ISSUER,
+	AUDIT_PRED_SKID,
+	AUDIT_PRED_FINGERPRINT,
+	AUDIT_PRED_HASH,
+	AUDIT_PRED_KEY_BITS,
+	AUDIT_PRED_KEY_TYPE,
+	AUDIT_PRED_EXPIRES,
+	AUDIT_PRED_EXPIRED,
+} AuditPredKind;
+
+typedef struct {
+	AuditPredKind  kind;
+	AuditOp        op;
+	char          *str;		/* the text to compare */
+	uint8_t       *bytes;		/* the decoded hex value */
+	size_t         bytes_size;
+	int64_t        value;		/* the number to compare */
+} AuditPred;
+
+typedef struct {
+	unsigned int  line;
+	char         *text;
+	AuditKind     kind;
+	DBName        db;
+	AuditPred    *preds;
+	unsigned int  pred_num;
+	int           cert_only;	/* a predicate needs a certificate */
+	char         *component;
+	AuditOp       op;
+	int64_t       value;
+} AuditRule;
+
+typedef struct {
+	AuditRule    *rules;
+	unsigned int  rule_num;
+} AuditRules;
+
+typedef struct {
+	int         passed;
+	int         error;		/* the database couldn't be read */
+	const char *db;
+	char       *detail;		/* what decided the result, or NULL */
+} AuditResult;
+
+int audit_load (const char *path, AuditRules *rules);
+void audit_free (AuditRules *rules);
+void audit_eval (const AuditRule *rule, AuditResult *result);
+void audit_reset (void);
+
+#endif /* __AUDIT_H__ */
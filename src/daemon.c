@@ -0,0 +1,621 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "util.h"
+
+/*
+ * The daemon serves the clients together from one poll() loop. Every
+ * request is a line of JSON and gets one line of JSON back:
+ *
+ *     {"result": ...} or {"error": "..."}
+ *
+ * Each request has to arrive, and its answer to be read, within
+ * CLIENT_TIMEOUT of the previous answer, or the client is dropped. A slow
+ * client therefore only delays itself.
+ */
+
+#define CLIENT_TIMEOUT  5	/* seconds */
+#define MAX_CLIENTS     64
+#define MAX_LINE_SIZE   (1024 * 1024)
+#define READ_CHUNK_SIZE 4096
+
+typedef struct {
+	int       fd;		/* -1 if the slot is free */
+	char     *in;		/* the partial request lines */
+	size_t    in_len;
+	size_t    in_size;
+	char     *out;		/* the answers not written yet */
+	size_t    out_len;
+	size_t    out_sent;
+	uint64_t  deadline;	/* CLOCK_MONOTONIC in ms */
+	int       closing;	/* close once the answers are written */
+} Client;
+
+static volatile sig_atomic_t daemon_stop;
+
+static void
+handle_stop (int sig)
+{
+	(void)sig;
+	daemon_stop = 1;
+}
+
+static const char *
+skip_space (const char *ptr)
+{
+	while (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n')
+		ptr++;
+	return ptr;
+}
+
+/* Parse a JSON string and return the position after it, or NULL */
+static const char *
+parse_string (const char *ptr, char **strp)
+{
+	char *str, *dst;
+
+	if (*ptr != '"')
+		return NULL;
+	ptr++;
+
+	str = malloc (strlen (ptr) + 1);
+	if (!str)
+		return NULL;
+
+	for (dst = str; *ptr != '"'; ptr++) {
+		if (*ptr == '\0')
+			goto error;
+		if (*ptr != '\\') {
+			*dst++ = *ptr;
+			continue;
+		}
+
+		switch (*++ptr) {
+		case '"':
+		case '\\':
+		case '/':
+			*dst++ = *ptr;
+			break;
+		case 'n':
+			*dst++ = '\n';
+			break;
+		case 't':
+			*dst++ = '\t';
+			break;
+		case 'r':
+			*dst++ = '\r';
+			break;
+		case 'u': {
+			unsigned int code;
+
+			/* Four digits, without reading past the string */
+			for (int i = 1; i <= 4; i++) {
+				if (!isxdigit ((unsigned char)ptr[i]))
+					goto error;
+			}
+
+			/* Only ASCII makes sense in the requests */
+			if (sscanf (ptr + 1, "%4x", &code) != 1 || code == 0 ||
+			    code > 0x7f)
+				goto error;
+			*dst++ = code;
+			ptr += 4;
+			break;
+		}
+		default:
+			goto error;
+		}
+	}
+	*dst = '\0';
+	*strp = str;
+
+	return ptr + 1;
+error:
+	free (str);
+	return NULL;
+}
+
+/* Parse a literal such as true, false, null or a number */
+static const char *
+parse_literal (const char *ptr, char **strp)
+{
+	const char *end = ptr;
+
+	while (*end && strchr (",} \t\r\n", *end) == NULL)
+		end++;
+	if (end == ptr)
+		return NULL;
+
+	*strp = strndup (ptr, end - ptr);
+	if (!*strp)
+		return NULL;
+
+	return end;
+}
+
+static void
+free_request (DaemonRequest *req)
+{
+	for (unsigned int i = 0; i < req->param_num; i++) {
+		free (req->keys[i]);
+		free (req->values[i]);
+	}
+	req->param_num = 0;
+}
+
+/* Parse a flat JSON object */
+static int
+parse_request (const char *line, DaemonRequest *req)
+{
+	const char *ptr = skip_space (line);
+
+	memset (req, 0, sizeof(DaemonRequest));
+
+	if (*ptr++ != '{')
+		return -1;
+
+	ptr = skip_space (ptr);
+	if (*ptr == '}')
+		return *skip_space (ptr + 1) == '\0' ? 0 : -1;
+
+	while (1) {
+		unsigned int n = req->param_num;
+
+		if (n == DAEMON_MAX_PARAMS)
+			goto error;
+
+		ptr = parse_string (ptr, &req->keys[n]);
+		if (!ptr)
+			goto error;
+
+		ptr = skip_space (ptr);
+		if (*ptr++ != ':') {
+			free (req->keys[n]);
+			goto error;
+		}
+
+		ptr = skip_space (ptr);
+		if (*ptr == '"')
+			ptr = parse_string (ptr, &req->values[n]);
+		else
+			ptr = parse_literal (ptr, &req->values[n]);
+		if (!ptr) {
+			free (req->keys[n]);
+			goto error;
+		}
+		req->param_num++;
+
+		ptr = skip_space (ptr);
+		if (*ptr == '}')
+			break;
+		if (*ptr++ != ',')
+			goto error;
+		ptr = skip_space (ptr);
+	}
+
+	if (*skip_space (ptr + 1) != '\0')
+		goto error;
+
+	return 0;
+error:
+	free_request (req);
+	return -1;
+}
+
+const char *
+daemon_param (const DaemonRequest *req, const char *key)
+{
+	for (unsigned int i = 0; i < req->param_num; i++) {
+		if (strcmp (req->keys[i], key) == 0)
+			return req->values[i];
+	}
+
+	return NULL;
+}
+
+static void
+serve_line (const char *line, FILE *out, DaemonHandler handler, void *data)
+{
+	DaemonRequest req;
+	const char *error;
+	char *result = NULL;
+	size_t result_size = 0;
+	FILE *result_out;
+
+	if (parse_request (line, &req) < 0) {
+		fprintf (out, "{\"error\": \"invalid request\"}\n");
+		return;
+	}
+
+	result_out = open_memstream (&result, &result_size);
+	if (!result_out) {
+		fprintf (out, "{\"error\": \"out of memory\"}\n");
+		free_request (&req);
+		return;
+	}
+
+	error = handler (&req, result_out, data);
+	fclose (result_out);
+
+	if (error) {
+		fprintf (out, "{\"error\": ");
+		json_print_string (out, error);
+		fprintf (out, "}\n");
+	} else {
+		fprintf (out, "{\"result\": %s}\n", result_size ? result : "null");
+	}
+
+	free (result);
+	free_request (&req);
+}
+
+static void
+drop_client (Client *client)
+{
+	close (client->fd);
+	free (client->in);
+	free (client->out);
+	memset (client, 0, sizeof(Client));
+	client->fd = -1;
+}
+
+static uint64_t
+now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Answer the complete lines in the input buffer */
+static int
+serve_input (Client *client, DaemonHandler handler, void *data)
+{
+	char *line = client->in, *newline, *out_new;
+	char *result = NULL;
+	size_t result_size = 0;
+	FILE *out;
+
+	out = open_memstream (&result, &result_size);
+	if (!out)
+		return -1;
+
+	while (!daemon_stop &&
+	       (newline = memchr (line, '\n', client->in_len -
+					       (line - client->in)))) {
+		*newline = '\0';
+		if (*skip_space (line) != '\0')
+			serve_line (line, out, handler, data);
+		line = newline + 1;
+	}
+
+	if (line == client->in && client->in_len > MAX_LINE_SIZE) {
+		fprintf (out, "{\"error\": \"request too large\"}\n");
+		client->closing = 1;
+		client->in_len = 0;
+	} else {
+		client->in_len -= line - client->in;
+		memmove (client->in, line, client->in_len);
+	}
+	fclose (out);
+
+	if (result_size > 0) {
+		out_new = realloc (client->out, client->out_len + result_size);
+		if (!out_new) {
+			free (result);
+			return -1;
+		}
+		client->out = out_new;
+		memcpy (client->out + client->out_len, result, result_size);
+		client->out_len += result_size;
+
+		/* The next request gets its own time */
+		client->deadline = now_ms () + CLIENT_TIMEOUT * 1000;
+	}
+	free (result);
+
+	return 0;
+}
+
+static int
+read_client (Client *client, DaemonHandler handler, void *data)
+{
+	char *in_new;
+	ssize_t len;
+
+	if (client->in_size - client->in_len < READ_CHUNK_SIZE) {
+		in_new = realloc (client->in, client->in_size + READ_CHUNK_SIZE);
+		if (!in_new)
+			return -1;
+		client->in = in_new;
+		client->in_size += READ_CHUNK_SIZE;
+	}
+
+	len = read (client->fd, client->in + client->in_len,
+		    client->in_size - client->in_len);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	if (len == 0) {
+		/* Answer what was sent before the end of the input */
+		client->closing = 1;
+		return 0;
+	}
+	client->in_len += len;
+
+	return serve_input (client, handler, data);
+}
+
+static int
+write_client (Client *client)
+{
+	ssize_t len;
+
+	len = write (client->fd, client->out + client->out_sent,
+		     client->out_len - client->out_sent);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	client->out_sent += len;
+	if (client->out_sent == client->out_len)
+		client->out_sent = client->out_len = 0;
+
+	return 0;
+}
+
+static void
+accept_client (const int listen_fd, Client *clients)
+{
+	int fd;
+
+	fd = accept (listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	if (fcntl (fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl (fd, F_SETFD, FD_CLOEXEC) < 0) {
+		close (fd);
+		return;
+	}
+
+	for (unsigned int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0)
+			continue;
+		clients[i].fd = fd;
+		clients[i].deadline = now_ms () + CLIENT_TIMEOUT * 1000;
+		return;
+	}
+
+	close (fd);
+}
+
+/* Check whether a daemon is still listening on the socket */
+static int
+is_socket_alive (const struct sockaddr_un *addr)
+{
+	int fd, ret;
+
+	fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	ret = connect (fd, (const struct sockaddr *)addr, sizeof(*addr));
+	close (fd);
+	if (ret == 0)
+		return 1;
+
+	return errno == ECONNREFUSED ? 0 : -1;
+}
+
+static int
+create_socket (const char *socket_path)
+{
+	struct sockaddr_un addr;
+	struct stat buf;
+	mode_t old_mask;
+	int fd, ret;
+
+	if (strlen (socket_path) >= sizeof(addr.sun_path)) {
+		fprintf (stderr, "Socket path too long: %s\n", socket_path);
+		return -1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, socket_path);
+
+	/* Replace the socket left by the previous instance, not a live one */
+	if (lstat (socket_path, &buf) == 0) {
+		if (!S_ISSOCK (buf.st_mode)) {
+			fprintf (stderr, "%s exists and is not a socket\n",
+				 socket_path);
+			return -1;
+		}
+		ret = is_socket_alive (&addr);
+		if (ret != 0) {
+			if (ret > 0)
+				fprintf (stderr, "Another daemon is listening on %s\n",
+					 socket_path);
+			else
+				fprintf (stderr, "Failed to check %s: %m\n",
+					 socket_path);
+			return -1;
+		}
+		unlink (socket_path);
+	}
+
+	fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to create socket: %m\n");
+		return -1;
+	}
+
+	/* Create the socket with its final permissions, rw for the group */
+	old_mask = umask (S_IXUSR | S_IRWXO | S_IXGRP);
+	ret = bind (fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask (old_mask);
+
+	if (ret < 0 || listen (fd, 16) < 0) {
+		fprintf (stderr, "Failed to listen on %s: %m\n", socket_path);
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Serve the requests on the socket until SIGTERM or SIGINT */
+int
+run_daemon (const char *socket_path, DaemonHandler handler, void *data)
+{
+	struct sigaction action;
+	struct pollfd pfds[MAX_CLIENTS + 1];
+	Client clients[MAX_CLIENTS];
+	Client *slots[MAX_CLIENTS + 1];
+	unsigned int pfd_num, client_num;
+	uint64_t now, deadline;
+	int listen_fd, timeout, rc;
+
+	listen_fd = create_socket (socket_path);
+	if (listen_fd < 0)
+		return -1;
+
+	memset (&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigaction (SIGTERM, &action, NULL);
+	sigaction (SIGINT, &action, NULL);
+	action.sa_handler = SIG_IGN;
+	sigaction (SIGPIPE, &action, NULL);
+
+	memset (clients, 0, sizeof(clients));
+	for (unsigned int i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	while (!daemon_stop) {
+		/* Wait for the clients until the earliest deadline */
+		now = now_ms ();
+		deadline = 0;
+		pfd_num = client_num = 0;
+		for (unsigned int i = 0; i < MAX_CLIENTS; i++) {
+			Client *client = &clients[i];
+
+			if (client->fd < 0)
+				continue;
+			if (client->closing && client->out_len == 0) {
+				drop_client (client);
+				continue;
+			}
+			client_num++;
+
+			pfds[pfd_num].fd = client->fd;
+			pfds[pfd_num].events = client->out_len ? POLLOUT : POLLIN;
+			pfds[pfd_num].revents = 0;
+			slots[pfd_num++] = client;
+			if (!deadline || client->deadline < deadline)
+				deadline = client->deadline;
+		}
+
+		/* Leave the new connections in the backlog when full */
+		if (client_num < MAX_CLIENTS) {
+			pfds[pfd_num].fd = listen_fd;
+			pfds[pfd_num].events = POLLIN;
+			pfds[pfd_num].revents = 0;
+			slots[pfd_num++] = NULL;
+		}
+
+		timeout = -1;
+		if (deadline)
+			timeout = deadline > now ? (int)(deadline - now) : 0;
+
+		rc = poll (pfds, pfd_num, timeout);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf (stderr, "Failed to poll: %m\n");
+			break;
+		}
+
+		now = now_ms ();
+		for (unsigned int i = 0; i < pfd_num; i++) {
+			Client *client = slots[i];
+			short revents = pfds[i].revents;
+
+			if (!client) {
+				if (revents & POLLIN)
+					accept_client (listen_fd, clients);
+				continue;
+			}
+
+			if ((revents & POLLOUT) && write_client (client) < 0) {
+				drop_client (client);
+				continue;
+			}
+			if ((revents & POLLIN) &&
+			    read_client (client, handler, data) < 0) {
+				drop_client (client);
+				continue;
+			}
+			if ((revents & (POLLERR | POLLNVAL)) ||
+			    ((revents & POLLHUP) && !(revents & POLLIN))) {
+				drop_client (client);
+				continue;
+			}
+
+			/* A slow client can't hold the others */
+			if (now >= client->deadline)
+				drop_client (client);
+		}
+	}
+
+	for (unsigned int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0)
+			drop_client (&clients[i]);
+	}
+
+	close (listen_fd);
+	unlink (socket_path);
+
+	return 0;
+}
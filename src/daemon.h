@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <stdio.h>
+
+#define DAEMON_MAX_PARAMS 16
+
+/* A request is one JSON object per line with string or literal values,
+ * e.g. {"method": "test-key", "cert": "MIIC..."} */
+typedef struct {
+	char         *keys[DAEMON_MAX_PARAMS];
+	char         *values[DAEMON_MAX_PARAMS];
+	unsigned int  param_num;
+} DaemonRequest;
+
+/* Write the result in JSON to "out" and return NULL, or return the error */
+typedef const char *(*DaemonHandler) (const DaemonRequest *req, FILE *out,
+				      void *data);
+
+const char *daemon_param (const DaemonRequest *req, const char *key);
+int run_daemon (const char *socket_path, DaemonHandler handler, void *data);
+
+#endif /* __DAEMON_H__ */
@@ -31,36 +31,144 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <openssl/sha.h>
 
 #include "efi_hash.h"
 
+static void
+print_digest (const uint8_t *data, const uint32_t hash_size)
+{
+	for (unsigned int i = 0; i < hash_size; i++)
+		printf ("%02x", data[i]);
+}
+
+static void
+print_cert_hash (const uint8_t *data, const uint32_t hash_size)
+{
+	EFI_TIME time;
+
+	print_digest (data, hash_size);
+
+	/* The revocation time follows the digest */
+	memcpy (&time, data + hash_size, sizeof(time));
+	if (time.Year != 0)
+		printf (" revoked %04u-%02u-%02u %02u:%02u:%02u",
+			time.Year, time.Month, time.Day, time.Hour,
+			time.Minute, time.Second);
+}
+
+/*
+ * Scan a hash array for the digest. The size is a constant in each
+ * instance so that the comparison compiles to a few word compares.
+ */
+#define DEFINE_MATCH_HASH(hash_size, data_size)				\
+static int								\
+match_hash_##hash_size##_##data_size (const void *hash,			\
+				      const uint8_t *array,		\
+				      const uint32_t count)		\
+{									\
+	const uint32_t sig_size = sizeof(efi_guid_t) + data_size;	\
+	const uint8_t *ptr = array + sizeof(efi_guid_t);		\
+									\
+	for (uint32_t i = 0; i < count; i++, ptr += sig_size) {		\
+		if (memcmp (ptr, hash, hash_size) == 0)			\
+			return i;					\
+	}								\
+									\
+	return -1;							\
+}
+
+DEFINE_MATCH_HASH (20, 20)
+DEFINE_MATCH_HASH (28, 28)
+DEFINE_MATCH_HASH (32, 32)
+DEFINE_MATCH_HASH (48, 48)
+DEFINE_MATCH_HASH (64, 64)
+DEFINE_MATCH_HASH (256, 256)
+DEFINE_MATCH_HASH (32, 48)
+DEFINE_MATCH_HASH (48, 64)
+DEFINE_MATCH_HASH (64, 80)
+
+/*
+ * The known signature types, the most common ones first. The X.509
+ * certificate is the only type whose entries vary in size.
+ */
+static const SigType sig_types[] = {
+	{ &efi_guid_sha256,         "sha256",         32,  32,
+	  print_digest,    match_hash_32_32 },
+	{ &efi_guid_x509_cert,      "x509",           0,   0,
+	  NULL,            NULL },
+	{ &efi_guid_sha1,           "sha1",           20,  20,
+	  print_digest,    match_hash_20_20 },
+	{ &efi_guid_sha224,         "sha224",         28,  28,
+	  print_digest,    match_hash_28_28 },
+	{ &efi_guid_sha384,         "sha384",         48,  48,
+	  print_digest,    match_hash_48_48 },
+	{ &efi_guid_sha512,         "sha512",         64,  64,
+	  print_digest,    match_hash_64_64 },
+	{ &efi_guid_x509_sha256,    "x509_sha256",    48,  32,
+	  print_cert_hash, match_hash_32_48 },
+	{ &efi_guid_x509_sha384,    "x509_sha384",    64,  48,
+	  print_cert_hash, match_hash_48_64 },
+	{ &efi_guid_x509_sha512,    "x509_sha512",    80,  64,
+	  print_cert_hash, match_hash_64_80 },
+	{ &efi_guid_rsa2048,        "rsa2048",        256, 256,
+	  print_digest,    match_hash_256_256 },
+	{ &efi_guid_rsa2048_sha256, "rsa2048_sha256", 256, 256,
+	  print_digest,    match_hash_256_256 },
+	{ &efi_guid_rsa2048_sha1,   "rsa2048_sha1",   256, 256,
+	  print_digest,    match_hash_256_256 },
+};
+
+/* Look up the signature type with one 128-bit compare per known type */
+const SigType *
+find_sig_type (const efi_guid_t *type)
+{
+	uint64_t key[2], guid[2];
+
+	memcpy (key, type, sizeof(key));
+	for (unsigned int i = 0; i < sizeof(sig_types)/sizeof(sig_types[0]); i++) {
+		memcpy (guid, sig_types[i].guid, sizeof(guid));
+		if (((key[0] ^ guid[0]) | (key[1] ^ guid[1])) == 0)
+			return &sig_types[i];
+	}
+
+	return NULL;
+}
+
+/* Walk the registry, returning NULL past the last type */
+const SigType *
+get_sig_type (const unsigned int index)
+{
+	if (index >= sizeof(sig_types)/sizeof(sig_types[0]))
+		return NULL;
+
+	return &sig_types[index];
+}
+
+const char *
+sig_type_name (const efi_guid_t *type)
+{
+	const SigType *info = find_sig_type (type);
+
+	return info ? info->name : "unknown";
+}
+
 uint32_t
 efi_hash_size (const efi_guid_t *hash_type)
 {
-	if (efi_guid_cmp (hash_type, &efi_guid_sha1) == 0) {
-		return SHA_DIGEST_LENGTH;
-	} else if (efi_guid_cmp (hash_type, &efi_guid_sha224) == 0) {
-		return SHA224_DIGEST_LENGTH;
-	} else if (efi_guid_cmp (hash_type, &efi_guid_sha256) == 0) {
-		return SHA256_DIGEST_LENGTH;
-	} else if (efi_guid_cmp (hash_type, &efi_guid_sha384) == 0) {
-		return SHA384_DIGEST_LENGTH;
-	} else if (efi_guid_cmp (hash_type, &efi_guid_sha512) == 0) {
-		return SHA512_DIGEST_LENGTH;
-	}
+	const SigType *info = find_sig_type (hash_type);
 
-	return 0;
+	return info ? info->hash_size : 0;
 }
 
 uint32_t
 signature_size (const efi_guid_t *hash_type)
 {
-	uint32_t hash_size;
+	const SigType *info = find_sig_type (hash_type);
 
-	hash_size = efi_hash_size (hash_type);
-	if (hash_size)
-		return (hash_size + sizeof(efi_guid_t));
+	if (info && info->data_size)
+		return (info->data_size + sizeof(efi_guid_t));
 
 	return 0;
 }
@@ -69,7 +177,8 @@ int
 print_hash_array (const efi_guid_t *hash_type, const void *hash_array,
 		  const uint32_t array_size)
 {
-	uint32_t hash_size, remain;
+	const SigType *info;
+	uint32_t remain;
 	uint32_t sig_size;
 	uint8_t *hash;
 	char *name;
@@ -79,18 +188,25 @@ print_hash_array (const efi_guid_t *hash_type, const void *hash_array,
 		return -1;
 	}
 
+	info = find_sig_type (hash_type);
+	if (!info || !info->print) {
+		fprintf (stderr, "unknown hash type\n");
+		return -1;
+	}
+
 	int rc = efi_guid_to_name ((efi_guid_t *)hash_type, &name);
 	if (rc < 0 || isxdigit(name[0])) {
 		if (name)
 			free(name);
-		fprintf (stderr, "unknown hash type\n");
-		return -1;
+		name = NULL;
 	}
 
-	hash_size = efi_hash_size (hash_type);
-	sig_size = hash_size + sizeof(efi_guid_t);
+	sig_size = info->data_size + sizeof(efi_guid_t);
 
-	printf ("  [%s]\n", name);
+	if (name)
+		printf ("  [%s]\n", name);
+	else
+		printf ("  [{%s}]\n", info->name);
 	free(name);
 	remain = array_size;
 	hash = (uint8_t *)hash_array;
@@ -102,11 +218,9 @@ print_hash_array (const efi_guid_t *hash_type, const void *hash_array,
 		}
 
 		printf ("  ");
-		hash += sizeof(efi_guid_t);
-		for (unsigned int i = 0; i<hash_size; i++)
-			printf ("%02x", *(hash + i));
+		info->print (hash + sizeof(efi_guid_t), info->hash_size);
 		printf ("\n");
-		hash += hash_size;
+		hash += sig_size;
 		remain -= sig_size;
 	}
 
@@ -118,30 +232,20 @@ int
 match_hash_array (const efi_guid_t *hash_type, const void *hash,
 		  const void *hash_array, const uint32_t array_size)
 {
-	uint32_t hash_size, hash_count;
+	const SigType *info;
 	uint32_t sig_size;
-	void *ptr;
 
-	hash_size = efi_hash_size (hash_type);
-	if (!hash_size)
+	info = find_sig_type (hash_type);
+	if (!info || !info->match)
 		return -1;
 
-	sig_size = hash_size + sizeof(efi_guid_t);
+	sig_size = info->data_size + sizeof(efi_guid_t);
 	if ((array_size % sig_size) != 0) {
 		fprintf (stderr, "invalid hash array size\n");
 		return -1;
 	}
 
-	ptr = (void *)hash_array;
-	hash_count = array_size / sig_size;
-	for (unsigned int i = 0; i < hash_count; i++) {
-		ptr += sizeof(efi_guid_t);
-		if (memcmp (ptr, hash, hash_size) == 0)
-			return i;
-		ptr += hash_size;
-	}
-
-	return -1;
+	return info->match (hash, hash_array, array_size / sig_size);
 }
 
 /* Return the hash type and size of a given hash string */
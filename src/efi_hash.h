@@ -37,6 +37,19 @@
 
 #include "mokutil.h"
 
+typedef struct {
+	const efi_guid_t *guid;
+	const char       *name;
+	uint32_t          data_size;	/* entry size without the owner, 0 if it varies */
+	uint32_t          hash_size;	/* the digest at the start of the entry */
+	void (*print)(const uint8_t *data, const uint32_t hash_size);
+	int  (*match)(const void *hash, const uint8_t *array,
+		      const uint32_t count);
+} SigType;
+
+const SigType *find_sig_type (const efi_guid_t *type);
+const SigType *get_sig_type (const unsigned int index);
+const char *sig_type_name (const efi_guid_t *type);
 uint32_t efi_hash_size (const efi_guid_t *hash_type);
 uint32_t signature_size (const efi_guid_t *hash_type);
 int print_hash_array (const efi_guid_t *hash_type, const void *hash_array,
@@ -30,10 +30,27 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 
 #include "efi_x509.h"
+#include "perf.h"
+#include "probes.h"
+
+/* d2i_X509() with the time taken counted for --trace-perf */
+X509 *
+parse_x509 (const uint8_t **cert, const long cert_size)
+{
+	const uint64_t start = perf_start ();
+	X509 *X509cert;
+
+	X509cert = d2i_X509 (NULL, cert, cert_size);
+	perf_stop (PERF_X509_PARSE, start, cert_size, NULL);
+
+	return X509cert;
+}
 
 int
 print_x509 (const uint8_t *cert, const int cert_size)
@@ -45,7 +62,7 @@ print_x509 (const uint8_t *cert, const int cert_size)
 	const unsigned char *in = (const unsigned char *)cert;
 	unsigned char fingerprint[EVP_MAX_MD_SIZE];
 
-	X509cert = d2i_X509 (NULL, &in, cert_size);
+	X509cert = parse_x509 (&in, cert_size);
 	if (X509cert == NULL) {
 		fprintf (stderr, "Invalid X509 certificate\n");
 		return -1;
@@ -103,7 +120,7 @@ is_valid_cert (const uint8_t *cert, const uint32_t cert_size)
 	if (cert == NULL)
 		return 0;
 
-	X509cert = d2i_X509 (NULL, &cert, cert_size);
+	X509cert = parse_x509 (&cert, cert_size);
 	if (X509cert == NULL)
 		return 0;
 
@@ -123,6 +140,7 @@ is_immediate_ca (const uint8_t *cert, const uint32_t cert_size,
 	X509 *X509ca = NULL;
 	X509_STORE *cert_store = NULL;
 	X509_STORE_CTX *cert_ctx = NULL;
+	uint64_t start, probe_start;
 	int ret = 0;
 
 	if (cert == NULL || ca_cert == NULL)
@@ -135,14 +153,21 @@ is_immediate_ca (const uint8_t *cert, const uint32_t cert_size,
 	if (EVP_add_digest (EVP_sha256 ()) == 0)
 		return 0;
 
-	X509cert = d2i_X509 (NULL, &cert, cert_size);
+	start = perf_start ();
+	probe_start = PROBE_START (x509__verify);
+
+	X509cert = parse_x509 (&cert, cert_size);
 	if (X509cert == NULL)
-		return 0;
+		goto err;
 
-	X509ca = d2i_X509 (NULL, &ca_cert, ca_cert_size);
+	X509ca = parse_x509 (&ca_cert, ca_cert_size);
 	if (X509ca == NULL)
 		goto err;
 
+	/* Skip building the store unless the names and key ids match */
+	if (X509_check_issued (X509ca, X509cert) != X509_V_OK)
+		goto err;
+
 	cert_store = X509_STORE_new ();
 	if (cert_store == NULL)
 		goto err;
@@ -182,6 +207,10 @@ err:
 	if (cert_store)
 		X509_STORE_CTX_free (cert_ctx);
 
+	perf_stop (PERF_CA_CHECK, start, cert_size + ca_cert_size, NULL);
+	PROBE4 (x509__verify, cert_size, ca_cert_size, ret,
+		PROBE_ELAPSED (probe_start));
+
 	return ret;
 }
 
@@ -205,7 +234,7 @@ get_cert_skid(const uint8_t *cert, const uint32_t cert_size, char **skid)
 	char *id_str, *ptr;
 	int ret = -1;
 
-	X509cert = d2i_X509 (NULL, &cert, cert_size);
+	X509cert = parse_x509 (&cert, cert_size);
 	if (X509cert == NULL) {
 		fprintf (stderr, "invalid x509 certificate\n");
 		goto out;
@@ -240,3 +269,156 @@ out:
 
 	return ret;
 }
+
+/**
+ * Get the expiry time and the subject of the given certificate
+ *
+ * The expiry time is returned in seconds relative to now, so it is negative
+ * for an expired certificate. The subject string is allocated and the caller
+ * is responsible to free it.
+ *
+ * Return value:
+ * -  0 : Success
+ * - -1 : Error
+ */
+int
+get_cert_validity (const uint8_t *cert, const uint32_t cert_size,
+		   int64_t *not_after, char **subject)
+{
+	X509 *X509cert;
+	char *name;
+	int day, sec;
+	int ret = -1;
+
+	X509cert = parse_x509 (&cert, cert_size);
+	if (X509cert == NULL)
+		return -1;
+
+	if (!ASN1_TIME_diff (&day, &sec, NULL, X509_get0_notAfter (X509cert)))
+		goto out;
+
+	name = X509_NAME_oneline (X509_get_subject_name (X509cert), NULL, 0);
+	if (name == NULL)
+		goto out;
+
+	*subject = strdup (name);
+	OPENSSL_free (name);
+	if (*subject == NULL)
+		goto out;
+
+	*not_after = (int64_t)day * 86400 + sec;
+	ret = 0;
+out:
+	X509_free (X509cert);
+
+	return ret;
+}
+
+static char *
+dup_x509_name (const X509_NAME *x509_name)
+{
+	char *name, *str;
+
+	name = X509_NAME_oneline (x509_name, NULL, 0);
+	if (name == NULL)
+		return NULL;
+
+	str = strdup (name);
+	OPENSSL_free (name);
+
+	return str;
+}
+
+/* The names of the public key algorithms, as --audit matches them */
+static const char *
+get_key_type_name (const EVP_PKEY *pkey)
+{
+	if (!pkey)
+		return "unknown";
+
+	switch (EVP_PKEY_base_id (pkey)) {
+	case EVP_PKEY_RSA:
+		return "rsa";
+#ifdef EVP_PKEY_RSA_PSS
+	case EVP_PKEY_RSA_PSS:
+		return "rsa-pss";
+#endif
+	case EVP_PKEY_DSA:
+		return "dsa";
+	case EVP_PKEY_EC:
+		return "ec";
+#ifdef EVP_PKEY_ED25519
+	case EVP_PKEY_ED25519:
+		return "ed25519";
+	case EVP_PKEY_ED448:
+		return "ed448";
+#endif
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Get the fields of the certificate which the policies look at, parsing
+ * the certificate only once. The strings are allocated and released with
+ * free_cert_info().
+ *
+ * Return value:
+ * -  0 : Success
+ * - -1 : Error
+ */
+int
+get_cert_info (const uint8_t *cert, const uint32_t cert_size, CertInfo *info)
+{
+	X509 *X509cert;
+	const ASN1_OCTET_STRING *asn1_id;
+	EVP_PKEY *pkey;
+	const uint8_t *id;
+	int day, sec;
+
+	memset (info, 0, sizeof(CertInfo));
+
+	X509cert = parse_x509 (&cert, cert_size);
+	if (X509cert == NULL)
+		return -1;
+
+	info->subject = dup_x509_name (X509_get_subject_name (X509cert));
+	info->issuer = dup_x509_name (X509_get_issuer_name (X509cert));
+	if (!info->subject || !info->issuer)
+		goto error;
+
+	asn1_id = X509_get0_subject_key_id (X509cert);
+	if (asn1_id) {
+		id = ASN1_STRING_get0_data (asn1_id);
+		info->skid = malloc (ASN1_STRING_length (asn1_id) * 2 + 1);
+		if (!info->skid)
+			goto error;
+		info->skid[0] = '\0';
+		for (int i = 0; i < ASN1_STRING_length (asn1_id); i++)
+			snprintf (info->skid + i * 2, 3, "%02x", id[i]);
+	}
+
+	pkey = X509_get0_pubkey (X509cert);
+	info->key_bits = pkey ? EVP_PKEY_bits (pkey) : 0;
+	info->key_type = get_key_type_name (pkey);
+
+	if (!ASN1_TIME_diff (&day, &sec, NULL, X509_get0_notAfter (X509cert)))
+		goto error;
+	info->not_after = (int64_t)day * 86400 + sec;
+
+	X509_free (X509cert);
+	return 0;
+error:
+	X509_free (X509cert);
+	free_cert_info (info);
+	return -1;
+}
+
+void
+free_cert_info (CertInfo *info)
+{
+	free (info->subject);
+	free (info->issuer);
+	free (info->skid);
+	memset (info, 0, sizeof(CertInfo));
+}
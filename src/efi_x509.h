@@ -33,11 +33,28 @@
 #define __EFI_X509_H__
 
 #include <stdint.h>
+#include <openssl/x509.h>
 
+X509 *parse_x509 (const uint8_t **cert, const long cert_size);
 int print_x509 (const uint8_t *cert, const int cert_size);
 int is_valid_cert (const uint8_t *cert, const uint32_t cert_size);
 int is_immediate_ca (const uint8_t *cert, const uint32_t cert_size,
 		     const uint8_t *ca_cert, const uint32_t ca_cert_size);
 int get_cert_skid(const uint8_t *cert, const uint32_t cert_size, char **skid);
+int get_cert_validity (const uint8_t *cert, const uint32_t cert_size,
+		       int64_t *not_after, char **subject);
+
+typedef struct {
+	char    *subject;
+	char    *issuer;
+	char    *skid;		/* NULL without the extension */
+	int      key_bits;
+	const char *key_type;	/* "rsa", "ec"... or "unknown" */
+	int64_t  not_after;	/* seconds relative to now */
+} CertInfo;
+
+int get_cert_info (const uint8_t *cert, const uint32_t cert_size,
+		   CertInfo *info);
+void free_cert_info (CertInfo *info);
 
 #endif /* __EFI_X509_H__ */
@@ -0,0 +1,451 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "signature.h"
+#include "efi_x509.h"
+#include "esl_file.h"
+#include "snapshot.h"
+
+/* Drop the pages of the file which have been parsed in chunks of this size */
+#define RELEASE_CHUNK_SIZE (16 * 1024 * 1024)
+
+static int
+read_fd (const int fd, uint8_t **bufp, size_t *sizep)
+{
+	uint8_t *buf = NULL, *buf_new;
+	size_t size = 0, alloced = 0;
+	ssize_t rc;
+
+	while (1) {
+		if (size == alloced) {
+			alloced = alloced ? alloced * 2 : 65536;
+			buf_new = realloc (buf, alloced);
+			if (!buf_new) {
+				free (buf);
+				return -1;
+			}
+			buf = buf_new;
+		}
+
+		rc = read (fd, buf + size, alloced - size);
+		if (rc < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			free (buf);
+			return -1;
+		} else if (rc == 0) {
+			break;
+		}
+		size += rc;
+	}
+
+	*bufp = buf;
+	*sizep = size;
+
+	return 0;
+}
+
+/* Check that the data is a sequence of well-formed signature lists */
+static int
+is_valid_esl (const uint8_t *data, const size_t data_size)
+{
+	const EFI_SIGNATURE_LIST *list;
+	size_t remain = data_size;
+
+	while (remain > 0) {
+		list = (const EFI_SIGNATURE_LIST *)data;
+		if (remain < sizeof(EFI_SIGNATURE_LIST) ||
+		    list->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) ||
+		    list->SignatureListSize > remain ||
+		    list->SignatureHeaderSize > list->SignatureListSize -
+						sizeof(EFI_SIGNATURE_LIST))
+			return 0;
+
+		data += list->SignatureListSize;
+		remain -= list->SignatureListSize;
+	}
+
+	return 1;
+}
+
+static int
+append_cert_list (uint8_t **bufp, size_t *sizep, size_t *alloced,
+		  X509 *cert)
+{
+	EFI_SIGNATURE_LIST *CertList;
+	EFI_SIGNATURE_DATA *CertData;
+	uint8_t *buf_new, *ptr;
+	size_t list_size;
+	int cert_size;
+
+	cert_size = i2d_X509 (cert, NULL);
+	if (cert_size <= 0)
+		return -1;
+
+	list_size = sizeof(EFI_SIGNATURE_LIST) + sizeof(efi_guid_t) + cert_size;
+	if (*sizep + list_size > *alloced) {
+		*alloced = (*sizep + list_size) * 2;
+		buf_new = realloc (*bufp, *alloced);
+		if (!buf_new)
+			return -1;
+		*bufp = buf_new;
+	}
+
+	CertList = (EFI_SIGNATURE_LIST *)(*bufp + *sizep);
+	CertData = (EFI_SIGNATURE_DATA *)(*bufp + *sizep +
+					  sizeof(EFI_SIGNATURE_LIST));
+
+	CertList->SignatureType = efi_guid_x509_cert;
+	CertList->SignatureListSize = list_size;
+	CertList->SignatureHeaderSize = 0;
+	CertList->SignatureSize = cert_size + sizeof(efi_guid_t);
+	CertData->SignatureOwner = efi_guid_shim;
+
+	ptr = CertData->SignatureData;
+	i2d_X509 (cert, &ptr);
+	*sizep += list_size;
+
+	return 0;
+}
+
+/* Convert the DER certificate or the PEM bundle into signature lists */
+static int
+certs_to_esl (EslFile *file, const uint8_t *data, const size_t data_size)
+{
+	uint8_t *buf = NULL;
+	size_t size = 0, alloced = 0;
+	const uint8_t *in = data;
+	X509 *cert;
+	BIO *bio;
+	int ret = -1;
+
+	if (file->format == ESL_FORMAT_DER) {
+		cert = parse_x509 (&in, data_size);
+		if (cert == NULL)
+			return -1;
+		ret = append_cert_list (&buf, &size, &alloced, cert);
+		X509_free (cert);
+		if (ret < 0)
+			goto error;
+	} else {
+		if (data_size > INT32_MAX)
+			return -1;
+
+		bio = BIO_new_mem_buf (data, data_size);
+		if (bio == NULL)
+			return -1;
+
+		while ((cert = PEM_read_bio_X509 (bio, NULL, NULL, NULL))) {
+			ret = append_cert_list (&buf, &size, &alloced, cert);
+			X509_free (cert);
+			if (ret < 0) {
+				BIO_free (bio);
+				goto error;
+			}
+		}
+		BIO_free (bio);
+
+		if (size == 0) {
+			fprintf (stderr, "No certificate in the PEM file\n");
+			goto error;
+		}
+	}
+
+	free (file->buf);
+	file->buf = buf;
+	file->data = buf;
+	file->data_size = size;
+
+	return 0;
+error:
+	free (buf);
+	return -1;
+}
+
+/* Pick the key database from a snapshot made by --capture */
+static int
+snapshot_to_esl (EslFile *file, const uint8_t *data, const size_t data_size,
+		 const char *var_name)
+{
+	Snapshot snap;
+	uint8_t *buf;
+
+	if (snapshot_load (data, data_size, &snap) < 0)
+		return -1;
+
+	file->format = ESL_FORMAT_SNAPSHOT;
+	if (snapshot_get_db (&snap, var_name, &file->data, &file->data_size,
+			     &buf) < 0) {
+		if (errno != ENOENT)
+			return -1;
+		file->data = NULL;
+		file->data_size = 0;
+		return 0;
+	}
+
+	if (!is_valid_esl (file->data, file->data_size)) {
+		free (buf);
+		fprintf (stderr, "Corrupted %s in the snapshot\n", var_name);
+		return -1;
+	}
+
+	if (buf) {
+		free (file->buf);
+		file->buf = buf;
+	}
+
+	return 0;
+}
+
+static int
+identify_format (EslFile *file, const uint8_t *data, const size_t data_size,
+		 const char *var_name)
+{
+	const EFI_VARIABLE_AUTHENTICATION_2 *auth;
+	const uint8_t *in = data;
+	efi_guid_t cert_type;
+	uint32_t attributes;
+	size_t auth_size;
+	X509 *cert;
+
+	if (is_snapshot (data, data_size))
+		return snapshot_to_esl (file, data, data_size, var_name);
+
+	/* Time-based authenticated variable payload (.auth) */
+	auth = (const EFI_VARIABLE_AUTHENTICATION_2 *)data;
+	if (data_size >= sizeof(EFI_VARIABLE_AUTHENTICATION_2))
+		cert_type = auth->AuthInfo.CertType;
+	if (data_size >= sizeof(EFI_VARIABLE_AUTHENTICATION_2) &&
+	    auth->AuthInfo.Hdr.wRevision == WIN_CERT_REVISION_2_0 &&
+	    auth->AuthInfo.Hdr.wCertificateType == WIN_CERT_TYPE_EFI_GUID &&
+	    efi_guid_cmp (&cert_type, &efi_guid_pkcs7_cert) == 0) {
+		auth_size = sizeof(EFI_TIME) + auth->AuthInfo.Hdr.dwLength;
+		if (auth->AuthInfo.Hdr.dwLength < sizeof(WIN_CERTIFICATE_UEFI_GUID) ||
+		    auth_size > data_size ||
+		    !is_valid_esl (data + auth_size, data_size - auth_size)) {
+			fprintf (stderr, "Corrupted authenticated variable\n");
+			return -1;
+		}
+		file->format = ESL_FORMAT_AUTH;
+		file->data = data + auth_size;
+		file->data_size = data_size - auth_size;
+		return 0;
+	}
+
+	/* Variable copied from efivarfs with the leading attributes */
+	if (data_size > sizeof(uint32_t)) {
+		memcpy (&attributes, data, sizeof(uint32_t));
+		if (attributes != 0 && (attributes & ~0x7fU) == 0 &&
+		    is_valid_esl (data + sizeof(uint32_t),
+				  data_size - sizeof(uint32_t))) {
+			file->format = ESL_FORMAT_EFIVARFS;
+			file->data = data + sizeof(uint32_t);
+			file->data_size = data_size - sizeof(uint32_t);
+			return 0;
+		}
+	}
+
+	/* PEM bundle */
+	for (size_t i = 0; i < data_size; i++) {
+		if (data[i] == ' ' || data[i] == '\t' ||
+		    data[i] == '\r' || data[i] == '\n')
+			continue;
+		if (data_size - i > 10 &&
+		    memcmp (data + i, "-----BEGIN", 10) == 0) {
+			file->format = ESL_FORMAT_PEM;
+			return certs_to_esl (file, data, data_size);
+		}
+		break;
+	}
+
+	/* Single DER certificate */
+	if (data[0] == 0x30) {
+		cert = parse_x509 (&in, data_size);
+		if (cert) {
+			X509_free (cert);
+			if (in == data + data_size) {
+				file->format = ESL_FORMAT_DER;
+				return certs_to_esl (file, data, data_size);
+			}
+		}
+	}
+
+	/* Raw signature lists */
+	if (is_valid_esl (data, data_size)) {
+		file->format = ESL_FORMAT_ESL;
+		file->data = data;
+		file->data_size = data_size;
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Open a file holding signature lists
+ *
+ * Regular files are memory-mapped and parsed in place. The file may contain
+ * raw signature lists, a time-based authenticated variable payload, or a
+ * variable copied from efivarfs. A DER certificate or a PEM bundle is
+ * converted into signature lists. "-" reads from the standard input.
+ *
+ * For a snapshot made by --capture, the signature lists are those of the
+ * variable named var_name, MokListRT if NULL.
+ */
+int
+esl_file_open_var (const char *path, const char *var_name, EslFile *file)
+{
+	struct stat sb;
+	const uint8_t *data;
+	size_t data_size;
+	void *map;
+	int fd;
+
+	memset (file, 0, sizeof(EslFile));
+
+	if (strcmp (path, "-") == 0)
+		fd = STDIN_FILENO;
+	else
+		fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to open %s: %m\n", path);
+		return -1;
+	}
+
+	if (fstat (fd, &sb) < 0) {
+		fprintf (stderr, "Failed to get file status, %s\n", path);
+		goto error;
+	}
+
+	if (S_ISREG (sb.st_mode) && sb.st_size > 0) {
+		map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf (stderr, "Failed to map %s: %m\n", path);
+			goto error;
+		}
+		madvise (map, sb.st_size, MADV_SEQUENTIAL);
+		file->map = map;
+		file->map_size = sb.st_size;
+		data = file->map;
+		data_size = file->map_size;
+	} else {
+		if (read_fd (fd, &file->buf, &data_size) < 0) {
+			fprintf (stderr, "Failed to read %s: %m\n", path);
+			goto error;
+		}
+		data = file->buf;
+	}
+
+	if (fd != STDIN_FILENO)
+		close (fd);
+	fd = -1;
+
+	if (data_size == 0) {
+		fprintf (stderr, "%s is empty\n", path);
+		goto error;
+	}
+
+	if (identify_format (file, data, data_size,
+			     var_name ? var_name : "MokListRT") < 0) {
+		fprintf (stderr, "Unknown format or corrupted data in %s\n", path);
+		goto error;
+	}
+
+	return 0;
+error:
+	if (fd >= 0 && fd != STDIN_FILENO)
+		close (fd);
+	esl_file_close (file);
+	return -1;
+}
+
+int
+esl_file_open (const char *path, EslFile *file)
+{
+	return esl_file_open_var (path, NULL, file);
+}
+
+/* Tell the kernel that the data before the offset won't be used again */
+void
+esl_file_release (EslFile *file, const size_t offset)
+{
+	long page_size = sysconf (_SC_PAGESIZE);
+	size_t end;
+
+	if (!file->map || file->data < file->map ||
+	    file->data >= file->map + file->map_size)
+		return;
+
+	end = (file->data - file->map) + offset;
+	end -= end % page_size;
+	if (end < file->released + RELEASE_CHUNK_SIZE)
+		return;
+
+	madvise (file->map + file->released, end - file->released,
+		 MADV_DONTNEED);
+	file->released = end;
+}
+
+void
+esl_file_close (EslFile *file)
+{
+	if (file->map)
+		munmap (file->map, file->map_size);
+	free (file->buf);
+	memset (file, 0, sizeof(EslFile));
+}
+
+const char *
+esl_format_name (const EslFormat format)
+{
+	const char *format_names[] = {
+		[ESL_FORMAT_ESL]      = "EFI signature list",
+		[ESL_FORMAT_AUTH]     = "authenticated variable",
+		[ESL_FORMAT_EFIVARFS] = "efivarfs variable",
+		[ESL_FORMAT_DER]      = "DER certificate",
+		[ESL_FORMAT_PEM]      = "PEM bundle",
+		[ESL_FORMAT_SNAPSHOT] = "snapshot",
+	};
+
+	return format_names[format];
+}
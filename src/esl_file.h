@@ -0,0 +1,63 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __ESL_FILE_H__
+#define __ESL_FILE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+	ESL_FORMAT_ESL = 0,
+	ESL_FORMAT_AUTH,
+	ESL_FORMAT_EFIVARFS,
+	ESL_FORMAT_DER,
+	ESL_FORMAT_PEM,
+	ESL_FORMAT_SNAPSHOT,
+} EslFormat;
+
+typedef struct {
+	EslFormat      format;
+	uint8_t       *map;		/* the memory-mapped file */
+	size_t         map_size;
+	uint8_t       *buf;		/* allocated data for non-mappable input */
+	size_t         released;	/* bytes of the mapping already dropped */
+	const uint8_t *data;		/* the signature lists */
+	size_t         data_size;
+} EslFile;
+
+int esl_file_open (const char *path, EslFile *file);
+int esl_file_open_var (const char *path, const char *var_name, EslFile *file);
+void esl_file_release (EslFile *file, const size_t offset);
+void esl_file_close (EslFile *file);
+const char *esl_format_name (const EslFormat format);
+
+#endif /* __ESL_FILE_H__ */
@@ -0,0 +1,316 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eventlog.h"
+
+#define SPEC_ID_SIGNATURE "Spec ID Event03"
+/* The largest event seen in the wild is a dbx of a few hundred KB */
+#define MAX_EVENT_SIZE    (16 * 1024 * 1024)
+
+typedef struct {
+	uint16_t alg;
+	uint16_t size;
+} DigestAlg;
+
+typedef struct {
+	FILE     *fp;
+	uint8_t  *buf;		/* the event data, reused for every event */
+	uint32_t  buf_size;
+	DigestAlg algs[EVENTLOG_MAX_BANKS];
+	uint32_t  alg_num;
+} EventLog;
+
+/*
+ * Returns 1 on success, or 0 if the log ends before the read. The log may
+ * only end at the start of an event.
+ */
+static int
+read_log (EventLog *log, void *buf, const size_t size, const int at_event)
+{
+	size_t nread;
+
+	if (size == 0)
+		return 1;
+
+	nread = fread (buf, 1, size, log->fp);
+	if (nread == size)
+		return 1;
+
+	if (ferror (log->fp)) {
+		fprintf (stderr, "Failed to read the event log: %m\n");
+		return -1;
+	}
+
+	return (at_event && nread == 0) ? 0 : -1;
+}
+
+static int
+read_u32 (EventLog *log, uint32_t *value, const int at_event)
+{
+	return read_log (log, value, sizeof(*value), at_event);
+}
+
+static int
+read_event_data (EventLog *log, const uint32_t size)
+{
+	uint8_t *buf_new;
+
+	if (size > MAX_EVENT_SIZE) {
+		fprintf (stderr, "Event of %u bytes is too large\n", size);
+		return -1;
+	}
+
+	if (size > log->buf_size) {
+		buf_new = realloc (log->buf, size);
+		if (!buf_new) {
+			fprintf (stderr, "Failed to allocate space: %m\n");
+			return -1;
+		}
+		log->buf = buf_new;
+		log->buf_size = size;
+	}
+
+	return read_log (log, log->buf, size, 0);
+}
+
+/*
+ * The first event is always in the SHA-1 format. For a crypto agile log,
+ * it carries the digest sizes of the algorithms in the later events.
+ */
+static int
+parse_spec_id (EventLog *log, const uint32_t data_size)
+{
+	const uint8_t *ptr = log->buf;
+	uint32_t alg_num;
+
+	/* signature[16], platformClass, version[3], uintnSize, numberOfAlgorithms */
+	if (data_size < 28 ||
+	    memcmp (ptr, SPEC_ID_SIGNATURE, sizeof(SPEC_ID_SIGNATURE)) != 0)
+		return 0;
+
+	memcpy (&alg_num, ptr + 24, sizeof(alg_num));
+	if (alg_num == 0 || alg_num > EVENTLOG_MAX_BANKS ||
+	    data_size < 28 + alg_num * 4) {
+		fprintf (stderr, "Invalid Spec ID event\n");
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < alg_num; i++) {
+		memcpy (&log->algs[i].alg, ptr + 28 + i * 4, sizeof(uint16_t));
+		memcpy (&log->algs[i].size, ptr + 30 + i * 4, sizeof(uint16_t));
+		if (log->algs[i].size > EVENTLOG_MAX_DIGEST) {
+			fprintf (stderr, "Invalid digest size in Spec ID event\n");
+			return -1;
+		}
+	}
+	log->alg_num = alg_num;
+
+	return 0;
+}
+
+static int
+parse_digests (EventLog *log, TcgDigest *digests, uint32_t *digest_num)
+{
+	uint32_t count;
+	uint16_t alg;
+	uint32_t i;
+
+	if (read_u32 (log, &count, 0) <= 0)
+		return -1;
+
+	if (count > EVENTLOG_MAX_BANKS) {
+		fprintf (stderr, "Too many digests in an event\n");
+		return -1;
+	}
+
+	for (uint32_t n = 0; n < count; n++) {
+		if (read_log (log, &alg, sizeof(alg), 0) <= 0)
+			return -1;
+
+		for (i = 0; i < log->alg_num; i++) {
+			if (log->algs[i].alg == alg)
+				break;
+		}
+		if (i == log->alg_num) {
+			fprintf (stderr, "Unknown digest algorithm 0x%04x\n", alg);
+			return -1;
+		}
+
+		digests[n].alg = alg;
+		digests[n].size = log->algs[i].size;
+		if (read_log (log, digests[n].value, digests[n].size, 0) <= 0)
+			return -1;
+	}
+	*digest_num = count;
+
+	return 0;
+}
+
+/*
+ * Walk the events of a TPM 1.2 or crypto agile TPM 2.0 event log in one
+ * pass. Only the current event is kept in memory.
+ */
+int
+eventlog_parse (FILE *fp, TcgEventFunc func, void *data)
+{
+	EventLog log;
+	TcgEvent event;
+	TcgDigest digests[EVENTLOG_MAX_BANKS];
+	uint32_t header[2];
+	uint32_t data_size;
+	int first = 1, rc, ret = -1;
+
+	memset (&log, 0, sizeof(log));
+	log.fp = fp;
+
+	while (1) {
+		rc = read_log (&log, header, sizeof(header), 1);
+		if (rc < 0)
+			goto truncated;
+		if (rc == 0)
+			break;
+
+		event.pcr = header[0];
+		event.type = header[1];
+
+		if (first || log.alg_num == 0) {
+			digests[0].alg = TPM_ALG_SHA1;
+			digests[0].size = 20;
+			if (read_log (&log, digests[0].value, 20, 0) <= 0)
+				goto truncated;
+			event.digest_num = 1;
+		} else if (parse_digests (&log, digests, &event.digest_num) < 0) {
+			goto truncated;
+		}
+		event.digests = digests;
+
+		/* Keep SHA-256, or SHA-1 if that's all there is */
+		event.digest_alg = 0;
+		event.digest = NULL;
+		event.digest_size = 0;
+		for (uint32_t i = 0; i < event.digest_num; i++) {
+			if (digests[i].alg == TPM_ALG_SHA256 ||
+			    (digests[i].alg == TPM_ALG_SHA1 && !event.digest)) {
+				event.digest_alg = digests[i].alg;
+				event.digest = digests[i].value;
+				event.digest_size = digests[i].size;
+			}
+		}
+
+		if (read_u32 (&log, &data_size, 0) <= 0 ||
+		    read_event_data (&log, data_size) <= 0)
+			goto truncated;
+		event.data = log.buf;
+		event.data_size = data_size;
+
+		if (first && event.type == EV_NO_ACTION &&
+		    parse_spec_id (&log, data_size) < 0)
+			goto error;
+		first = 0;
+
+		if (func (&event, data) < 0)
+			goto error;
+	}
+
+	ret = 0;
+	goto error;
+truncated:
+	if (!ferror (fp))
+		fprintf (stderr, "The event log is truncated\n");
+error:
+	free (log.buf);
+
+	return ret;
+}
+
+const char *
+eventlog_alg_name (const uint16_t alg)
+{
+	switch (alg) {
+	case TPM_ALG_SHA1:
+		return "sha1";
+	case TPM_ALG_SHA256:
+		return "sha256";
+	case TPM_ALG_SHA384:
+		return "sha384";
+	case TPM_ALG_SHA512:
+		return "sha512";
+	case TPM_ALG_SM3_256:
+		return "sm3";
+	}
+
+	return NULL;
+}
+
+/* Decode the UEFI_VARIABLE_DATA of the EFI variable events */
+int
+eventlog_variable (const TcgEvent *event, efi_guid_t *guid, char *name,
+		   const size_t name_size, const uint8_t **var_datap,
+		   size_t *var_sizep)
+{
+	const uint8_t *ptr = event->data;
+	uint64_t name_len, var_size;
+	size_t header_size = sizeof(efi_guid_t) + 2 * sizeof(uint64_t);
+	size_t i;
+
+	if (event->data_size < header_size)
+		return -1;
+
+	memcpy (guid, ptr, sizeof(efi_guid_t));
+	memcpy (&name_len, ptr + sizeof(efi_guid_t), sizeof(name_len));
+	memcpy (&var_size, ptr + sizeof(efi_guid_t) + sizeof(name_len),
+		sizeof(var_size));
+
+	if (name_len >= name_size ||
+	    name_len * 2 > event->data_size - header_size ||
+	    var_size > event->data_size - header_size - name_len * 2)
+		return -1;
+
+	/* The variable names we look for are plain ASCII */
+	ptr += header_size;
+	for (i = 0; i < name_len; i++) {
+		uint16_t c;
+
+		memcpy (&c, ptr + i * 2, sizeof(c));
+		name[i] = (c > 0 && c < 0x80) ? (char)c : '?';
+	}
+	name[i] = '\0';
+
+	*var_datap = ptr + name_len * 2;
+	*var_sizep = var_size;
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __EVENTLOG_H__
+#define __EVENTLOG_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <efivar.h>
+
+#define EVENTLOG_DEFAULT_PATH "/sys/kernel/security/tpm0/binary_bios_measurements"
+
+/* The event types of the TCG PC Client Platform Firmware Profile */
+#define EV_NO_ACTION                  0x00000003
+#define EV_IPL                        0x0000000d
+#define EV_EFI_VARIABLE_DRIVER_CONFIG 0x80000001
+#define EV_EFI_VARIABLE_BOOT          0x80000002
+#define EV_EFI_VARIABLE_AUTHORITY     0x800000e0
+
+#define TPM_ALG_SHA1    0x0004
+#define TPM_ALG_SHA256  0x000b
+#define TPM_ALG_SHA384  0x000c
+#define TPM_ALG_SHA512  0x000d
+#define TPM_ALG_SM3_256 0x0012
+
+#define EVENTLOG_MAX_BANKS  16
+#define EVENTLOG_MAX_DIGEST 64
+
+typedef struct {
+	uint16_t alg;
+	uint16_t size;
+	uint8_t  value[EVENTLOG_MAX_DIGEST];
+} TcgDigest;
+
+typedef struct {
+	uint32_t         pcr;
+	uint32_t         type;
+	uint16_t         digest_alg;	/* SHA-256 if the log has it, or SHA-1 */
+	const uint8_t   *digest;
+	uint16_t         digest_size;
+	const TcgDigest *digests;	/* one per PCR bank */
+	uint32_t         digest_num;
+	const uint8_t   *data;		/* only valid during the callback */
+	uint32_t         data_size;
+} TcgEvent;
+
+/* Return a negative value to stop parsing */
+typedef int (*TcgEventFunc)(const TcgEvent *event, void *data);
+
+int eventlog_parse (FILE *fp, TcgEventFunc func, void *data);
+const char *eventlog_alg_name (const uint16_t alg);
+int eventlog_variable (const TcgEvent *event, efi_guid_t *guid, char *name,
+		       const size_t name_size, const uint8_t **var_datap,
+		       size_t *var_sizep);
+
+#endif /* __EVENTLOG_H__ */
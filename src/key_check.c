@@ -0,0 +1,255 @@
+/**
+ * Copyright (C) 2012-2020 Gary Lin <glin@suse.com>
+ * Copyright (C) 2012 Matthew Garrett <mjg@redhat.com>
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include <stdlib.h>
+
+#include <efivar.h>
+
+#include "efi_x509.h"
+#include "key_check.h"
+#include "keyring.h"
+#include "sig_index.h"
+#include "var_cache.h"
+
+/*
+ * Check whether the certificate or the hash is in the key database. Return
+ * -1 with errno set if the database couldn't be read.
+ */
+int
+is_duplicate (const efi_guid_t *type,
+	      const void *data, const uint32_t data_size,
+	      const efi_guid_t *vendor, const char *db_name)
+{
+	const CachedVar *var;
+
+	if (!data || data_size == 0)
+		return 0;
+
+	var = var_cache_get (db_name, *vendor);
+	if (!var)
+		return -1;
+
+	return sig_index_find (&var->index, type, data, data_size) >= 0;
+}
+
+/* Combine two lookups so that a failed read wins over a match */
+static int
+any_of (const int a, const int b)
+{
+	if (a < 0 || b < 0)
+		return -1;
+
+	return a || b;
+}
+
+/* Return 1 if the request would change the list, 0 if not, -1 on errors */
+int
+is_valid_request (const efi_guid_t *type, const void *mok,
+		  const uint32_t mok_size, const MokRequest req)
+{
+	int found;
+
+	switch (req) {
+	case MOK_REQ_ENROLL_MOK:
+		found = any_of (any_of (
+			is_duplicate (type, mok, mok_size, &efi_guid_security, "db"),
+			is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListRT")),
+			is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokNew"));
+		if (found)
+			return found < 0 ? -1 : 0;
+		/* Also check the blocklists */
+		found = any_of (
+			is_duplicate (type, mok, mok_size, &efi_guid_security, "dbx"),
+			is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListXRT"));
+		if (found)
+			return found < 0 ? -1 : 0;
+		break;
+	case MOK_REQ_DELETE_MOK:
+		found = is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListRT");
+		if (found <= 0)
+			return found;
+		found = is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokDel");
+		if (found)
+			return found < 0 ? -1 : 0;
+		break;
+	case MOK_REQ_ENROLL_BLACKLIST:
+		found = any_of (
+			is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListXRT"),
+			is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokXNew"));
+		if (found)
+			return found < 0 ? -1 : 0;
+		break;
+	case MOK_REQ_DELETE_BLACKLIST:
+		found = is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListXRT");
+		if (found <= 0)
+			return found;
+		found = is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokXDel");
+		if (found)
+			return found < 0 ? -1 : 0;
+		break;
+	}
+
+	return 1;
+}
+
+int
+is_ca_in_db (const void *cert, const uint32_t cert_size,
+	     const efi_guid_t *vendor, const char *db_name)
+{
+	const CachedVar *var;
+
+	if (!cert || cert_size == 0 || !vendor || !db_name)
+		return 0;
+
+	var = var_cache_get (db_name, *vendor);
+	if (!var)
+		return -1;
+
+	for (uint32_t i = 0; i < var->index.entry_num; i++) {
+		const SigEntry *entry = &var->index.entries[i];
+
+		if (efi_guid_cmp (&entry->type, &efi_guid_x509_cert) != 0)
+			continue;
+
+		if (is_immediate_ca (cert, cert_size, entry->data,
+				     entry->data_size))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Check whether the CA cert is already enrolled */
+int
+is_ca_enrolled (const void *mok, const uint32_t mok_size, const MokRequest req)
+{
+	switch (req) {
+	case MOK_REQ_ENROLL_MOK:
+		return is_ca_in_db (mok, mok_size, &efi_guid_shim, "MokListRT");
+	case MOK_REQ_ENROLL_BLACKLIST:
+		return is_ca_in_db (mok, mok_size, &efi_guid_shim, "MokListXRT");
+	default:
+		return 0;
+	}
+}
+
+/* Check whether the CA cert is blocked */
+int
+is_ca_blocked (const void *mok, const uint32_t mok_size, const MokRequest req)
+{
+	switch (req) {
+	case MOK_REQ_ENROLL_MOK:
+		return any_of (
+			is_ca_in_db (mok, mok_size, &efi_guid_security, "dbx"),
+			is_ca_in_db (mok, mok_size, &efi_guid_shim, "MokListXRT"));
+	default:
+		return 0;
+	}
+}
+
+/* Check whether the key is already in the kernel trusted keyring */
+int
+is_in_trusted_keyring (const void *cert, const uint32_t cert_size)
+{
+	char *skid = NULL;
+	int ret;
+
+	if (get_cert_skid (cert, cert_size, &skid) < 0)
+		return 0;
+
+	ret = match_skid_in_trusted_keyring (skid);
+	if (ret < 0)
+		ret = 0;
+
+	free (skid);
+
+	return ret;
+}
+
+static int
+add_state (unsigned int *state, const int found, const unsigned int flag)
+{
+	if (found < 0)
+		return -1;
+	if (found)
+		*state |= flag;
+
+	return 0;
+}
+
+/*
+ * Collect the MOK_KEY_* flags of a certificate. This may run in any thread.
+ * Return -1 if a database couldn't be read.
+ */
+int
+get_key_state (const void *cert, const uint32_t cert_size,
+	       const MokRequest req, const int check_keyring,
+	       unsigned int *statep)
+{
+	const efi_guid_t *type = &efi_guid_x509_cert;
+	unsigned int state = 0;
+
+	if (req == MOK_REQ_ENROLL_MOK) {
+		if (add_state (&state, any_of (
+			is_duplicate (type, cert, cert_size, &efi_guid_security, "db"),
+			is_duplicate (type, cert, cert_size, &efi_guid_shim, "MokListRT")),
+			MOK_KEY_ENROLLED) < 0 ||
+		    add_state (&state,
+			is_duplicate (type, cert, cert_size, &efi_guid_shim, "MokNew"),
+			MOK_KEY_PENDING) < 0 ||
+		    add_state (&state, any_of (
+			is_duplicate (type, cert, cert_size, &efi_guid_security, "dbx"),
+			is_duplicate (type, cert, cert_size, &efi_guid_shim, "MokListXRT")),
+			MOK_KEY_BLOCKED) < 0)
+			return -1;
+		if (check_keyring && is_in_trusted_keyring (cert, cert_size))
+			state |= MOK_KEY_IN_KEYRING;
+	} else {
+		if (add_state (&state,
+			is_duplicate (type, cert, cert_size, &efi_guid_shim, "MokListXRT"),
+			MOK_KEY_ENROLLED) < 0 ||
+		    add_state (&state,
+			is_duplicate (type, cert, cert_size, &efi_guid_shim, "MokXNew"),
+			MOK_KEY_PENDING) < 0)
+			return -1;
+	}
+
+	if (add_state (&state, is_ca_enrolled (cert, cert_size, req),
+		       MOK_KEY_CA_ENROLLED) < 0 ||
+	    add_state (&state, is_ca_blocked (cert, cert_size, req),
+		       MOK_KEY_CA_BLOCKED) < 0)
+		return -1;
+
+	*statep = state;
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2012-2020 Gary Lin <glin@suse.com>
+ * Copyright (C) 2012 Matthew Garrett <mjg@redhat.com>
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __KEY_CHECK_H__
+#define __KEY_CHECK_H__
+
+#include <stdint.h>
+#include <efivar.h>
+
+#include "mokutil.h"
+
+int is_duplicate (const efi_guid_t *type, const void *data,
+		  const uint32_t data_size, const efi_guid_t *vendor,
+		  const char *db_name);
+int is_valid_request (const efi_guid_t *type, const void *mok,
+		      const uint32_t mok_size, const MokRequest req);
+int is_ca_in_db (const void *cert, const uint32_t cert_size,
+		 const efi_guid_t *vendor, const char *db_name);
+int is_ca_enrolled (const void *mok, const uint32_t mok_size,
+		    const MokRequest req);
+int is_ca_blocked (const void *mok, const uint32_t mok_size,
+		   const MokRequest req);
+int is_in_trusted_keyring (const void *cert, const uint32_t cert_size);
+int get_key_state (const void *cert, const uint32_t cert_size,
+		   const MokRequest req, const int check_keyring,
+		   unsigned int *statep);
+
+#endif /* __KEY_CHECK_H__ */
@@ -32,34 +32,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
 #include <keyutils.h>
 
 #include "keyring.h"
+#include "perf.h"
+#include "probes.h"
 
-/**
- * Match the x509v3 Subject Key ID in the descriptions of the kernel built-in
- * trusted keys keyring
- *
- * return value
- *   -  0 : not matched
- *   -  1 : matched
- *   - -1 : error
- */
-int
-match_skid_in_trusted_keyring (const char *skid)
+static char **key_descs;
+static int key_desc_num = -1;
+static pthread_once_t keyring_once = PTHREAD_ONCE_INIT;
+
+/* Read the descriptions of the kernel built-in trusted keys once */
+static void
+load_trusted_keyring (void)
 {
 	key_serial_t ring_id, key_id, *key_ptr;
 	void *keylist = NULL;
-	int count;
+	char **descs = NULL;
+	int count, num = 0;
 	char buffer[1024];
-	char *ptr;
 	long buf_size;
-	int ret = -1;
-
-	if (skid == NULL)
-		return -1;
+	const uint64_t start = perf_start ();
 
 	/* Find the keyring ID of the kernel trusted keys */
 	ring_id = find_key_by_type_and_desc("keyring", ".builtin_trusted_keys", 0);
@@ -77,11 +73,14 @@ match_skid_in_trusted_keyring (const char *skid)
 	count /= sizeof(key_serial_t);
 	if (count == 0) {
 		/* The keyring is empty */
-		ret = 0;
+		key_desc_num = 0;
 		goto out;
 	}
 
-	/* Iterate the keylist and match SKID */
+	descs = calloc(count, sizeof(char *));
+	if (descs == NULL)
+		goto out;
+
 	key_ptr = keylist;
 	do {
 		key_id = *key_ptr++;
@@ -92,20 +91,63 @@ match_skid_in_trusted_keyring (const char *skid)
 			goto out;
 		}
 
-		/* Check if SKID is in the description */
-		ptr = strstr(buffer, skid);
-		if (ptr && *(ptr + strlen(skid)) == '\0') {
-			/* Matched */
-			ret = 1;
+		descs[num] = strdup(buffer);
+		if (descs[num] == NULL)
 			goto out;
-		}
+		num++;
 	} while (--count);
 
-	ret = 0;
+	key_descs = descs;
+	key_desc_num = num;
+	descs = NULL;
 out:
+	if (descs) {
+		for (int i = 0; i < num; i++)
+			free(descs[i]);
+		free(descs);
+	}
+
 	if (keylist)
 		free(keylist);
 
-	return ret;
+	perf_stop (PERF_KEYRING, start, 0, ".builtin_trusted_keys");
+}
 
+/**
+ * Match the x509v3 Subject Key ID in the descriptions of the kernel built-in
+ * trusted keys keyring
+ *
+ * The keyring is read on the first call and the later calls, also from
+ * other threads, only match the cached descriptions.
+ *
+ * return value
+ *   -  0 : not matched
+ *   -  1 : matched
+ *   - -1 : error
+ */
+int
+match_skid_in_trusted_keyring (const char *skid)
+{
+	char *ptr;
+	int ret = 0;
+
+	if (skid == NULL)
+		return -1;
+
+	pthread_once(&keyring_once, load_trusted_keyring);
+	if (key_desc_num < 0)
+		ret = -1;
+
+	for (int i = 0; i < key_desc_num; i++) {
+		/* Check if SKID is in the description */
+		ptr = strstr(key_descs[i], skid);
+		if (ptr && *(ptr + strlen(skid)) == '\0') {
+			ret = 1;
+			break;
+		}
+	}
+
+	PROBE2 (keyring__lookup, skid, ret);
+
+	return ret;
 }
@@ -0,0 +1,237 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+/*
+ * Load OpenSSL, libkeyutils and libcrypt on the first call of a function
+ * instead of at the start, so that the commands which only touch the
+ * variables don't pay for linking and initializing them. Each function
+ * below has the name and the prototype of the library function it stands
+ * for, so the callers are built as if the libraries were linked.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <crypt.h>
+#include <keyutils.h>
+
+typedef struct {
+	const char *soname;
+	void       *handle;
+	int         reported;
+} LazyLib;
+
+static LazyLib libcrypto = { LIBCRYPTO_SONAME, NULL, 0 };
+static LazyLib libkeyutils = { LIBKEYUTILS_SONAME, NULL, 0 };
+static LazyLib libcrypt = { LIBCRYPT_SONAME, NULL, 0 };
+static pthread_mutex_t lazy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Return NULL with errno set if the library or the symbol can't be
+ * loaded. The first failure of each library is printed with dlerror().
+ */
+static void *
+load_symbol (LazyLib *lib, const char *name)
+{
+	void *sym = NULL;
+
+	pthread_mutex_lock (&lazy_lock);
+	if (!lib->handle)
+		lib->handle = dlopen (lib->soname, RTLD_NOW | RTLD_LOCAL);
+	if (lib->handle)
+		sym = dlsym (lib->handle, name);
+	if (!sym && !lib->reported) {
+		fprintf (stderr, "Failed to load %s from %s: %s\n", name,
+			 lib->soname, dlerror ());
+		lib->reported = 1;
+	}
+	pthread_mutex_unlock (&lazy_lock);
+
+	if (!sym)
+		errno = ELIBACC;
+
+	return sym;
+}
+
+/* A function which can't be loaded fails with the value in err */
+#define LAZY_FUNCTION(lib, type, name, params, args, err)		\
+	type name params						\
+	{								\
+		static type (*lazy_func) params;			\
+		type (*fn) params;					\
+									\
+		fn = __atomic_load_n (&lazy_func, __ATOMIC_ACQUIRE);	\
+		if (!fn) {						\
+			fn = (type (*) params)load_symbol (&lib, #name); \
+			if (!fn)					\
+				return err;				\
+			__atomic_store_n (&lazy_func, fn, __ATOMIC_RELEASE); \
+		}							\
+									\
+		return fn args;						\
+	}
+
+#define LAZY_VOID_FUNCTION(lib, name, params, args)			\
+	void name params						\
+	{								\
+		static void (*lazy_func) params;			\
+		void (*fn) params;					\
+									\
+		fn = __atomic_load_n (&lazy_func, __ATOMIC_ACQUIRE);	\
+		if (!fn) {						\
+			fn = (void (*) params)load_symbol (&lib, #name); \
+			if (!fn)					\
+				return;					\
+			__atomic_store_n (&lazy_func, fn, __ATOMIC_RELEASE); \
+		}							\
+									\
+		fn args;						\
+	}
+
+LAZY_FUNCTION (libcrypto, const unsigned char *, ASN1_STRING_get0_data,
+	       (const ASN1_STRING *x), (x), NULL)
+LAZY_FUNCTION (libcrypto, int, ASN1_STRING_length,
+	       (const ASN1_STRING *x), (x), 0)
+LAZY_FUNCTION (libcrypto, int, ASN1_TIME_diff,
+	       (int *pday, int *psec, const ASN1_TIME *from, const ASN1_TIME *to),
+	       (pday, psec, from, to), 0)
+LAZY_FUNCTION (libcrypto, int, BIO_free, (BIO *a), (a), 0)
+LAZY_FUNCTION (libcrypto, BIO *, BIO_new_mem_buf,
+	       (const void *buf, int len), (buf, len), NULL)
+LAZY_VOID_FUNCTION (libcrypto, CRYPTO_free,
+		    (void *ptr, const char *file, int line), (ptr, file, line))
+LAZY_FUNCTION (libcrypto, int, CRYPTO_memcmp,
+	       (const void *in_a, const void *in_b, size_t len),
+	       (in_a, in_b, len), -1)
+LAZY_FUNCTION (libcrypto, int, EVP_DecodeBlock,
+	       (unsigned char *out, const unsigned char *in, int n),
+	       (out, in, n), -1)
+LAZY_FUNCTION (libcrypto, int, EVP_EncodeBlock,
+	       (unsigned char *t, const unsigned char *f, int n),
+	       (t, f, n), -1)
+LAZY_FUNCTION (libcrypto, int, EVP_DigestFinal_ex,
+	       (EVP_MD_CTX *ctx, unsigned char *md, unsigned int *s),
+	       (ctx, md, s), 0)
+LAZY_FUNCTION (libcrypto, int, EVP_DigestInit_ex,
+	       (EVP_MD_CTX *ctx, const EVP_MD *type, ENGINE *impl),
+	       (ctx, type, impl), 0)
+LAZY_FUNCTION (libcrypto, int, EVP_DigestUpdate,
+	       (EVP_MD_CTX *ctx, const void *d, size_t cnt), (ctx, d, cnt), 0)
+LAZY_VOID_FUNCTION (libcrypto, EVP_MD_CTX_free, (EVP_MD_CTX *ctx), (ctx))
+LAZY_FUNCTION (libcrypto, EVP_MD_CTX *, EVP_MD_CTX_new, (void), (), NULL)
+LAZY_FUNCTION (libcrypto, int, EVP_PKEY_get_base_id, (const EVP_PKEY *pkey),
+	       (pkey), EVP_PKEY_NONE)
+LAZY_FUNCTION (libcrypto, int, EVP_PKEY_get_bits, (const EVP_PKEY *pkey), (pkey),
+	       0)
+LAZY_FUNCTION (libcrypto, int, EVP_add_digest, (const EVP_MD *digest), (digest),
+	       0)
+LAZY_FUNCTION (libcrypto, const EVP_MD *, EVP_get_digestbyname,
+	       (const char *name), (name), NULL)
+LAZY_FUNCTION (libcrypto, const EVP_MD *, EVP_md5, (void), (), NULL)
+LAZY_FUNCTION (libcrypto, const EVP_MD *, EVP_sha1, (void), (), NULL)
+LAZY_FUNCTION (libcrypto, const EVP_MD *, EVP_sha256, (void), (), NULL)
+LAZY_FUNCTION (libcrypto, X509 *, PEM_read_bio_X509,
+	       (BIO *out, X509 **x, pem_password_cb *cb, void *u),
+	       (out, x, cb, u), NULL)
+LAZY_FUNCTION (libcrypto, unsigned char *, SHA1,
+	       (const unsigned char *d, size_t n, unsigned char *md),
+	       (d, n, md), NULL)
+LAZY_FUNCTION (libcrypto, unsigned char *, SHA256,
+	       (const unsigned char *d, size_t n, unsigned char *md),
+	       (d, n, md), NULL)
+LAZY_FUNCTION (libcrypto, char *, X509_NAME_oneline,
+	       (const X509_NAME *a, char *buf, int size), (a, buf, size), NULL)
+LAZY_VOID_FUNCTION (libcrypto, X509_STORE_CTX_cleanup,
+		    (X509_STORE_CTX *ctx), (ctx))
+LAZY_VOID_FUNCTION (libcrypto, X509_STORE_CTX_free,
+		    (X509_STORE_CTX *ctx), (ctx))
+LAZY_FUNCTION (libcrypto, int, X509_STORE_CTX_init,
+	       (X509_STORE_CTX *ctx, X509_STORE *trust_store, X509 *target,
+		STACK_OF(X509) *untrusted),
+	       (ctx, trust_store, target, untrusted), 0)
+LAZY_FUNCTION (libcrypto, X509_STORE_CTX *, X509_STORE_CTX_new, (void), (),
+	       NULL)
+LAZY_FUNCTION (libcrypto, int, X509_STORE_add_cert,
+	       (X509_STORE *ctx, X509 *x), (ctx, x), 0)
+LAZY_VOID_FUNCTION (libcrypto, X509_STORE_free, (X509_STORE *v), (v))
+LAZY_FUNCTION (libcrypto, X509_STORE *, X509_STORE_new, (void), (), NULL)
+LAZY_FUNCTION (libcrypto, int, X509_STORE_set_flags,
+	       (X509_STORE *ctx, unsigned long flags), (ctx, flags), 0)
+LAZY_FUNCTION (libcrypto, int, X509_check_issued,
+	       (X509 *issuer, X509 *subject), (issuer, subject),
+	       X509_V_ERR_UNSPECIFIED)
+LAZY_VOID_FUNCTION (libcrypto, X509_free, (X509 *a), (a))
+LAZY_FUNCTION (libcrypto, const ASN1_TIME *, X509_get0_notAfter,
+	       (const X509 *x), (x), NULL)
+LAZY_FUNCTION (libcrypto, const ASN1_OCTET_STRING *, X509_get0_subject_key_id,
+	       (X509 *x), (x), NULL)
+LAZY_FUNCTION (libcrypto, EVP_PKEY *, X509_get0_pubkey, (const X509 *x), (x),
+	       NULL)
+LAZY_FUNCTION (libcrypto, X509_NAME *, X509_get_issuer_name,
+	       (const X509 *a), (a), NULL)
+LAZY_FUNCTION (libcrypto, X509_NAME *, X509_get_subject_name,
+	       (const X509 *a), (a), NULL)
+LAZY_FUNCTION (libcrypto, int, X509_print_fp, (FILE *bp, X509 *x), (bp, x), 0)
+LAZY_FUNCTION (libcrypto, int, X509_verify_cert, (X509_STORE_CTX *ctx), (ctx),
+	       -1)
+LAZY_FUNCTION (libcrypto, int, i2d_X509,
+	       (const X509 *a, unsigned char **out), (a, out), -1)
+LAZY_FUNCTION (libcrypto, X509 *, d2i_X509,
+	       (X509 **a, const unsigned char **in, long len), (a, in, len),
+	       NULL)
+
+LAZY_FUNCTION (libkeyutils, key_serial_t, find_key_by_type_and_desc,
+	       (const char *type, const char *desc, key_serial_t destringid),
+	       (type, desc, destringid), -1)
+LAZY_FUNCTION (libkeyutils, long, keyctl_read_alloc,
+	       (key_serial_t id, void **_buffer), (id, _buffer), -1)
+LAZY_FUNCTION (libkeyutils, long, keyctl_describe,
+	       (key_serial_t id, char *buffer, size_t buflen),
+	       (id, buffer, buflen), -1)
+
+LAZY_FUNCTION (libcrypt, char *, crypt,
+	       (const char *phrase, const char *setting), (phrase, setting),
+	       NULL)
+LAZY_FUNCTION (libcrypt, char *, crypt_r,
+	       (const char *phrase, const char *setting,
+		struct crypt_data *data), (phrase, setting, data), NULL)
@@ -0,0 +1,309 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <efivar.h>
+
+#include "libmokutil.h"
+#include "efi_x509.h"
+#include "key_check.h"
+#include "sig_index.h"
+#include "util.h"
+#include "var_cache.h"
+
+struct MokContext {
+	int check_keyring;
+};
+
+static unsigned int context_num;
+static pthread_mutex_t context_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct {
+	MokSigType        type;
+	const efi_guid_t *guid;
+} sig_types[] = {
+	{ MOK_SIG_X509,   &efi_guid_x509_cert },
+	{ MOK_SIG_SHA1,   &efi_guid_sha1 },
+	{ MOK_SIG_SHA224, &efi_guid_sha224 },
+	{ MOK_SIG_SHA256, &efi_guid_sha256 },
+	{ MOK_SIG_SHA384, &efi_guid_sha384 },
+	{ MOK_SIG_SHA512, &efi_guid_sha512 },
+};
+
+static MokSigType
+guid_to_sig_type (const efi_guid_t *guid)
+{
+	for (unsigned int i = 0; i < sizeof(sig_types)/sizeof(sig_types[0]); i++) {
+		if (efi_guid_cmp (guid, sig_types[i].guid) == 0)
+			return sig_types[i].type;
+	}
+
+	return MOK_SIG_UNKNOWN;
+}
+
+static const efi_guid_t *
+sig_type_to_guid (const MokSigType type)
+{
+	for (unsigned int i = 0; i < sizeof(sig_types)/sizeof(sig_types[0]); i++) {
+		if (sig_types[i].type == type)
+			return sig_types[i].guid;
+	}
+
+	return NULL;
+}
+
+static const CachedVar *
+get_db (const char *db)
+{
+	const efi_guid_t *guid;
+
+	if (!db)
+		return NULL;
+
+	guid = find_sig_db_var (db);
+	if (!guid)
+		return NULL;
+
+	return var_cache_get (db, *guid);
+}
+
+static int
+get_flag (const char *name)
+{
+	const CachedVar *var = var_cache_get (name, efi_guid_global);
+
+	if (!var || !var->data || var->data_size != 1)
+		return -1;
+
+	return var->data[0];
+}
+
+MokContext *
+mok_context_new (void)
+{
+	MokContext *ctx;
+
+	ctx = calloc (1, sizeof(MokContext));
+	if (!ctx)
+		return NULL;
+
+	ctx->check_keyring = 1;
+
+	pthread_mutex_lock (&context_lock);
+	context_num++;
+	pthread_mutex_unlock (&context_lock);
+
+	return ctx;
+}
+
+void
+mok_context_free (MokContext *ctx)
+{
+	if (!ctx)
+		return;
+
+	/* The last context takes the cached variables with it */
+	pthread_mutex_lock (&context_lock);
+	if (--context_num == 0)
+		var_cache_clear ();
+	pthread_mutex_unlock (&context_lock);
+
+	free (ctx);
+}
+
+void
+mok_context_set_keyring_check (MokContext *ctx, const int enable)
+{
+	ctx->check_keyring = !!enable;
+}
+
+unsigned int
+mok_context_refresh (MokContext *ctx)
+{
+	(void)ctx;
+
+	return var_cache_refresh ();
+}
+
+int
+mok_get_secure_boot (MokContext *ctx)
+{
+	(void)ctx;
+
+	return get_flag ("SecureBoot");
+}
+
+int
+mok_get_setup_mode (MokContext *ctx)
+{
+	(void)ctx;
+
+	return get_flag ("SetupMode");
+}
+
+int
+mok_db_count (MokContext *ctx, const char *db)
+{
+	const CachedVar *var;
+
+	(void)ctx;
+
+	var = get_db (db);
+	if (!var)
+		return -1;
+
+	return var->index.entry_num;
+}
+
+int
+mok_db_get_entry (MokContext *ctx, const char *db, const unsigned int index,
+		  MokEntry *entry)
+{
+	const CachedVar *var;
+	const SigEntry *sig;
+
+	(void)ctx;
+
+	var = get_db (db);
+	if (!var || index >= var->index.entry_num || !entry)
+		return -1;
+
+	sig = &var->index.entries[index];
+	entry->type = guid_to_sig_type (&sig->type);
+	memcpy (entry->owner, &sig->owner, sizeof(entry->owner));
+	entry->data = sig->data;
+	entry->data_size = sig->data_size;
+
+	return 0;
+}
+
+int
+mok_db_contains (MokContext *ctx, const char *db, const MokSigType type,
+		 const void *data, const size_t data_size)
+{
+	const efi_guid_t *guid = sig_type_to_guid (type);
+	const CachedVar *var;
+
+	(void)ctx;
+
+	if (!guid || !data || data_size == 0 || data_size > UINT32_MAX)
+		return -1;
+
+	var = get_db (db);
+	if (!var)
+		return -1;
+
+	return sig_index_find (&var->index, guid, data, data_size) >= 0;
+}
+
+int
+mok_test_cert (MokContext *ctx, const MokRequest req, const void *cert,
+	       const size_t cert_size, unsigned int *state)
+{
+	if (!cert || cert_size > UINT32_MAX || !state)
+		return -1;
+
+	if (req != MOK_REQ_ENROLL_MOK && req != MOK_REQ_ENROLL_BLACKLIST)
+		return -1;
+
+	if (!is_valid_cert (cert, cert_size))
+		return -1;
+
+	return get_key_state (cert, cert_size, req, ctx->check_keyring, state);
+}
+
+/*
+ * Build the signature lists of the certificates which would change the
+ * database. The invalid certificates fail the request, and the ones
+ * already enrolled, pending or in the trusted keyring are left out.
+ * Return the number of the certificates in the lists.
+ */
+int
+mok_build_request (MokContext *ctx, const MokRequest req,
+		   const void *const *certs, const size_t *cert_sizes,
+		   const unsigned int cert_num,
+		   uint8_t **eslp, size_t *esl_sizep)
+{
+	SigIndex index;
+	int valid, ret = -1;
+
+	if (!certs || !cert_sizes || !eslp || !esl_sizep)
+		return -1;
+
+	if (req < MOK_REQ_DELETE_MOK || req > MOK_REQ_ENROLL_BLACKLIST)
+		return -1;
+
+	sig_index_init (&index);
+
+	for (unsigned int i = 0; i < cert_num; i++) {
+		const void *cert = certs[i];
+		const uint32_t cert_size = cert_sizes[i];
+
+		if (!cert || cert_sizes[i] > UINT32_MAX ||
+		    !is_valid_cert (cert, cert_size))
+			goto error;
+
+		if (req == MOK_REQ_ENROLL_MOK && ctx->check_keyring &&
+		    is_in_trusted_keyring (cert, cert_size))
+			continue;
+
+		valid = is_valid_request (&efi_guid_x509_cert, cert, cert_size,
+					  req);
+		if (valid < 0)
+			goto error;
+		if (!valid)
+			continue;
+
+		if (sig_index_add (&index, &efi_guid_x509_cert, &efi_guid_shim,
+				   cert, cert_size) < 0)
+			goto error;
+	}
+
+	*eslp = NULL;
+	*esl_sizep = 0;
+	if (index.entry_num > 0 &&
+	    sig_index_to_esl (&index, eslp, esl_sizep) < 0)
+		goto error;
+
+	ret = index.entry_num;
+error:
+	sig_index_free (&index);
+
+	return ret;
+}
+
+void
+mok_free (void *ptr)
+{
+	free (ptr);
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __LIBMOKUTIL_H__
+#define __LIBMOKUTIL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	MOK_REQ_DELETE_MOK = 0,
+	MOK_REQ_ENROLL_MOK,
+	MOK_REQ_DELETE_BLACKLIST,
+	MOK_REQ_ENROLL_BLACKLIST,
+} MokRequest;
+
+typedef enum {
+	MOK_SIG_UNKNOWN = 0,
+	MOK_SIG_X509,
+	MOK_SIG_SHA1,
+	MOK_SIG_SHA224,
+	MOK_SIG_SHA256,
+	MOK_SIG_SHA384,
+	MOK_SIG_SHA512,
+} MokSigType;
+
+/* Where mok_test_cert() found a certificate */
+typedef enum {
+	MOK_KEY_ENROLLED    = (1 << 0),
+	MOK_KEY_PENDING     = (1 << 1),
+	MOK_KEY_BLOCKED     = (1 << 2),
+	MOK_KEY_IN_KEYRING  = (1 << 3),
+	MOK_KEY_CA_ENROLLED = (1 << 4),
+	MOK_KEY_CA_BLOCKED  = (1 << 5),
+} MokKeyState;
+
+typedef struct {
+	MokSigType     type;
+	uint8_t        owner[16];
+	const uint8_t *data;
+	uint32_t       data_size;
+} MokEntry;
+
+typedef struct MokContext MokContext;
+
+/*
+ * The variables are read on the first use and kept until they change in
+ * efivarfs. mok_context_refresh() drops the changed ones, and the data
+ * returned by mok_db_get_entry() is valid until the next refresh. All the
+ * contexts in a process share the same cache, and the lookups may run in
+ * any thread as long as no refresh runs at the same time.
+ */
+MokContext *mok_context_new (void);
+void mok_context_free (MokContext *ctx);
+void mok_context_set_keyring_check (MokContext *ctx, const int enable);
+unsigned int mok_context_refresh (MokContext *ctx);
+
+int mok_get_secure_boot (MokContext *ctx);
+int mok_get_setup_mode (MokContext *ctx);
+
+/* The databases are named as the variables, e.g. "db" or "MokListRT" */
+int mok_db_count (MokContext *ctx, const char *db);
+int mok_db_get_entry (MokContext *ctx, const char *db,
+		      const unsigned int index, MokEntry *entry);
+int mok_db_contains (MokContext *ctx, const char *db, const MokSigType type,
+		     const void *data, const size_t data_size);
+
+int mok_test_cert (MokContext *ctx, const MokRequest req,
+		   const void *cert, const size_t cert_size,
+		   unsigned int *state);
+int mok_build_request (MokContext *ctx, const MokRequest req,
+		       const void *const *certs, const size_t *cert_sizes,
+		       const unsigned int cert_num,
+		       uint8_t **eslp, size_t *esl_sizep);
+void mok_free (void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBMOKUTIL_H__ */
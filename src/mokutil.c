@@ -38,8 +38,12 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <shadow.h>
-#include <sys/time.h>
+#include <inttypes.h>
+#include <sys/random.h>
+#include <time.h>
 
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
 
 #include <crypt.h>
@@ -47,11 +51,21 @@
 
 #include "mokutil.h"
 #include "signature.h"
+#include "audit.h"
+#include "daemon.h"
 #include "efi_hash.h"
 #include "efi_x509.h"
+#include "esl_file.h"
+#include "eventlog.h"
+#include "key_check.h"
 #include "keyring.h"
 #include "password-crypt.h"
+#include "perf.h"
+#include "req_lock.h"
+#include "sig_index.h"
+#include "snapshot.h"
 #include "util.h"
+#include "var_cache.h"
 
 #define PASSWORD_MAX 256
 #define PASSWORD_MIN 1
@@ -88,14 +102,31 @@
 #define TRUST_MOK          (1 << 27)
 #define UNTRUST_MOK        (1 << 28)
 #define SET_SBAT           (1 << 29)
+#define CHECK_EXPIRY       (1 << 30)
+#define DBX_UPDATE_CHECK   (1ULL << 31)
+#define COMPACT            (1ULL << 32)
+#define DAEMON             (1ULL << 33)
+#define GENERATE_PW_HASH_BATCH (1ULL << 34)
+#define VERIFY_PASSWORD    (1ULL << 35)
+#define CHECK_EVENTLOG     (1ULL << 36)
+#define PREDICT_PCR7       (1ULL << 37)
+#define LIST_ALL           (1ULL << 38)
+#define DIFF               (1ULL << 39)
+#define AUDIT              (1ULL << 40)
+#define CAPTURE            (1ULL << 41)
 
 #define DEFAULT_CRYPT_METHOD SHA512_BASED
 #define DEFAULT_SALT_SIZE    SHA512_SALT_MAX
-#define SETTINGS_LEN         (DEFAULT_SALT_SIZE*2)
+#define SETTINGS_LEN         (DEFAULT_SALT_SIZE*2 + sizeof ("rounds=999999999$"))
+#define CALIBRATE_MIN_NS     (100 * 1000000ULL)
 #define BUF_SIZE             300
+#define DEFAULT_EXPIRY_DAYS  30
 
 static int force_ca_check;
 static int check_keyring;
+static unsigned int hash_time;
+static double firmware_slowdown = 1.0;
+static unsigned long pw_rounds;
 
 typedef struct {
 	uint32_t mok_toggle_state;
@@ -114,19 +145,21 @@ print_help ()
 	printf ("  --list-enrolled\t\t\tList the enrolled keys\n");
 	printf ("  --list-new\t\t\t\tList the keys to be enrolled\n");
 	printf ("  --list-delete\t\t\t\tList the keys to be deleted\n");
-	printf ("  --import <der file...>\t\tImport keys\n");
-	printf ("  --delete <der file...>\t\tDelete specific keys\n");
+	printf ("  --import <key file...>\t\tImport keys\n");
+	printf ("  --delete <key file...>\t\tDelete specific keys\n");
 	printf ("  --revoke-import\t\t\tRevoke the import request\n");
 	printf ("  --revoke-delete\t\t\tRevoke the delete request\n");
 	printf ("  --export\t\t\t\tExport keys to files\n");
 	printf ("  --password\t\t\t\tSet MOK password\n");
 	printf ("  --clear-password\t\t\tClear MOK password\n");
+	printf ("  --verify-password\t\t\tCheck a password against the pending requests\n");
 	printf ("  --disable-validation\t\t\tDisable signature validation\n");
 	printf ("  --enable-validation\t\t\tEnable signature validation\n");
 	printf ("  --sb-state\t\t\t\tShow SecureBoot State\n");
-	printf ("  --test-key <der file>\t\t\tTest if the key is enrolled or not\n");
+	printf ("  --test-key <key file...>\t\tTest if the keys are enrolled or not\n");
 	printf ("  --reset\t\t\t\tReset MOK list\n");
 	printf ("  --generate-hash[=password]\t\tGenerate the password hash\n");
+	printf ("  --generate-hash-batch <file|->\tGenerate a hash for each password line\n");
 	printf ("  --ignore-db\t\t\t\tIgnore DB for validation\n");
 	printf ("  --use-db\t\t\t\tUse DB for validation\n");
 	printf ("  --import-hash <hash>\t\t\tImport a hash into MOK or MOKX\n");
@@ -141,15 +174,55 @@ print_help ()
 	printf ("  --kek\t\t\t\t\tList the keys in KEK\n");
 	printf ("  --db\t\t\t\t\tList the keys in db\n");
 	printf ("  --dbx\t\t\t\t\tList the keys in dbx\n");
+	printf ("  --dbr, --dbt\t\t\t\tList the keys in dbr or dbt\n");
+	printf ("  --pk-default, --kek-default\t\tList the keys in PKDefault or KEKDefault\n");
+	printf ("  --db-default, --dbx-default\t\tList the keys in dbDefault or dbxDefault\n");
+	printf ("  --dbr-default, --dbt-default\t\tList the keys in dbrDefault or dbtDefault\n");
+	printf ("  --all\t\t\t\t\tList the keys in every database\n");
+	printf ("  --diff <a> <b>\t\t\tShow the keys added and removed between two\n");
+	printf ("                \t\t\tfiles or \"live\" variables\n");
+	printf ("  --audit <rules>\t\t\tCheck the databases against the rules file\n");
+	printf ("  --capture <file>\t\t\tSave the variables to a snapshot file\n");
 	printf ("  --timeout <-1,0..0x7fff>\t\tSet the timeout for MOK prompt\n");
 	printf ("  --list-sbat-revocations\t\t\t\tList the entries in SBAT\n");
+	printf ("  --check-expiry[=days]\t\t\tList the certificates expiring within the days\n");
+	printf ("  --dbx-update-check <file>\t\tCompare a dbx update with the current dbx\n");
+	printf ("  --check-eventlog[=file]\t\tCompare the measured boot state with the\n");
+	printf ("                         \t\truntime variables\n");
+	printf ("  --predict-pcr7[=file]\t\t\tPredict PCR7 after the pending changes\n");
+	printf ("  --compact\t\t\t\tRemove duplicates from the pending requests\n");
+	printf ("  --daemon <socket>\t\t\tServe queries on the Unix socket\n");
 	printf ("\n");
 	printf ("Supplimentary Options:\n");
 	printf ("  --hash-file <hash file>\t\tUse the specific password hash\n");
 	printf ("  --root-pw\t\t\t\tUse the root password\n");
+	printf ("  --hash-time <ms>\t\t\tUse the hash rounds that take <ms> in MokManager\n");
+	printf ("  --firmware-slowdown <factor>\t\tThe firmware hashes <factor> times slower\n");
+	printf ("                              \t\tthan this host (default 1)\n");
 	printf ("  --mokx\t\t\t\tManipulate the MOK blacklist\n");
 	printf ("  --ca-check\t\t\t\tCheck if CA of the key is enrolled/blocked\n");
 	printf ("  --ignore-keyring\t\t\tDon't check if the key is the kernel keyring\n");
+	printf ("  --file <file>\t\t\t\tList or test keys in the file instead of the firmware\n");
+	printf ("  --output <file>\t\t\tWrite the result to the file\n");
+	printf ("  --export-format <format>\t\tExport to one stream in esl, pem, tar\n");
+	printf ("                          \t\tor hashlist format\n");
+	printf ("  --json\t\t\t\tPrint the results of --test-key, --all, --diff or\n");
+	printf ("        \t\t\t\t--audit in JSON\n");
+	printf ("  --trace-perf[=file]\t\t\tShow the time taken by the firmware and the\n");
+	printf ("                     \t\t\tcryptography, or write a Chrome trace\n");
+}
+
+static void
+print_mok_node (const MokListNode *node, const unsigned int index)
+{
+	efi_guid_t sigtype = node->header->SignatureType;
+
+	printf ("[key %d]\n", index);
+	if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) == 0) {
+		print_x509 (node->mok, node->mok_size);
+	} else {
+		print_hash_array (&sigtype, node->mok, node->mok_size);
+	}
 }
 
 static int
@@ -164,14 +237,7 @@ list_keys (const uint8_t *data, const size_t data_size)
 	}
 
 	for (unsigned int i = 0; i < mok_num; i++) {
-		printf ("[key %d]\n", i+1);
-		efi_guid_t sigtype = list[i].header->SignatureType;
-		if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) == 0) {
-			print_x509 (list[i].mok, list[i].mok_size);
-		} else {
-			print_hash_array (&sigtype,
-					  list[i].mok, list[i].mok_size);
-		}
+		print_mok_node (&list[i], i+1);
 		if (i < mok_num - 1)
 			printf ("\n");
 	}
@@ -181,6 +247,75 @@ list_keys (const uint8_t *data, const size_t data_size)
 	return 0;
 }
 
+/*
+ * Walk the signature lists in the file one at a time so that only the list
+ * being processed has to be resident, no matter how large the file is.
+ * The callback returns < 0 on error, 0 to continue, or > 0 to stop.
+ */
+static int
+walk_file_lists (EslFile *esl,
+		 int (*func)(const MokListNode *node, void *data), void *data)
+{
+	const EFI_SIGNATURE_LIST *CertList;
+	MokListNode *list;
+	uint32_t mok_num;
+	size_t offset = 0;
+	int ret = 0;
+
+	while (offset < esl->data_size) {
+		CertList = (const EFI_SIGNATURE_LIST *)(esl->data + offset);
+
+		list = build_mok_list (CertList, CertList->SignatureListSize,
+				       &mok_num);
+		/* An unknown signature type yields an empty list */
+		for (unsigned int i = 0; list && i < mok_num; i++) {
+			ret = func (&list[i], data);
+			if (ret != 0)
+				break;
+		}
+		free (list);
+		if (ret != 0)
+			return ret;
+
+		offset += CertList->SignatureListSize;
+		esl_file_release (esl, offset);
+	}
+
+	return 0;
+}
+
+static int
+print_file_node (const MokListNode *node, void *data)
+{
+	unsigned int *index = data;
+
+	if (*index > 0)
+		printf ("\n");
+	(*index)++;
+	print_mok_node (node, *index);
+
+	return 0;
+}
+
+static int
+list_keys_in_file (const char *file, const DBName db_name)
+{
+	unsigned int index = 0;
+	EslFile esl;
+	int ret;
+
+	if (esl_file_open_var (file, get_db_var_name (db_name), &esl) < 0)
+		return -1;
+
+	ret = walk_file_lists (&esl, print_file_node, &index);
+	if (ret >= 0 && index == 0)
+		printf ("%s is empty\n", file);
+
+	esl_file_close (&esl);
+
+	return ret;
+}
+
 static int
 list_keys_in_var (const char *var_name, const efi_guid_t guid)
 {
@@ -204,7 +339,7 @@ list_keys_in_var (const char *var_name, const efi_guid_t guid)
 			snprintf(varname, varname_sz, "%s%zu", var_name, i);
 		}
 
-		ret = efi_get_variable (guid, varname, &data, &data_sz,
+		ret = get_efi_variable (guid, varname, &data, &data_sz,
 					&attributes);
 		if (ret < 0)
 			return 0;
@@ -287,59 +422,155 @@ error:
 	return ret;
 }
 
-static void
+static int
 generate_pw_salt (char salt[], const unsigned int salt_size)
 {
-	struct timeval tv;
-	char *rand_str;
-	int remain = salt_size;
-
-	salt[0] = '\0';
+	static const char salt_chars[] =
+		"./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	unsigned char rand_buf[SETTINGS_LEN];
+	ssize_t len;
 
-	(void) gettimeofday (&tv, NULL);
-	srandom (tv.tv_sec ^ tv.tv_usec ^ getpid ());
+	if (salt_size > sizeof (rand_buf)) {
+		errno = EOVERFLOW;
+		return -1;
+	}
 
-	do {
-		rand_str = l64a (random());
-		strncat (salt, rand_str, remain);
-		remain = remain - strlen(rand_str);
-	} while (remain > 0);
+	/* Every salt is drawn independently from the kernel CSPRNG so that
+	 * hashes generated in the same microsecond never share a salt */
+	for (unsigned int off = 0; off < salt_size; off += len) {
+		len = getrandom (rand_buf + off, salt_size - off, 0);
+		if (len < 0) {
+			if (errno == EINTR) {
+				len = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
 
+	/* 64 characters, so the low 6 bits map without bias */
+	for (unsigned int i = 0; i < salt_size; i++)
+		salt[i] = salt_chars[rand_buf[i] & 0x3f];
 	salt[salt_size] = '\0';
+
+	explicit_bzero (rand_buf, sizeof (rand_buf));
+
+	return 0;
 }
 
+/*
+ * Find the rounds for which the default crypt method takes hash_time
+ * milliseconds in MokManager. The firmware is assumed to be
+ * firmware_slowdown times slower than this host.
+ */
 static int
-generate_pw_crypt (pw_crypt_t *pw_crypt, const char *password,
-		   const unsigned int pw_len)
+calibrate_pw_rounds (void)
 {
-	pw_crypt_t new_crypt;
 	char settings[SETTINGS_LEN];
-	char *next;
-	char *crypt_string;
+	struct crypt_data *cd;
 	const char *prefix;
-	int hash_len, settings_len = sizeof (settings) - 2;
+	unsigned long rounds = SHA_ROUNDS_MIN * 10;
+	uint64_t start, elapsed;
+	double rounds_per_ns;
+	double target;
 
-	if (!password || !pw_crypt || password[pw_len] != '\0')
+	if (pw_rounds || !hash_time)
+		return 0;
+
+	if (DEFAULT_CRYPT_METHOD != SHA256_BASED &&
+	    DEFAULT_CRYPT_METHOD != SHA512_BASED) {
+		fprintf (stderr, "The hash method doesn't support rounds\n");
+		return -1;
+	}
+	prefix = get_crypt_prefix (DEFAULT_CRYPT_METHOD);
+
+	cd = calloc (1, sizeof (struct crypt_data));
+	if (!cd) {
+		fprintf (stderr, "Failed to allocate space: %m\n");
 		return -1;
+	}
+
+	/* Double the rounds until one hash takes long enough to time */
+	while (1) {
+		snprintf (settings, sizeof (settings), "%srounds=%lu$calibration",
+			  prefix, rounds);
+		start = perf_clock ();
+		if (!crypt_r ("calibration", settings, cd)) {
+			fprintf (stderr, "Failed to calibrate the hash rounds\n");
+			free (cd);
+			return -1;
+		}
+		elapsed = perf_clock () - start;
+		if (elapsed >= CALIBRATE_MIN_NS || rounds > SHA_ROUNDS_MAX / 2)
+			break;
+		rounds *= 2;
+	}
+	free (cd);
+
+	rounds_per_ns = (double)rounds / (elapsed ? elapsed : 1);
+	target = rounds_per_ns * hash_time * 1000000.0 / firmware_slowdown;
+	if (target < SHA_ROUNDS_MIN)
+		pw_rounds = SHA_ROUNDS_MIN;
+	else if (target > SHA_ROUNDS_MAX)
+		pw_rounds = SHA_ROUNDS_MAX;
+	else
+		pw_rounds = (unsigned long)target;
+
+	fprintf (stderr, "Using %lu rounds (%.1f ms on this host)\n", pw_rounds,
+		 pw_rounds / rounds_per_ns / 1000000.0);
+
+	return 0;
+}
+
+static int
+generate_pw_settings (char settings[SETTINGS_LEN], const HashMethod method)
+{
+	const char *prefix;
+	char *next;
+	size_t settings_len = SETTINGS_LEN - 2;
+	unsigned int salt_size;
 
-	prefix = get_crypt_prefix (pw_crypt->method);
+	prefix = get_crypt_prefix (method);
 	if (!prefix)
 		return -1;
 
-	pw_crypt->salt_size = get_pw_salt_size (pw_crypt->method);
-	generate_pw_salt ((char *)pw_crypt->salt, pw_crypt->salt_size);
+	if (calibrate_pw_rounds () < 0)
+		return -1;
 
-	memset (settings, 0, sizeof (settings));
+	memset (settings, 0, SETTINGS_LEN);
 	next = stpncpy (settings, prefix, settings_len);
-	if (pw_crypt->salt_size > settings_len - (next - settings)) {
+	if (pw_rounds && (method == SHA256_BASED || method == SHA512_BASED))
+		next += sprintf (next, "rounds=%lu$", pw_rounds);
+	salt_size = get_pw_salt_size (method);
+	if (salt_size > settings_len - (next - settings)) {
 		errno = EOVERFLOW;
 		return -1;
 	}
-	next = stpncpy (next, (const char *)pw_crypt->salt,
-			pw_crypt->salt_size);
-	*next = '\0';
+	if (generate_pw_salt (next, salt_size) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int
+generate_pw_crypt (pw_crypt_t *pw_crypt, const char *password,
+		   const unsigned int pw_len)
+{
+	pw_crypt_t new_crypt;
+	char settings[SETTINGS_LEN];
+	char *crypt_string;
+	int hash_len;
+	uint64_t start;
+
+	if (!password || !pw_crypt || password[pw_len] != '\0')
+		return -1;
+
+	if (generate_pw_settings (settings, pw_crypt->method) < 0)
+		return -1;
 
+	start = perf_start ();
 	crypt_string = crypt (password, settings);
+	perf_stop (PERF_CRYPT, start, 0, get_crypt_prefix (pw_crypt->method));
 	if (!crypt_string)
 		return -1;
 
@@ -351,11 +582,8 @@ generate_pw_crypt (pw_crypt_t *pw_crypt, const char *password,
 		return -1;
 	memcpy (pw_crypt->hash, new_crypt.hash, hash_len);
 	pw_crypt->iter_count = new_crypt.iter_count;
-
-	if (pw_crypt->method == BLOWFISH_BASED) {
-		pw_crypt->salt_size = new_crypt.salt_size;
-		memcpy (pw_crypt->salt, new_crypt.salt, new_crypt.salt_size);
-	}
+	pw_crypt->salt_size = new_crypt.salt_size;
+	memcpy (pw_crypt->salt, new_crypt.salt, new_crypt.salt_size);
 
 	return 0;
 }
@@ -419,51 +647,25 @@ get_password_from_shadow (pw_crypt_t *pw_crypt)
 	return 0;
 }
 
+/* Get the password hash for the Auth variable of a request */
 static int
-update_request (void *new_list, const int list_len, const MokRequest req,
-		const char *pw_hash_file, const int root_pw)
+get_request_auth (const char *pw_hash_file, const int root_pw,
+		  pw_crypt_t *pw_crypt)
 {
-	const char *req_name, *auth_name;
-	pw_crypt_t pw_crypt;
 	char *password = NULL;
 	unsigned int pw_len;
-	int auth_ret;
 	int ret = -1;
-	uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
-			      | EFI_VARIABLE_BOOTSERVICE_ACCESS
-			      | EFI_VARIABLE_RUNTIME_ACCESS;
 
-	bzero (&pw_crypt, sizeof(pw_crypt_t));
-	pw_crypt.method = DEFAULT_CRYPT_METHOD;
-
-	switch (req) {
-	case ENROLL_MOK:
-		req_name = "MokNew";
-		auth_name = "MokAuth";
-		break;
-	case DELETE_MOK:
-		req_name = "MokDel";
-		auth_name = "MokDelAuth";
-		break;
-	case ENROLL_BLACKLIST:
-		req_name = "MokXNew";
-		auth_name = "MokXAuth";
-		break;
-	case DELETE_BLACKLIST:
-		req_name = "MokXDel";
-		auth_name = "MokXDelAuth";
-		break;
-	default:
-		return -1;
-	}
+	bzero (pw_crypt, sizeof(pw_crypt_t));
+	pw_crypt->method = DEFAULT_CRYPT_METHOD;
 
 	if (pw_hash_file) {
-		if (get_pw_hash_from_file (pw_hash_file, &pw_crypt) < 0) {
+		if (get_pw_hash_from_file (pw_hash_file, pw_crypt) < 0) {
 			fprintf (stderr, "Failed to read hash\n");
 			goto error;
 		}
 	} else if (root_pw) {
-		if (get_password_from_shadow (&pw_crypt) < 0) {
+		if (get_password_from_shadow (pw_crypt) < 0) {
 			fprintf (stderr, "Failed to get root password hash\n");
 			goto error;
 		}
@@ -473,296 +675,449 @@ update_request (void *new_list, const int list_len, const MokRequest req,
 			goto error;
 		}
 
-		auth_ret = generate_pw_crypt (&pw_crypt, password, pw_len);
-		if (auth_ret < 0) {
+		if (generate_pw_crypt (pw_crypt, password, pw_len) < 0) {
 			fprintf (stderr, "Couldn't generate hash\n");
 			goto error;
 		}
 	}
 
+	ret = 0;
+error:
+	if (password)
+		free (password);
+	return ret;
+}
+
+static int
+write_request (void *new_list, const int list_len, const MokRequest req,
+	       const pw_crypt_t *pw_crypt)
+{
+	const char *req_name = get_req_var_name (req);
+	const char *auth_name = get_req_auth_var_name (req);
+	int ret;
+	uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
+			      | EFI_VARIABLE_BOOTSERVICE_ACCESS
+			      | EFI_VARIABLE_RUNTIME_ACCESS;
+
 	if (new_list) {
 		/* Write MokNew, MokDel, MokXNew, or MokXDel*/
-		ret = efi_set_variable (efi_guid_shim, req_name,
+		ret = set_efi_variable (efi_guid_shim, req_name,
 					new_list, list_len, attributes,
 					S_IRUSR | S_IWUSR);
 		if (ret < 0) {
 			switch (req) {
-			case ENROLL_MOK:
+			case MOK_REQ_ENROLL_MOK:
 				fprintf (stderr, "Failed to enroll new keys\n");
 				break;
-			case ENROLL_BLACKLIST:
+			case MOK_REQ_ENROLL_BLACKLIST:
 				fprintf (stderr, "Failed to enroll blacklist\n");
 				break;
-			case DELETE_MOK:
+			case MOK_REQ_DELETE_MOK:
 				fprintf (stderr, "Failed to delete keys\n");
 				break;
-			case DELETE_BLACKLIST:
+			case MOK_REQ_DELETE_BLACKLIST:
 				fprintf (stderr, "Failed to delete blacklist\n");
 				break;
 			}
-			goto error;
+			return -1;
 		}
 	} else {
 		test_and_delete_mok_var (req_name);
 	}
+	var_cache_invalidate (req_name);
 
 	/* Write MokAuth, MokDelAuth, MokXAuth, or MokXDelAuth */
-	ret = efi_set_variable (efi_guid_shim, auth_name, (void *)&pw_crypt,
+	ret = set_efi_variable (efi_guid_shim, auth_name, (void *)pw_crypt,
 				PASSWORD_CRYPT_SIZE, attributes,
 				S_IRUSR | S_IWUSR);
 	if (ret < 0) {
 		fprintf (stderr, "Failed to write %s\n", auth_name);
 		test_and_delete_mok_var (req_name);
-		goto error;
+		return -1;
 	}
 
-	ret = 0;
-error:
-	if (password)
-		free (password);
-	return ret;
+	return 0;
 }
 
 static int
-is_one_duplicate (const efi_guid_t *type,
-		  const void *data, const uint32_t data_size,
-		  uint8_t *var_data, size_t var_data_size)
+update_request (void *new_list, const int list_len, const MokRequest req,
+		const char *pw_hash_file, const int root_pw)
 {
-	uint32_t node_num;
-	MokListNode *list;
-	int ret = 0;
+	pw_crypt_t pw_crypt;
+	int lock_fd, ret;
 
-	if (!data || data_size == 0)
-		return 0;
+	if (get_request_auth (pw_hash_file, root_pw, &pw_crypt) < 0)
+		return -1;
 
-	list = build_mok_list (var_data, var_data_size, &node_num);
-	if (list == NULL) {
-		goto done;
-	}
+	lock_fd = lock_requests ();
+	if (lock_fd < 0)
+		return -1;
 
-	for (unsigned int i = 0; i < node_num; i++) {
-		efi_guid_t sigtype = list[i].header->SignatureType;
-		if (efi_guid_cmp (&sigtype, type) != 0)
-			continue;
+	ret = write_request (new_list, list_len, req, &pw_crypt);
+	unlock_requests (lock_fd);
 
-		if (efi_guid_cmp (type, &efi_guid_x509_cert) == 0) {
-			if (list[i].mok_size != data_size)
-				continue;
+	return ret;
+}
 
-			if (memcmp (list[i].mok, data, data_size) == 0) {
-				ret = 1;
-				break;
-			}
-		} else {
-			if (match_hash_array (type, data, list[i].mok,
-					      list[i].mok_size) >= 0) {
-				ret = 1;
-				break;
-			}
-		}
+/* Pack the keys in order into parts which fit in the limit */
+static void
+print_split_plan (const char **names, const size_t *sizes,
+		  const unsigned int num, const size_t old_size,
+		  const size_t limit)
+{
+	unsigned int part = 1;
+	size_t part_size = old_size;
+
+	if (old_size > limit) {
+		printf ("The pending request alone takes %zu bytes. Revoke it and import the keys again.\n",
+			old_size);
+		return;
 	}
 
-done:
-	if (list)
-		free (list);
+	printf ("Import the keys in parts of up to %zu bytes, rebooting to enroll each part:\n",
+		limit);
+	printf ("  part 1:");
+	if (old_size > 0)
+		printf (" (pending request)");
 
-	return ret;
+	for (unsigned int i = 0; i < num; i++) {
+		if (sizes[i] > limit) {
+			printf ("\n  %s is too large for any request", names[i]);
+			continue;
+		}
+		if (part_size + sizes[i] > limit && part_size > 0) {
+			printf (" (%zu bytes)\n  part %u:", part_size, ++part);
+			part_size = 0;
+		}
+		printf (" %s", names[i]);
+		part_size += sizes[i];
+	}
+	printf (" (%zu bytes)\n", part_size);
 }
 
+/*
+ * Predict whether the request fits in the variable storage before writing
+ * it. Show how to split the keys if the request won't fit or it is larger
+ * than what many firmwares accept in one variable.
+ *
+ * Return -1 if the request won't fit, or 0 otherwise.
+ */
 static int
-is_duplicate (const efi_guid_t *type,
-	      const void *data, const uint32_t data_size,
-	      const efi_guid_t *vendor, const char *db_name)
+check_request_space (const MokRequest req, const size_t req_size,
+		     const char **names, const size_t *sizes,
+		     const unsigned int num, const size_t old_size)
 {
-	uint32_t attributes;
-	char varname[] = "implausibly-long-mok-variable-name";
-	size_t varname_sz = sizeof(varname);
-	int ret = 0;
-	size_t i;
-
-	if (!strncmp(db_name, "Mok", 3)) {
-		uint8_t *var_data = NULL;
-		size_t var_data_size = 0;
-		ret = mok_get_variable(db_name, &var_data, &var_data_size);
-		if (ret >= 0) {
-			ret = is_one_duplicate(type, data, data_size,
-					       var_data, var_data_size);
-			if (ret >= 0) {
-				free (var_data);
-				return ret;
-			}
-			var_data = NULL;
-			var_data_size = 0;
+	const char *var_name = get_req_var_name (req);
+	const char *auth_name = get_req_auth_var_name (req);
+	uint64_t total, remain, avail = UINT64_MAX;
+	size_t need, auth_cost, limit = VAR_SIZE_LIMIT_HINT;
+	int fits = 1;
+
+	auth_cost = nvram_var_cost (auth_name, PASSWORD_CRYPT_SIZE);
+	need = nvram_var_cost (var_name, req_size) + auth_cost;
+
+	if (get_nvram_space (&total, &remain) > 0) {
+		/* The firmware reclaims the space of the old request */
+		avail = remain + nvram_var_usage (efi_guid_shim, var_name) +
+			nvram_var_usage (efi_guid_shim, auth_name);
+		if (need > avail) {
+			fprintf (stderr, "The request needs %zu bytes but only %"PRIu64" bytes of variable storage are available\n",
+				 need, avail);
+			fits = 0;
 		}
 	}
 
-	for (i = 0; i < SIZE_MAX; i++) {
-		uint8_t *var_data = NULL;
-		size_t var_data_size = 0;
-		if (i == 0) {
-			snprintf(varname, varname_sz, "%s", db_name);
-		} else {
-			snprintf(varname, varname_sz, "%s%zu", db_name, i);
-		}
+	if (fits && req_size <= VAR_SIZE_LIMIT_HINT)
+		return 0;
 
-		ret = efi_get_variable (*vendor, varname,
-					&var_data, &var_data_size,
-					&attributes);
-		if (ret < 0)
-			return 0;
+	if (fits)
+		fprintf (stderr, "Warning: %s will be %zu bytes, which some firmware rejects\n",
+			 var_name, req_size);
 
-		ret = is_one_duplicate(type, data, data_size,
-				       var_data, var_data_size);
-		free (var_data);
-		/*
-		 * If ret is < 0, the next one will error as well.
-		 * If ret is 0, we need to test the next variable.
-		 * If it's 1, that's a real answer.
-		 */
-		if (ret < 0)
-			return 0;
-		if (ret > 0)
-			return ret;
-	}
+	if (num == 0)
+		return fits ? 0 : -1;
 
-	return 0;
-}
+	if (avail < nvram_var_cost (var_name, limit) + auth_cost)
+		limit = avail > nvram_var_cost (var_name, 0) + auth_cost ?
+			avail - nvram_var_cost (var_name, 0) - auth_cost : 0;
 
-static int
-is_valid_request (const efi_guid_t *type, const void *mok,
-		  const uint32_t mok_size, const MokRequest req)
-{
-	switch (req) {
-	case ENROLL_MOK:
-		if (is_duplicate (type, mok, mok_size, &efi_guid_security, "db") ||
-		    is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListRT") ||
-		    is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokNew")) {
-			return 0;
-		}
-		/* Also check the blocklists */
-		if (is_duplicate (type, mok, mok_size, &efi_guid_security, "dbx") ||
-		    is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListXRT"))
-			return 0;
-		break;
-	case DELETE_MOK:
-		if (!is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListRT") ||
-		    is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokDel")) {
-			return 0;
-		}
-		break;
-	case ENROLL_BLACKLIST:
-		if (is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListXRT") ||
-		    is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokXNew")) {
-			return 0;
-		}
-		break;
-	case DELETE_BLACKLIST:
-		if (!is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokListXRT") ||
-		    is_duplicate (type, mok, mok_size, &efi_guid_shim, "MokXDel")) {
-			return 0;
-		}
-		break;
-	}
+	print_split_plan (names, sizes, num, old_size, limit);
 
-	return 1;
+	return fits ? 0 : -1;
 }
 
+/*
+ * Add the new signatures to the old request. The certificates and the hashes
+ * of a type not in the old request are put in front of it, and the other
+ * hashes are appended to the first list of the same type. The signatures
+ * already in the old request are skipped.
+ */
 static int
-is_ca_in_db (const void *cert, const uint32_t cert_size,
-	     const efi_guid_t *vendor, const char *db_name)
+merge_request (const uint8_t *old_data, const size_t old_size,
+	       const SigIndex *added, uint8_t **datap, size_t *data_sizep)
 {
-	uint8_t *var_data = NULL;
-	size_t var_data_size;
-	uint32_t attributes;
-	uint32_t node_num;
-	MokListNode *list;
-	int ret = 0;
+	SigIndex front;
+	uint8_t *front_esl = NULL, *data = NULL, *ptr, *merged = NULL;
+	size_t front_size = 0, data_size;
+	const uint8_t *src, *end;
+	int ret = -1;
 
-	if (!cert || cert_size == 0 || !vendor || !db_name)
-		return 0;
+	sig_index_init (&front);
 
-	ret = efi_get_variable (*vendor, db_name, &var_data, &var_data_size,
-				&attributes);
-	if (ret < 0)
-		return 0;
+	merged = calloc (added->entry_num ? added->entry_num : 1, 1);
+	if (!merged)
+		goto error;
 
-	list = build_mok_list (var_data, var_data_size, &node_num);
-	if (list == NULL) {
-		goto done;
-	}
+	/* Find the hashes which go into the old lists */
+	data_size = old_size;
+	for (src = old_data, end = old_data + old_size; src < end;) {
+		const EFI_SIGNATURE_LIST *list = (const EFI_SIGNATURE_LIST *)src;
+		efi_guid_t sigtype = list->SignatureType;
 
-	for (unsigned int i = 0; i < node_num; i++) {
-		efi_guid_t sigtype = list[i].header->SignatureType;
-		if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0)
-			continue;
+		if (list->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) ||
+		    list->SignatureListSize > (size_t)(end - src)) {
+			fprintf (stderr, "Corrupted signature list\n");
+			goto error;
+		}
 
-		if (is_immediate_ca (cert, cert_size, list[i].mok,
-				     list[i].mok_size)) {
-			ret = 1;
-			break;
+		if (list->SignatureHeaderSize == 0 &&
+		    efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0) {
+			for (uint32_t i = 0; i < added->entry_num; i++) {
+				const SigEntry *entry = &added->entries[i];
+
+				if (merged[i] ||
+				    efi_guid_cmp (&entry->type, &sigtype) != 0 ||
+				    list->SignatureSize != sizeof(efi_guid_t) +
+							   entry->data_size)
+					continue;
+				merged[i] = 1;
+				data_size += list->SignatureSize;
+			}
 		}
+		src += list->SignatureListSize;
 	}
 
-done:
-	if (list)
-		free (list);
-	free (var_data);
+	for (uint32_t i = 0; i < added->entry_num; i++) {
+		const SigEntry *entry = &added->entries[i];
 
-	return ret;
-}
+		if (merged[i])
+			continue;
+		if (sig_index_add (&front, &entry->type, &entry->owner,
+				   entry->data, entry->data_size) < 0)
+			goto error;
+	}
+	if (sig_index_to_esl (&front, &front_esl, &front_size) < 0)
+		goto error;
+	data_size += front_size;
 
-/* Check whether the CA cert is already enrolled */
-static int
-is_ca_enrolled (const void *mok, const uint32_t mok_size, const MokRequest req)
-{
-	switch (req) {
-	case ENROLL_MOK:
-		if (is_ca_in_db (mok, mok_size, &efi_guid_shim, "MokListRT"))
-			return 1;
-		break;
-	case ENROLL_BLACKLIST:
-		if (is_ca_in_db (mok, mok_size, &efi_guid_shim, "MokListXRT"))
-			return 1;
-		break;
-	default:
-		return 0;
+	data = malloc (data_size ? data_size : 1);
+	if (!data)
+		goto error;
+
+	memcpy (data, front_esl, front_size);
+	ptr = data + front_size;
+
+	memset (merged, 0, added->entry_num);
+	for (src = old_data; src < end;) {
+		const EFI_SIGNATURE_LIST *list = (const EFI_SIGNATURE_LIST *)src;
+		EFI_SIGNATURE_LIST *new_list = (EFI_SIGNATURE_LIST *)ptr;
+		efi_guid_t sigtype = list->SignatureType;
+
+		memcpy (ptr, src, list->SignatureListSize);
+		ptr += list->SignatureListSize;
+
+		if (list->SignatureHeaderSize == 0 &&
+		    efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0) {
+			for (uint32_t i = 0; i < added->entry_num; i++) {
+				const SigEntry *entry = &added->entries[i];
+
+				if (merged[i] ||
+				    efi_guid_cmp (&entry->type, &sigtype) != 0 ||
+				    list->SignatureSize != sizeof(efi_guid_t) +
+							   entry->data_size)
+					continue;
+				merged[i] = 1;
+				memcpy (ptr, &entry->owner, sizeof(efi_guid_t));
+				memcpy (ptr + sizeof(efi_guid_t), entry->data,
+					entry->data_size);
+				ptr += list->SignatureSize;
+				new_list->SignatureListSize += list->SignatureSize;
+			}
+		}
+		src += list->SignatureListSize;
 	}
 
-	return 0;
+	*datap = data;
+	*data_sizep = data_size;
+	data = NULL;
+	ret = 0;
+error:
+	if (ret < 0)
+		fprintf (stderr, "Failed to merge the request\n");
+	sig_index_free (&front);
+	free (front_esl);
+	free (merged);
+	free (data);
+
+	return ret;
 }
 
-/* Check whether the CA cert is blocked */
+/*
+ * Add the signature lists to the request variable.
+ *
+ * The additions are queued in the spool first, and then the process which
+ * gets the request lock merges all the queued additions into the variable
+ * with one write. If the additions of this process were already committed
+ * by another instance while waiting for the lock, there is nothing left to
+ * do. The variable is read again right before the write, and the merge
+ * starts over if it was changed by somebody else.
+ */
 static int
-is_ca_blocked (const void *mok, const uint32_t mok_size, const MokRequest req)
+commit_request (const void *esl, const size_t esl_size, const MokRequest req,
+		const char *pw_hash_file, const int root_pw)
 {
-	switch (req) {
-	case ENROLL_MOK:
-		if (is_ca_in_db (mok, mok_size, &efi_guid_security, "dbx") ||
-		    is_ca_in_db (mok, mok_size, &efi_guid_shim, "MokListXRT"))
-			return 1;
-		break;
-	default:
-		return 0;
+	const char *var_name = get_req_var_name (req);
+	pw_crypt_t pw_crypt;
+	SpoolEntry *spool = NULL;
+	unsigned int spool_num = 0;
+	uint8_t *old_data = NULL, *new_data = NULL;
+	size_t old_size = 0, new_size = 0;
+	uint32_t attributes;
+	char *spool_path = NULL;
+	SigIndex old_sigs, added;
+	int lock_fd = -1;
+	int ret = -1;
+
+	sig_index_init (&old_sigs);
+	sig_index_init (&added);
+
+	/* Ask for the password before blocking the other instances */
+	if (get_request_auth (pw_hash_file, root_pw, &pw_crypt) < 0)
+		return -1;
+
+	if (spool_add (var_name, esl, esl_size, &spool_path) < 0)
+		return -1;
+
+	lock_fd = lock_requests ();
+	if (lock_fd < 0)
+		goto error;
+
+	if (access (spool_path, F_OK) != 0) {
+		printf ("The request was committed together with another mokutil\n");
+		ret = 0;
+		goto error;
 	}
 
-	return 0;
-}
+	for (unsigned int retry = 0; retry < MAX_COMMIT_RETRIES; retry++) {
+		spool_free (spool, spool_num);
+		spool = NULL;
+		spool_num = 0;
+		sig_index_free (&old_sigs);
+		sig_index_free (&added);
+		free (old_data);
+		free (new_data);
+		old_data = new_data = NULL;
+		old_size = 0;
+
+		if (get_efi_variable (efi_guid_shim, var_name, &old_data,
+				      &old_size, &attributes) < 0) {
+			if (errno != ENOENT) {
+				fprintf (stderr, "Failed to read variable \"%s\": %m\n",
+					 var_name);
+				goto error;
+			}
+			old_data = NULL;
+			old_size = 0;
+		}
 
-/* Check whether the key is already in the kernel trusted keyring */
-static int
-is_in_trusted_keyring (const void *cert, const uint32_t cert_size)
-{
-	char *skid = NULL;
-	int ret;
+		if (spool_collect (var_name, &spool, &spool_num) < 0) {
+			fprintf (stderr, "Failed to read %s\n", REQ_SPOOL_DIR);
+			goto error;
+		}
 
-	if (get_cert_skid (cert, cert_size, &skid) < 0)
-		return 0;
+		/* Gather the queued signatures which are not in the request */
+		if (sig_index_add_esl (&old_sigs, old_data, old_size) < 0) {
+			fprintf (stderr, "Corrupted request \"%s\"\n", var_name);
+			goto error;
+		}
+		for (unsigned int i = 0; i < spool_num; i++) {
+			SigIndex queued;
+
+			sig_index_init (&queued);
+			if (sig_index_add_esl (&queued, spool[i].data,
+					       spool[i].data_size) < 0) {
+				sig_index_free (&queued);
+				goto error;
+			}
+			for (uint32_t n = 0; n < queued.entry_num; n++) {
+				const SigEntry *entry = &queued.entries[n];
+
+				if (sig_index_find (&old_sigs, &entry->type,
+						    entry->data,
+						    entry->data_size) >= 0)
+					continue;
+				if (sig_index_add (&added, &entry->type,
+						   &entry->owner, entry->data,
+						   entry->data_size) < 0) {
+					sig_index_free (&queued);
+					goto error;
+				}
+			}
+			sig_index_free (&queued);
+		}
+
+		if (added.entry_num == 0) {
+			/* Everything is already in the request */
+			spool_remove (spool, spool_num);
+			ret = 0;
+			goto error;
+		}
+
+		if (merge_request (old_data, old_size, &added, &new_data,
+				   &new_size) < 0)
+			goto error;
+
+		if (check_request_space (req, new_size, NULL, NULL, 0,
+					 old_size) < 0)
+			goto error;
+
+		ret = is_variable_unchanged (efi_guid_shim, var_name, old_data,
+					     old_size);
+		if (ret < 0) {
+			fprintf (stderr, "Failed to read variable \"%s\": %m\n",
+				 var_name);
+			goto error;
+		}
+		if (ret > 0)
+			break;
+		ret = -1;
+	}
+
+	if (ret <= 0) {
+		fprintf (stderr, "%s keeps changing, give up\n", var_name);
+		ret = -1;
+		goto error;
+	}
 
-	ret = match_skid_in_trusted_keyring (skid);
+	ret = write_request (new_data, new_size, req, &pw_crypt);
 	if (ret < 0)
-		ret = 0;
+		goto error;
 
-	free (skid);
+	/* The other instances find their spool files gone and finish */
+	spool_remove (spool, spool_num);
+	if (spool_num > 1)
+		printf ("Committed %u queued requests together\n", spool_num);
+error:
+	/* Don't leave our addition for the others if it wasn't committed */
+	if (ret < 0 && spool_path)
+		unlink (spool_path);
+	unlock_requests (lock_fd);
+	spool_free (spool, spool_num);
+	sig_index_free (&old_sigs);
+	sig_index_free (&added);
+	free (old_data);
+	free (new_data);
+	free (spool_path);
 
 	return ret;
 }
@@ -773,10 +1128,16 @@ in_reverse_pending_request (const efi_guid_t *type, const void *data,
 {
 	MokRequest reverse_req = get_reverse_req (req);
 
+	int ret;
+
 	if (!data || data_size == 0)
 		return 0;
 
-	return delete_data_from_req_var (reverse_req, type, data, data_size);
+	ret = delete_data_from_req_var (reverse_req, type, data, data_size);
+	if (ret > 0)
+		var_cache_invalidate (get_req_var_name (reverse_req));
+
+	return ret;
 }
 
 static void
@@ -784,7 +1145,7 @@ print_skip_message (const char *filename, const void *mok,
 		    const uint32_t mok_size, const MokRequest req)
 {
 	switch (req) {
-	case ENROLL_MOK:
+	case MOK_REQ_ENROLL_MOK:
 		if (is_duplicate (&efi_guid_x509_cert, mok, mok_size,
 				  &efi_guid_security, "db"))
 			printf ("%s is already in db\n", filename);
@@ -801,7 +1162,7 @@ print_skip_message (const char *filename, const void *mok,
 				       &efi_guid_shim, "MokListXRT"))
 			printf ("%s is blocked in MokListXRT\n", filename);
 		break;
-	case DELETE_MOK:
+	case MOK_REQ_DELETE_MOK:
 		if (!is_duplicate (&efi_guid_x509_cert, mok, mok_size,
 				   &efi_guid_shim, "MokListRT"))
 			printf ("%s is not in MokList\n", filename);
@@ -809,7 +1170,7 @@ print_skip_message (const char *filename, const void *mok,
 				       &efi_guid_shim, "MokDel"))
 			printf ("%s is already in the deletion request\n", filename);
 		break;
-	case ENROLL_BLACKLIST:
+	case MOK_REQ_ENROLL_BLACKLIST:
 		if (is_duplicate (&efi_guid_x509_cert, mok, mok_size,
 				  &efi_guid_shim, "MokListXRT"))
 			printf ("%s is already in MokListX\n", filename);
@@ -817,7 +1178,7 @@ print_skip_message (const char *filename, const void *mok,
 				       &efi_guid_shim, "MokXNew"))
 			printf ("%s is already in the MokX enrollment request\n", filename);
 		break;
-	case DELETE_BLACKLIST:
+	case MOK_REQ_DELETE_BLACKLIST:
 		if (!is_duplicate (&efi_guid_x509_cert, mok, mok_size,
 				   &efi_guid_shim, "MokListXRT"))
 			printf ("%s is not in MokListX\n", filename);
@@ -828,170 +1189,446 @@ print_skip_message (const char *filename, const void *mok,
 	}
 }
 
+typedef enum {
+	CERT_INVALID = 0,
+	CERT_IN_KEYRING,
+	CERT_CA_ENROLLED,
+	CERT_CA_BLOCKED,
+	CERT_VALID_REQUEST,
+	CERT_INVALID_REQUEST,
+	CERT_READ_ERROR,
+} CertVerdict;
+
+/* Where --test-key found a certificate */
+typedef enum {
+	KEY_ENROLLED    = MOK_KEY_ENROLLED,
+	KEY_PENDING     = MOK_KEY_PENDING,
+	KEY_BLOCKED     = MOK_KEY_BLOCKED,
+	KEY_IN_KEYRING  = MOK_KEY_IN_KEYRING,
+	KEY_CA_ENROLLED = MOK_KEY_CA_ENROLLED,
+	KEY_CA_BLOCKED  = MOK_KEY_CA_BLOCKED,
+	KEY_IN_FILE     = (1 << 6),
+} KeyState;
+
+typedef struct {
+	char          *name;
+	const uint8_t *cert;
+	uint32_t       cert_size;
+	CertVerdict    verdict;
+	unsigned int   state;
+} CertInput;
+
+typedef struct {
+	char           **paths;
+	unsigned int     path_num;
+	EslFile         *files;
+	int             *file_rets;
+	CertInput       *certs;
+	unsigned int     cert_num;
+	MokRequest       req;
+	const SigIndex  *file_index;
+} CertBatch;
+
 static int
-issue_mok_request (char **files, const uint32_t total, const MokRequest req,
-		   const char *pw_hash_file, const int root_pw)
+add_input_path (CertBatch *batch, const char *path)
 {
-	uint8_t *old_req_data = NULL;
-	size_t old_req_data_size = 0;
-	uint32_t attributes;
-	void *new_list = NULL;
-	void *ptr;
+	char **paths_new;
+
+	paths_new = realloc (batch->paths, (batch->path_num + 1) * sizeof(char *));
+	if (!paths_new)
+		return -1;
+	batch->paths = paths_new;
+
+	batch->paths[batch->path_num] = strdup (path);
+	if (!batch->paths[batch->path_num])
+		return -1;
+	batch->path_num++;
+
+	return 0;
+}
+
+static int
+filter_visible (const struct dirent *entry)
+{
+	return entry->d_name[0] != '.';
+}
+
+/* Add the file, the regular files in the directory, or "-" for stdin */
+static int
+expand_input_path (CertBatch *batch, const char *arg)
+{
+	struct dirent **entries;
 	struct stat buf;
-	unsigned long list_size = 0;
-	unsigned long real_size = 0;
-	uint32_t *sizes = NULL;
-	int fd = -1;
-	ssize_t read_size;
-	int ret = -1;
-	EFI_SIGNATURE_LIST *CertList;
-	EFI_SIGNATURE_DATA *CertData;
-	const char *var_name = get_req_var_name (req);
+	char path[PATH_MAX];
+	int entry_num, ret = 0;
 
-	if (!files)
+	if (strcmp (arg, "-") == 0 || stat (arg, &buf) != 0 ||
+	    !S_ISDIR (buf.st_mode))
+		return add_input_path (batch, arg);
+
+	entry_num = scandir (arg, &entries, filter_visible, alphasort);
+	if (entry_num < 0) {
+		fprintf (stderr, "Failed to read directory %s: %m\n", arg);
 		return -1;
+	}
 
-	sizes = malloc (total * sizeof(uint32_t));
-	if (!sizes) {
-		fprintf (stderr, "Failed to allocate space for sizes\n");
-		goto error;
+	for (int i = 0; i < entry_num; i++) {
+		snprintf (path, sizeof(path), "%s/%s", arg, entries[i]->d_name);
+		if (ret == 0 && stat (path, &buf) == 0 && S_ISREG (buf.st_mode))
+			ret = add_input_path (batch, path);
+		free (entries[i]);
+	}
+	free (entries);
+
+	return ret;
+}
+
+static void
+load_input_file (const unsigned int index, void *data)
+{
+	CertBatch *batch = data;
+
+	batch->file_rets[index] = esl_file_open (batch->paths[index],
+						 &batch->files[index]);
+}
+
+static int
+add_input_cert (CertBatch *batch, const char *name, const unsigned int num,
+		const MokListNode *node)
+{
+	CertInput *certs_new, *input;
+	size_t name_len;
+
+	certs_new = realloc (batch->certs, (batch->cert_num + 1) * sizeof(CertInput));
+	if (!certs_new)
+		return -1;
+	batch->certs = certs_new;
+
+	input = &batch->certs[batch->cert_num];
+	memset (input, 0, sizeof(CertInput));
+
+	/* Tell the certificates in a bundle apart with the index */
+	name_len = strlen (name) + 12;
+	input->name = malloc (name_len);
+	if (!input->name)
+		return -1;
+	if (num > 0)
+		snprintf (input->name, name_len, "%s:%u", name, num);
+	else
+		snprintf (input->name, name_len, "%s", name);
+
+	input->cert = node->mok;
+	input->cert_size = node->mok_size;
+	batch->cert_num++;
+
+	return 0;
+}
+
+static void
+free_cert_batch (CertBatch *batch)
+{
+	for (unsigned int i = 0; i < batch->cert_num; i++)
+		free (batch->certs[i].name);
+	free (batch->certs);
+
+	for (unsigned int i = 0; i < batch->path_num; i++) {
+		if (batch->files && batch->file_rets && batch->file_rets[i] == 0)
+			esl_file_close (&batch->files[i]);
+		free (batch->paths[i]);
 	}
+	free (batch->paths);
+	free (batch->files);
+	free (batch->file_rets);
+
+	memset (batch, 0, sizeof(CertBatch));
+}
+
+/*
+ * Collect the certificates from DER files, PEM bundles, signature lists,
+ * directories and stdin. The files are mapped and decoded in parallel while
+ * the certificates keep the order of the arguments.
+ */
+static int
+load_cert_batch (CertBatch *batch, char **args, const uint32_t total)
+{
+	MokListNode *list;
+	uint32_t mok_num, cert_num;
+	int stdin_num = 0;
+
+	memset (batch, 0, sizeof(CertBatch));
 
-	/* get the sizes of the key files */
 	for (unsigned int i = 0; i < total; i++) {
-		if (stat (files[i], &buf) != 0) {
-			fprintf (stderr, "Failed to get file status, %s\n",
-			         files[i]);
-			goto error;
+		if (strcmp (args[i], "-") == 0 && stdin_num++ > 0) {
+			fprintf (stderr, "stdin can only be read once\n");
+			return -1;
 		}
+		if (expand_input_path (batch, args[i]) < 0)
+			return -1;
+	}
 
-		sizes[i] = buf.st_size;
-		list_size += buf.st_size;
+	if (batch->path_num == 0) {
+		fprintf (stderr, "No key file is given\n");
+		return -1;
 	}
 
-	list_size += sizeof(EFI_SIGNATURE_LIST) * total;
-	list_size += sizeof(efi_guid_t) * total;
+	batch->files = calloc (batch->path_num, sizeof(EslFile));
+	batch->file_rets = calloc (batch->path_num, sizeof(int));
+	if (!batch->files || !batch->file_rets) {
+		fprintf (stderr, "Failed to allocate space for key files\n");
+		return -1;
+	}
 
-	ret = efi_get_variable (efi_guid_shim, var_name, &old_req_data,
-				&old_req_data_size, &attributes);
-	if (ret < 0) {
-		if (errno != ENOENT) {
-			fprintf (stderr, "Failed to read variable \"%s\": %m\n",
-				 var_name);
-			goto error;
+	run_parallel (batch->path_num, load_input_file, batch);
+
+	for (unsigned int i = 0; i < batch->path_num; i++) {
+		if (batch->file_rets[i] < 0) {
+			fprintf (stderr, "Abort!!! Failed to load %s\n",
+				 batch->paths[i]);
+			return -1;
 		}
-	} else {
-		list_size += old_req_data_size;
 	}
-	ret = -1;
 
-	new_list = malloc (list_size);
-	if (!new_list) {
-		fprintf (stderr, "Failed to allocate space for %s\n",
-			 var_name);
-		goto error;
-	}
-	ptr = new_list;
+	for (unsigned int i = 0; i < batch->path_num; i++) {
+		list = build_mok_list (batch->files[i].data,
+				       batch->files[i].data_size, &mok_num);
+		if (list == NULL) {
+			fprintf (stderr, "No certificate in %s\n", batch->paths[i]);
+			continue;
+		}
 
-	for (unsigned int i = 0; i < total; i++) {
-		CertList = ptr;
-		CertData = (EFI_SIGNATURE_DATA *)(((uint8_t *)ptr) +
-						  sizeof(EFI_SIGNATURE_LIST));
-
-		CertList->SignatureType = efi_guid_x509_cert;
-		CertList->SignatureListSize = sizes[i] +
-		   sizeof(EFI_SIGNATURE_LIST) + sizeof(EFI_SIGNATURE_DATA) - 1;
-		CertList->SignatureHeaderSize = 0;
-		CertList->SignatureSize = sizes[i] + sizeof(efi_guid_t);
-		CertData->SignatureOwner = efi_guid_shim;
-
-		fd = open (files[i], O_RDONLY);
-		if (fd == -1) {
-			fprintf (stderr, "Failed to open %s\n", files[i]);
-			goto error;
+		cert_num = 0;
+		for (unsigned int n = 0; n < mok_num; n++) {
+			efi_guid_t sigtype = list[n].header->SignatureType;
+
+			if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) == 0)
+				cert_num++;
 		}
+		if (cert_num < mok_num)
+			printf ("Ignore the hashes in %s\n", batch->paths[i]);
 
-		ptr = CertData->SignatureData;
+		for (unsigned int n = 0, num = 0; n < mok_num; n++) {
+			efi_guid_t sigtype = list[n].header->SignatureType;
 
-		/* Mok */
-		read_size = read (fd, ptr, sizes[i]);
-		if (read_size < 0 || read_size != (int64_t)sizes[i]) {
-			fprintf (stderr, "Failed to read %s\n", files[i]);
-			close (fd);
-			goto error;
+			if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0)
+				continue;
+
+			num++;
+			if (add_input_cert (batch, batch->paths[i],
+					    cert_num > 1 ? num : 0,
+					    &list[n]) < 0) {
+				fprintf (stderr, "Failed to allocate space for certificates\n");
+				free (list);
+				return -1;
+			}
 		}
+		free (list);
+	}
+
+	return 0;
+}
+
+/* Run the read-only checks of a certificate. This may run in any thread. */
+static void
+check_input_cert (const unsigned int index, void *data)
+{
+	CertBatch *batch = data;
+	CertInput *input = &batch->certs[index];
+	const MokRequest req = batch->req;
+	const void *mok = input->cert;
+	const uint32_t mok_size = input->cert_size;
+	int rc;
+
+	if (!is_valid_cert (mok, mok_size))
+		input->verdict = CERT_INVALID;
+	else if (req == MOK_REQ_ENROLL_MOK && check_keyring &&
+		 is_in_trusted_keyring (mok, mok_size))
+		input->verdict = CERT_IN_KEYRING;
+	else if (force_ca_check &&
+		 (rc = is_ca_enrolled (mok, mok_size, req)) != 0)
+		input->verdict = rc < 0 ? CERT_READ_ERROR : CERT_CA_ENROLLED;
+	else if (force_ca_check &&
+		 (rc = is_ca_blocked (mok, mok_size, req)) != 0)
+		input->verdict = rc < 0 ? CERT_READ_ERROR : CERT_CA_BLOCKED;
+	else if ((rc = is_valid_request (&efi_guid_x509_cert, mok, mok_size,
+					 req)) < 0)
+		input->verdict = CERT_READ_ERROR;
+	else
+		input->verdict = rc ? CERT_VALID_REQUEST : CERT_INVALID_REQUEST;
+}
+
+static int
+issue_mok_request (char **files, const uint32_t total, const MokRequest req,
+		   const char *pw_hash_file, const int root_pw)
+{
+	size_t old_req_data_size = 0;
+	uint8_t *new_list = NULL;
+	size_t list_size = 0;
+	int ret = -1;
+	const char *var_name = get_req_var_name (req);
+	CertBatch batch;
+	SigIndex new_certs, reverse_certs;
+	uint8_t *removed = NULL;
+	const char **new_names = NULL;
+	size_t *new_sizes = NULL;
+
+	if (!files)
+		return -1;
+
+	sig_index_init (&new_certs);
+	sig_index_init (&reverse_certs);
+
+	if (load_cert_batch (&batch, files, total) < 0)
+		goto error;
 
-		const void *mok = ptr;
-		const uint32_t mok_size = sizes[i];
+	batch.req = req;
+	run_parallel (batch.cert_num, check_input_cert, &batch);
 
-		if (!is_valid_cert (mok, mok_size)) {
+	/* Abort before changing anything if any certificate is invalid */
+	for (unsigned int i = 0; i < batch.cert_num; i++) {
+		if (batch.certs[i].verdict == CERT_INVALID) {
 			fprintf (stderr, "Abort!!! %s is not a valid x509 certificate in DER format\n",
-			         files[i]);
-			close (fd);
+				 batch.certs[i].name);
+			goto error;
+		}
+		if (batch.certs[i].verdict == CERT_READ_ERROR) {
+			fprintf (stderr, "Failed to read the key databases to check %s\n",
+				 batch.certs[i].name);
 			goto error;
 		}
+	}
 
-		/* Check whether the key is already in the trusted keyring */
-		if (req == ENROLL_MOK && check_keyring &&
-		    is_in_trusted_keyring (mok, mok_size)) {
-			printf ("Already in kernel trusted keyring. Skip %s\n",
-				files[i]);
-			close (fd);
+	/* Sort the keys into the new request and the reverse one to cancel */
+	for (unsigned int i = 0; i < batch.cert_num; i++) {
+		const CertInput *input = &batch.certs[i];
+		SigIndex *set;
+
+		if (input->verdict == CERT_VALID_REQUEST)
+			set = &new_certs;
+		else if (input->verdict == CERT_INVALID_REQUEST)
+			set = &reverse_certs;
+		else
 			continue;
+		if (sig_index_add (set, &efi_guid_x509_cert, &efi_guid_shim,
+				   input->cert, input->cert_size) < 0) {
+			fprintf (stderr, "Failed to allocate space for certificates\n");
+			goto error;
 		}
+	}
 
-		/* Check whether CA is already enrolled */
-		if (force_ca_check && is_ca_enrolled (mok, mok_size, req)) {
-			printf ("CA enrolled. Skip %s\n", files[i]);
-			close (fd);
-			continue;
+	/* Check the space before writing any variable */
+	if (new_certs.entry_num > 0) {
+		if (efi_get_variable_size (efi_guid_shim, var_name,
+					   &old_req_data_size) < 0)
+			old_req_data_size = 0;
+
+		if (sig_index_to_esl (&new_certs, &new_list, &list_size) < 0) {
+			fprintf (stderr, "Failed to allocate space for %s\n",
+				 var_name);
+			goto error;
 		}
 
-		/* Check whether CA is blocked */
-		if (force_ca_check && is_ca_blocked (mok, mok_size, req)) {
-			printf ("CA blocked. Skip %s\n", files[i]);
-			close (fd);
-			continue;
+		new_names = calloc (new_certs.entry_num, sizeof(char *));
+		new_sizes = calloc (new_certs.entry_num, sizeof(size_t));
+		if (!new_names || !new_sizes) {
+			fprintf (stderr, "Failed to allocate memory\n");
+			goto error;
 		}
+		for (unsigned int i = 0; i < batch.cert_num; i++) {
+			const CertInput *input = &batch.certs[i];
+			int idx;
 
-		if (is_valid_request (&efi_guid_x509_cert, mok, mok_size, req)) {
-			ptr += mok_size;
-			real_size += mok_size + sizeof(EFI_SIGNATURE_LIST) + sizeof(efi_guid_t);
-		} else if (in_reverse_pending_request (&efi_guid_x509_cert, mok, mok_size, req)) {
-			printf ("Removed %s from %s\n", files[i],
-				get_reverse_req_var_name (req));
-			ptr -= sizeof(EFI_SIGNATURE_LIST) + sizeof(efi_guid_t);
-		} else {
-			printf ("SKIP: ");
-			print_skip_message (files[i], mok, mok_size, req);
-			ptr -= sizeof(EFI_SIGNATURE_LIST) + sizeof(efi_guid_t);
+			if (input->verdict != CERT_VALID_REQUEST)
+				continue;
+			idx = sig_index_find (&new_certs, &efi_guid_x509_cert,
+					      input->cert, input->cert_size);
+			if (idx >= 0 && !new_names[idx]) {
+				new_names[idx] = input->name;
+				new_sizes[idx] = sizeof(EFI_SIGNATURE_LIST) +
+						 sizeof(efi_guid_t) +
+						 input->cert_size;
+			}
 		}
 
-		close (fd);
+		if (check_request_space (req, list_size + old_req_data_size,
+					 new_names, new_sizes,
+					 new_certs.entry_num,
+					 old_req_data_size) < 0)
+			goto error;
 	}
 
-	/* All keys are in the list, nothing to do here... */
-	if (real_size == 0) {
-		ret = 0;
-		goto error;
+	/* Cancel the keys pending in the reverse request with one write */
+	if (reverse_certs.entry_num > 0) {
+		removed = malloc (reverse_certs.entry_num);
+		if (!removed) {
+			fprintf (stderr, "Failed to allocate space for certificates\n");
+			goto error;
+		}
+		if (delete_sigs_from_req_var (get_reverse_req (req),
+					      &reverse_certs, removed) < 0)
+			goto error;
+		var_cache_invalidate (get_reverse_req_var_name (req));
 	}
 
-	/* append the keys to the previous request */
-	if (old_req_data && old_req_data_size) {
-		memcpy (new_list + real_size, old_req_data, old_req_data_size);
-		real_size += old_req_data_size;
+	for (unsigned int i = 0; i < batch.cert_num; i++) {
+		const CertInput *input = &batch.certs[i];
+		int idx;
+
+		switch (input->verdict) {
+		case CERT_IN_KEYRING:
+			printf ("Already in kernel trusted keyring. Skip %s\n",
+				input->name);
+			break;
+		case CERT_CA_ENROLLED:
+			printf ("CA enrolled. Skip %s\n", input->name);
+			break;
+		case CERT_CA_BLOCKED:
+			printf ("CA blocked. Skip %s\n", input->name);
+			break;
+		case CERT_VALID_REQUEST:
+			/* The first file of a duplicate named the entry */
+			idx = sig_index_find (&new_certs, &efi_guid_x509_cert,
+					      input->cert, input->cert_size);
+			if (idx >= 0 && new_names[idx] != input->name)
+				printf ("SKIP: %s is already in the request\n",
+					input->name);
+			break;
+		case CERT_INVALID_REQUEST:
+			idx = sig_index_find (&reverse_certs, &efi_guid_x509_cert,
+					      input->cert, input->cert_size);
+			if (idx >= 0 && removed[idx]) {
+				printf ("Removed %s from %s\n", input->name,
+					get_reverse_req_var_name (req));
+				/* Report a duplicate in the batch as skipped */
+				removed[idx] = 0;
+			} else {
+				printf ("SKIP: ");
+				print_skip_message (input->name, input->cert,
+						    input->cert_size, req);
+			}
+			break;
+		default:
+			break;
+		}
 	}
 
-	if (update_request (new_list, real_size, req, pw_hash_file, root_pw) < 0) {
+	/* All keys are in the list, nothing to do here... */
+	if (new_certs.entry_num == 0) {
+		ret = 0;
 		goto error;
 	}
 
+	if (commit_request (new_list, list_size, req, pw_hash_file,
+			    root_pw) < 0)
+		goto error;
+
 	ret = 0;
 error:
-	if (sizes)
-		free (sizes);
-	if (old_req_data)
-		free (old_req_data);
+	sig_index_free (&new_certs);
+	sig_index_free (&reverse_certs);
+	free (removed);
+	free (new_names);
+	free (new_sizes);
+	free_cert_batch (&batch);
 	if (new_list)
 		free (new_list);
 
@@ -1019,22 +1656,17 @@ static int
 issue_hash_request (const char *hash_str, const MokRequest req,
 		    const char *pw_hash_file, const int root_pw)
 {
-	uint8_t *old_req_data = NULL;
 	size_t old_req_data_size = 0;
-	uint32_t attributes;
-	void *new_list = NULL;
-	void *ptr;
-	unsigned long list_size = 0;
-	uint32_t sig_size, sig_list_size;
+	uint8_t hash_list[sizeof(EFI_SIGNATURE_LIST) + sizeof(efi_guid_t) +
+			  SHA512_DIGEST_LENGTH];
+	unsigned long list_size;
 	int ret = -1;
 	EFI_SIGNATURE_LIST *CertList;
 	EFI_SIGNATURE_DATA *CertData;
 	efi_guid_t hash_type;
 	uint8_t db_hash[SHA512_DIGEST_LENGTH];
 	int hash_size;
-	int merge_ind = -1;
-	MokListNode *mok_list = NULL;
-	uint32_t mok_num;
+	int valid;
 	const char *var_name = get_req_var_name (req);
 
 	if (!hash_str)
@@ -1047,216 +1679,251 @@ issue_hash_request (const char *hash_str, const MokRequest req,
 	if (hex_str_to_binary (hash_str, db_hash, hash_size) < 0)
 		return -1;
 
-	if (is_valid_request (&hash_type, db_hash, hash_size, req) == 0) {
+	valid = is_valid_request (&hash_type, db_hash, hash_size, req);
+	if (valid < 0) {
+		fprintf (stderr, "Failed to read the key databases\n");
+		goto error;
+	} else if (valid == 0) {
 		printf ("Skip hash\n");
 		ret = 0;
 		goto error;
-	} else if (in_reverse_pending_request (&hash_type, db_hash, hash_size, req)) {
+	}
+
+	valid = in_reverse_pending_request (&hash_type, db_hash, hash_size, req);
+	if (valid < 0) {
+		goto error;
+	} else if (valid > 0) {
 		printf ("Removed hash from %s\n", get_reverse_req_var_name (req));
 		ret = 0;
 		goto error;
 	}
 
+	/* The hash is merged into the list of the same type when committed */
 	list_size = sizeof(EFI_SIGNATURE_LIST) + sizeof(efi_guid_t) + hash_size;
+	CertList = (EFI_SIGNATURE_LIST *)hash_list;
+	CertList->SignatureType = hash_type;
+	CertList->SignatureListSize = list_size;
+	CertList->SignatureHeaderSize = 0;
+	CertList->SignatureSize = hash_size + sizeof(efi_guid_t);
+
+	CertData = (EFI_SIGNATURE_DATA *)(hash_list + sizeof(EFI_SIGNATURE_LIST));
+	CertData->SignatureOwner = efi_guid_shim;
+	memcpy (CertData->SignatureData, db_hash, hash_size);
+
+	if (efi_get_variable_size (efi_guid_shim, var_name,
+				   &old_req_data_size) < 0)
+		old_req_data_size = 0;
+
+	if (check_request_space (req, list_size + old_req_data_size, NULL,
+				 NULL, 0, old_req_data_size) < 0)
+		goto error;
 
-	ret = efi_get_variable (efi_guid_shim, var_name, &old_req_data,
-				&old_req_data_size, &attributes);
-	if (ret < 0) {
-		if (errno != ENOENT) {
-			fprintf (stderr, "Failed to read variable \"%s\": %m\n",
-				 var_name);
-			goto error;
-		}
-	} else {
-		list_size += old_req_data_size;
-		mok_list = build_mok_list (old_req_data, old_req_data_size,
-					   &mok_num);
-		if (mok_list == NULL)
-			goto error;
-		/* Check if there is a signature list with the same type */
-		for (unsigned int i = 0; i < mok_num; i++) {
-			efi_guid_t sigtype = mok_list[i].header->SignatureType;
-			if (efi_guid_cmp (&sigtype, &hash_type) == 0) {
-				merge_ind = i;
-				list_size -= sizeof(EFI_SIGNATURE_LIST);
-				break;
-			}
-		}
-	}
-	ret = -1;
-
-	new_list = malloc (list_size);
-	if (!new_list) {
-		fprintf (stderr, "Failed to allocate space for %s: %m\n",
-			 var_name);
+	if (commit_request (hash_list, list_size, req, pw_hash_file,
+			    root_pw) < 0)
 		goto error;
-	}
-	ptr = new_list;
-
-	if (merge_ind < 0) {
-		/* Create a new signature list for the hash */
-		sig_list_size = sizeof(EFI_SIGNATURE_LIST) +
-				sizeof(efi_guid_t) + hash_size;
-		CertList = ptr;
-		CertList->SignatureType = hash_type;
-		CertList->SignatureListSize = sig_list_size;
-		CertList->SignatureHeaderSize = 0;
-		CertList->SignatureSize = hash_size + sizeof(efi_guid_t);
-
-		CertData = (EFI_SIGNATURE_DATA *)(((uint8_t *)ptr) +
-						  sizeof(EFI_SIGNATURE_LIST));
-		CertData->SignatureOwner = efi_guid_shim;
-		memcpy (CertData->SignatureData, db_hash, hash_size);
-
-		/* prepend the hash to the previous request */
-		ptr += sig_list_size;
-		if (old_req_data) {
-			memcpy (ptr, old_req_data, old_req_data_size);
-		}
-	} else {
-		/* Merge the hash into an existed signature list */
-		unsigned int i;
-
-		for (i = 0; i < (unsigned int)merge_ind; i++) {
-			sig_list_size = mok_list[i].header->SignatureListSize;
-			memcpy (ptr, (void *)mok_list[i].header, sig_list_size);
-			ptr += sig_list_size;
-		}
-
-		/* Append the hash to the list */
-		i = merge_ind;
-		sig_list_size = mok_list[i].header->SignatureListSize;
-		sig_size = hash_size + sizeof(efi_guid_t);
-		mok_list[i].header->SignatureListSize += sig_size;
-		memcpy (ptr, (void *)mok_list[i].header, sig_list_size);
-		ptr += sig_list_size;
-		memcpy (ptr, (void *)&hash_type, sizeof(efi_guid_t));
-		ptr += sizeof(efi_guid_t);
-		memcpy (ptr, db_hash, hash_size);
-		ptr += hash_size;
-
-		for (i = (unsigned int)merge_ind + 1; i < mok_num; i++) {
-			sig_list_size = mok_list[i].header->SignatureListSize;
-			memcpy (ptr, (void *)mok_list[i].header, sig_list_size);
-			ptr += sig_list_size;
-		}
-	}
-
-	if (update_request (new_list, list_size, req, pw_hash_file, root_pw) < 0) {
-		goto error;
-	}
 
 	ret = 0;
 error:
-	if (old_req_data)
-		free (old_req_data);
-	if (mok_list)
-		free (mok_list);
-	if (new_list)
-		free (new_list);
-
 	return ret;
 }
 
 static int
 revoke_request (const MokRequest req)
 {
-	if (test_and_delete_mok_var (get_req_var_name(req)) < 0)
+	int lock_fd, ret = -1;
+
+	lock_fd = lock_requests ();
+	if (lock_fd < 0)
 		return -1;
+
+	if (test_and_delete_mok_var (get_req_var_name(req)) < 0)
+		goto error;
 	if (test_and_delete_mok_var (get_req_auth_var_name(req)) < 0)
-		return -1;
+		goto error;
 
-	return 0;
+	ret = 0;
+error:
+	unlock_requests (lock_fd);
+
+	return ret;
 }
 
+/*
+ * Rewrite the request variable canonically: one list per certificate, one
+ * list per hash type, sorted and without duplicates. The lists of unknown
+ * types are kept as they are at the end. The Auth variable in the
+ * pw_crypt_t format only holds the password hash, so it stays valid for
+ * the rewritten request; a request with a legacy Auth is left alone.
+ */
 static int
-export_db_keys (const DBName db_name)
+compact_req_var (const MokRequest req)
 {
-	const char *db_var_name;
-	uint8_t *data = NULL;
-	size_t data_size = 0;
-	uint32_t attributes;
-	char filename[PATH_MAX];
-	uint32_t mok_num;
-	efi_guid_t guid = efi_guid_shim;
-	MokListNode *list;
-	int fd;
-	mode_t mode;
-	int ret = -1;
-
-	switch (db_name) {
-		case MOK_LIST_RT:
-		case MOK_LIST_X_RT:
-			guid = efi_guid_shim;
-			break;
-		case PK:
-		case KEK:
-			guid = efi_guid_global;
-			break;
-		case DB:
-		case DBX:
-			guid = efi_guid_security;
-			break;
-	};
+	const char *var_name = get_req_var_name (req);
+	uint8_t *var_data = NULL, *new_data = NULL, *unknown = NULL;
+	uint8_t *auth_data = NULL;
+	size_t var_data_size = 0, new_size = 0, unknown_size = 0, auth_size;
+	uint32_t attributes, auth_attributes;
+	uint32_t sig_num = 0;
+	SigIndex index;
+	uint8_t *ptr, *end;
+	void *new_buf;
+	int ret;
 
-	db_var_name = get_db_var_name(db_name);
+	sig_index_init (&index);
 
-	ret = efi_get_variable (guid, db_var_name, &data, &data_size,
-				&attributes);
+	ret = get_efi_variable (efi_guid_shim, var_name, &var_data,
+				&var_data_size, &attributes);
 	if (ret < 0) {
 		if (errno == ENOENT) {
-			printf ("%s is empty\n", db_var_name);
+			printf ("%s: no pending request\n", var_name);
 			return 0;
 		}
-
-		fprintf (stderr, "Failed to read %s: %m\n", db_var_name);
+		fprintf (stderr, "Failed to read variable \"%s\": %m\n",
+			 var_name);
 		return -1;
 	}
 	ret = -1;
 
-	list = build_mok_list (data, data_size, &mok_num);
-	if (list == NULL) {
-		return -1;
+	unknown = malloc (var_data_size);
+	if (!unknown) {
+		fprintf (stderr, "Failed to allocate memory\n");
+		goto error;
 	}
 
-	/* mode 644 */
-	mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-	for (unsigned i = 0; i < mok_num; i++) {
-		off_t offset = 0;
-		ssize_t write_size;
-		efi_guid_t sigtype = list[i].header->SignatureType;
-
-		if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0)
+	ptr = var_data;
+	end = var_data + var_data_size;
+	while (ptr < end) {
+		EFI_SIGNATURE_LIST *list = (EFI_SIGNATURE_LIST *)ptr;
+		uint32_t list_size, hdr_size, sig_size;
+		efi_guid_t sigtype;
+
+		if ((size_t)(end - ptr) < sizeof(EFI_SIGNATURE_LIST))
+			goto corrupted;
+		list_size = list->SignatureListSize;
+		hdr_size = sizeof(EFI_SIGNATURE_LIST) + list->SignatureHeaderSize;
+		sig_size = list->SignatureSize;
+		if (list_size < hdr_size || list_size > (size_t)(end - ptr) ||
+		    sig_size <= sizeof(efi_guid_t) ||
+		    (list_size - hdr_size) % sig_size != 0)
+			goto corrupted;
+		sigtype = list->SignatureType;
+
+		if (list->SignatureHeaderSize != 0 ||
+		    (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0 &&
+		     signature_size (&sigtype) != sig_size)) {
+			memcpy (unknown + unknown_size, ptr, list_size);
+			unknown_size += list_size;
+			ptr += list_size;
 			continue;
-
-		/* Dump X509 certificate to files */
-		snprintf (filename, PATH_MAX, "%s-%04d.der",
-			  get_db_friendly_name(db_name), i+1);
-		fd = open (filename, O_CREAT | O_WRONLY, mode);
-		if (fd < 0) {
-			fprintf (stderr, "Failed to open %s: %m\n", filename);
-			goto error;
 		}
 
-		while (offset < (int64_t)list[i].mok_size) {
-			write_size = write (fd, list[i].mok + offset,
-						list[i].mok_size - offset);
-			if (write_size < 0) {
-				fprintf (stderr, "Failed to write %s: %m\n",
-					 filename);
-				close (fd);
+		for (uint8_t *sig = ptr + hdr_size; sig < ptr + list_size;
+		     sig += sig_size) {
+			efi_guid_t owner;
+
+			memcpy (&owner, sig, sizeof(efi_guid_t));
+			if (sig_index_add (&index, &sigtype, &owner,
+					   sig + sizeof(efi_guid_t),
+					   sig_size - sizeof(efi_guid_t)) < 0) {
+				fprintf (stderr, "Failed to allocate memory\n");
 				goto error;
 			}
-			offset += write_size;
+			sig_num++;
 		}
+		ptr += list_size;
+	}
 
-		close (fd);
+	if (sig_index_sort (&index) < 0 ||
+	    sig_index_to_esl (&index, &new_data, &new_size) < 0) {
+		fprintf (stderr, "Failed to allocate memory\n");
+		goto error;
+	}
+
+	if (unknown_size > 0) {
+		new_buf = realloc (new_data, new_size + unknown_size);
+		if (!new_buf) {
+			fprintf (stderr, "Failed to allocate memory\n");
+			goto error;
+		}
+		new_data = new_buf;
+		memcpy (new_data + new_size, unknown, unknown_size);
+		new_size += unknown_size;
+	}
+
+	/* Splitting the lists may grow a request without duplicates */
+	if (new_size >= var_data_size) {
+		printf ("%s: already compact (%zu bytes)\n", var_name,
+			var_data_size);
+		ret = 0;
+		goto error;
+	}
+
+	/*
+	 * The legacy auth is the SHA-256 digest of the request data and the
+	 * password, so rewriting the data would invalidate it.
+	 */
+	ret = get_efi_variable (efi_guid_shim, get_req_auth_var_name (req),
+				&auth_data, &auth_size, &auth_attributes);
+	if (ret < 0 && errno != ENOENT) {
+		fprintf (stderr, "Failed to read variable \"%s\": %m\n",
+			 get_req_auth_var_name (req));
+		ret = -1;
+		goto error;
+	}
+	ret = -1;
+	if (auth_data && auth_size != PASSWORD_CRYPT_SIZE) {
+		printf ("%s: skipped, %s holds a digest of the request\n",
+			var_name, get_req_auth_var_name (req));
+		ret = 0;
+		goto error;
 	}
 
+	attributes = EFI_VARIABLE_NON_VOLATILE
+		     | EFI_VARIABLE_BOOTSERVICE_ACCESS
+		     | EFI_VARIABLE_RUNTIME_ACCESS;
+	if (set_efi_variable (efi_guid_shim, var_name, new_data, new_size,
+			      attributes, S_IRUSR | S_IWUSR) < 0) {
+		fprintf (stderr, "Failed to write variable \"%s\": %m\n",
+			 var_name);
+		goto error;
+	}
+	efi_chmod_variable (efi_guid_shim, var_name, S_IRUSR | S_IWUSR);
+	var_cache_invalidate (var_name);
+
+	printf ("%s: %zu -> %zu bytes, saved %zu bytes, removed %u duplicates\n",
+		var_name, var_data_size, new_size, var_data_size - new_size,
+		sig_num - index.entry_num);
+
 	ret = 0;
+	goto error;
+
+corrupted:
+	fprintf (stderr, "Corrupted signature list in %s\n", var_name);
 error:
-	free (list);
-	free (data);
+	sig_index_free (&index);
+	free (var_data);
+	free (new_data);
+	free (unknown);
+	free (auth_data);
+
+	return ret;
+}
+
+static int
+compact_request (const MokRequest enroll_req, const MokRequest delete_req)
+{
+	int lock_fd, ret;
+
+	/* Hold the lock over the read-modify-write of both requests */
+	lock_fd = lock_requests ();
+	if (lock_fd < 0)
+		return -1;
+
+	ret = compact_req_var (enroll_req);
+	if (ret == 0)
+		ret = compact_req_var (delete_req);
+
+	unlock_requests (lock_fd);
 
 	return ret;
 }
@@ -1299,7 +1966,7 @@ set_password (const char *pw_hash_file, const int root_pw, const int clear)
 	uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
 			      | EFI_VARIABLE_BOOTSERVICE_ACCESS
 			      | EFI_VARIABLE_RUNTIME_ACCESS;
-	ret = efi_set_variable (efi_guid_shim, "MokPW", (void *)&pw_crypt,
+	ret = set_efi_variable (efi_guid_shim, "MokPW", (void *)&pw_crypt,
 				PASSWORD_CRYPT_SIZE, attributes,
 				S_IRUSR | S_IWUSR);
 	if (ret < 0) {
@@ -1314,6 +1981,214 @@ error:
 	return ret;
 }
 
+/* Rebuild the crypt settings string that produced the hash in pw_crypt */
+static int
+get_pw_crypt_settings (const pw_crypt_t *pw_crypt, char settings[SETTINGS_LEN])
+{
+	const char *prefix;
+	size_t salt_len;
+	int len;
+
+	if (pw_crypt->salt_size > sizeof (pw_crypt->salt))
+		return -1;
+	salt_len = strnlen ((const char *)pw_crypt->salt, pw_crypt->salt_size);
+
+	switch (pw_crypt->method) {
+	case TRADITIONAL_DES:
+	case MD5_BASED:
+		prefix = get_crypt_prefix (pw_crypt->method);
+		len = snprintf (settings, SETTINGS_LEN, "%s%.*s", prefix,
+				(int)salt_len, pw_crypt->salt);
+		break;
+	case SHA256_BASED:
+	case SHA512_BASED:
+		prefix = get_crypt_prefix (pw_crypt->method);
+		len = snprintf (settings, SETTINGS_LEN, "%srounds=%" PRIu64 "$%.*s",
+				prefix, pw_crypt->iter_count, (int)salt_len,
+				pw_crypt->salt);
+		break;
+	case BLOWFISH_BASED:
+		/* The salt keeps the whole "$2y$NN$" prefix */
+		len = snprintf (settings, SETTINGS_LEN, "%.*s", (int)salt_len,
+				pw_crypt->salt);
+		break;
+	default:
+		return -1;
+	}
+
+	if (len < 0 || (size_t)len >= SETTINGS_LEN)
+		return -1;
+
+	return 0;
+}
+
+/* Returns 1 if the password produces the hash in pw_crypt, 0 if not */
+static int
+match_pw_crypt (const pw_crypt_t *pw_crypt, const char *password)
+{
+	pw_crypt_t new_crypt;
+	char settings[SETTINGS_LEN];
+	char *crypt_string;
+	int hash_len, ret;
+	uint64_t start;
+
+	if (get_pw_crypt_settings (pw_crypt, settings) < 0)
+		return -1;
+
+	hash_len = get_pw_hash_size (pw_crypt->method);
+	if (hash_len < 0)
+		return -1;
+
+	start = perf_start ();
+	crypt_string = crypt (password, settings);
+	perf_stop (PERF_CRYPT, start, 0, get_crypt_prefix (pw_crypt->method));
+	if (!crypt_string || crypt_string[0] == '*')
+		return -1;
+
+	memset (&new_crypt, 0, sizeof (new_crypt));
+	if (decode_pass (crypt_string, &new_crypt) < 0 ||
+	    new_crypt.method != pw_crypt->method)
+		return -1;
+
+	ret = CRYPTO_memcmp (new_crypt.hash, pw_crypt->hash, hash_len) == 0;
+	explicit_bzero (&new_crypt, sizeof (new_crypt));
+
+	return ret;
+}
+
+/* Returns 1 if the password is the one in the toggle request, 0 if not */
+static int
+match_toggle_password (const MokToggleVar *tvar, const char *password)
+{
+	efi_char16_t efichar_pass[SB_PASSWORD_MAX+1];
+	size_t pw_len = strlen (password);
+	int ret;
+
+	if (tvar->password_length < SB_PASSWORD_MIN ||
+	    tvar->password_length > SB_PASSWORD_MAX)
+		return -1;
+
+	memset (efichar_pass, 0, sizeof (efichar_pass));
+	efichar_from_char (efichar_pass, password,
+			   SB_PASSWORD_MAX * sizeof(efi_char16_t));
+
+	/* Compare all the characters even if the length differs */
+	ret = CRYPTO_memcmp (efichar_pass, tvar->password,
+			     tvar->password_length * sizeof(efi_char16_t)) == 0;
+	ret &= pw_len == tvar->password_length;
+	explicit_bzero (efichar_pass, sizeof (efichar_pass));
+
+	return ret;
+}
+
+static int
+verify_password (void)
+{
+	const char *auth_vars[] = {
+		"MokAuth", "MokDelAuth", "MokXAuth", "MokXDelAuth", "MokPW",
+	};
+	const char *toggle_vars[] = { "MokSB", "MokDB" };
+	char *password = NULL;
+	size_t n = 0;
+	uint8_t *data;
+	size_t data_size;
+	uint32_t attributes;
+	unsigned int pending = 0, mismatch = 0;
+	int len, match, ret = -1;
+
+	printf ("input password: ");
+	fflush (stdout);
+	len = read_hidden_line (&password, &n);
+	printf ("\n");
+	if (len < PASSWORD_MIN || len > PASSWORD_MAX) {
+		fprintf (stderr, "password should be %d~%d characters\n",
+			 PASSWORD_MIN, PASSWORD_MAX);
+		goto error;
+	}
+
+	for (unsigned int i = 0; i < sizeof (auth_vars) / sizeof (auth_vars[0]); i++) {
+		const pw_crypt_t *pw_crypt;
+		pw_crypt_t empty;
+
+		data = NULL;
+		if (get_efi_variable (efi_guid_shim, auth_vars[i], &data,
+				      &data_size, &attributes) < 0) {
+			if (errno == ENOENT)
+				continue;
+			fprintf (stderr, "Failed to read %s: %m\n", auth_vars[i]);
+			goto error;
+		}
+		pending++;
+
+		if (data_size != PASSWORD_CRYPT_SIZE) {
+			/* The SHA-256 digest of the request and the password */
+			printf ("%s: can't be verified, unsupported format\n",
+				auth_vars[i]);
+			mismatch++;
+			free (data);
+			continue;
+		}
+
+		pw_crypt = (const pw_crypt_t *)data;
+		memset (&empty, 0, sizeof (empty));
+		if (memcmp (pw_crypt, &empty, sizeof (empty)) == 0) {
+			printf ("%s: clears the password\n", auth_vars[i]);
+			free (data);
+			continue;
+		}
+
+		match = match_pw_crypt (pw_crypt, password);
+		if (match < 0)
+			printf ("%s: can't be verified, unsupported hash\n",
+				auth_vars[i]);
+		else
+			printf ("%s: %s\n", auth_vars[i],
+				match ? "password matches" : "password doesn't match");
+		if (match != 1)
+			mismatch++;
+		free (data);
+	}
+
+	for (unsigned int i = 0; i < sizeof (toggle_vars) / sizeof (toggle_vars[0]); i++) {
+		data = NULL;
+		if (get_efi_variable (efi_guid_shim, toggle_vars[i], &data,
+				      &data_size, &attributes) < 0) {
+			if (errno == ENOENT)
+				continue;
+			fprintf (stderr, "Failed to read %s: %m\n", toggle_vars[i]);
+			goto error;
+		}
+		pending++;
+
+		if (data_size != sizeof (MokToggleVar))
+			match = -1;
+		else
+			match = match_toggle_password ((const MokToggleVar *)data,
+						       password);
+		if (match < 0)
+			printf ("%s: can't be verified, unsupported format\n",
+				toggle_vars[i]);
+		else
+			printf ("%s: %s\n", toggle_vars[i],
+				match ? "password matches" : "password doesn't match");
+		if (match != 1)
+			mismatch++;
+		free (data);
+	}
+
+	if (pending == 0)
+		printf ("No pending request\n");
+
+	ret = mismatch ? 1 : 0;
+error:
+	if (password) {
+		explicit_bzero (password, n);
+		free (password);
+	}
+
+	return ret;
+}
+
 static int
 set_toggle (const char * VarName, const uint32_t state)
 {
@@ -1342,7 +2217,7 @@ set_toggle (const char * VarName, const uint32_t state)
 	attributes = EFI_VARIABLE_NON_VOLATILE
 		     | EFI_VARIABLE_BOOTSERVICE_ACCESS
 		     | EFI_VARIABLE_RUNTIME_ACCESS;
-	ret = efi_set_variable (efi_guid_shim, VarName, (uint8_t *)&tvar,
+	ret = set_efi_variable (efi_guid_shim, VarName, (uint8_t *)&tvar,
 			  sizeof(tvar), attributes, S_IRUSR | S_IWUSR);
 	if (ret < 0) {
 		fprintf (stderr, "Failed to request new %s state\n", VarName);
@@ -1378,10 +2253,13 @@ sb_state ()
 	int32_t setupmode = -1;
 	int32_t moksbstate = -1;
 
-	if (efi_get_variable (efi_guid_global, "SecureBoot", &data, &data_size,
+	if (get_efi_variable (efi_guid_global, "SecureBoot", &data, &data_size,
 			      &attributes) < 0) {
-		fprintf (stderr, "Failed to read \"SecureBoot\" "
-				 "variable: %m\n");
+		if (errno == ENOENT)
+			fprintf (stderr, "This system doesn't support Secure Boot\n");
+		else
+			fprintf (stderr, "Failed to read \"SecureBoot\" "
+					 "variable: %m\n");
 		return -1;
 	}
 
@@ -1396,7 +2274,7 @@ sb_state ()
 	free (data);
 
 	data = NULL;
-	if (efi_get_variable (efi_guid_global, "SetupMode", &data, &data_size,
+	if (get_efi_variable (efi_guid_global, "SetupMode", &data, &data_size,
 			      &attributes) < 0) {
 		fprintf (stderr, "Failed to read \"SetupMode\" "
 				 "variable: %m\n");
@@ -1414,7 +2292,7 @@ sb_state ()
 	free (data);
 
 	data = NULL;
-	if (efi_get_variable (efi_guid_shim, "MokSBStateRT", &data, &data_size,
+	if (get_efi_variable (efi_guid_shim, "MokSBStateRT", &data, &data_size,
 			      &attributes) >= 0) {
 		moksbstate = 1;
 		free (data);
@@ -1493,7 +2371,36 @@ read_file(const int fd, void **bufp, size_t *lenptr)
 }
 
 static int
-test_key (const MokRequest req, const char *key_file)
+match_file_node (const MokListNode *node, void *data)
+{
+	const MokListNode *key = data;
+	efi_guid_t sigtype = node->header->SignatureType;
+
+	if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0)
+		return 0;
+
+	return node->mok_size == key->mok_size &&
+	       memcmp (node->mok, key->mok, key->mok_size) == 0;
+}
+
+static int
+is_key_in_file (const void *key, const uint32_t key_size, const char *file)
+{
+	MokListNode node = { .mok = (void *)key, .mok_size = key_size };
+	EslFile esl;
+	int ret;
+
+	if (esl_file_open (file, &esl) < 0)
+		return -1;
+
+	ret = walk_file_lists (&esl, match_file_node, &node);
+	esl_file_close (&esl);
+
+	return ret;
+}
+
+static int
+test_key (const MokRequest req, const char *key_file, const char *file)
 {
 	void *key = NULL;
 	size_t read_size;
@@ -1516,32 +2423,53 @@ test_key (const MokRequest req, const char *key_file)
 		goto error;
 	}
 
-	if (check_keyring && is_in_trusted_keyring (key, read_size)) {
-		fprintf (stderr, "%s is already in the built-in trusted keyring\n",
-			 key_file);
+	if (file) {
+		ret = is_key_in_file (key, read_size, file);
+		if (ret == 0)
+			printf ("%s is not in %s\n", key_file, file);
+		else if (ret > 0)
+			printf ("%s is already in %s\n", key_file, file);
 		goto error;
 	}
 
-	if (force_ca_check && is_ca_enrolled (key, read_size, req)) {
-		fprintf (stderr, "CA of %s is already enrolled\n",
+	if (check_keyring && is_in_trusted_keyring (key, read_size)) {
+		fprintf (stderr, "%s is already in the built-in trusted keyring\n",
 			 key_file);
 		goto error;
 	}
 
-	if (force_ca_check && is_ca_blocked (key, read_size, req)) {
-		fprintf (stderr, "CA of %s is blocked\n",
-			 key_file);
-		goto error;
+	if (force_ca_check) {
+		rc = is_ca_enrolled (key, read_size, req);
+		if (rc > 0) {
+			fprintf (stderr, "CA of %s is already enrolled\n",
+				 key_file);
+			goto error;
+		}
+		if (rc == 0)
+			rc = is_ca_blocked (key, read_size, req);
+		if (rc > 0) {
+			fprintf (stderr, "CA of %s is blocked\n",
+				 key_file);
+			goto error;
+		}
+		if (rc < 0)
+			goto read_error;
 	}
 
-	if (is_valid_request (&efi_guid_x509_cert, key, read_size, req)) {
+	rc = is_valid_request (&efi_guid_x509_cert, key, read_size, req);
+	if (rc < 0) {
+		goto read_error;
+	} else if (rc) {
 		printf ("%s is not enrolled\n", key_file);
 		ret = 0;
 	} else {
 		print_skip_message (key_file, key, read_size, req);
 		ret = 1;
 	}
+	goto error;
 
+read_error:
+	fprintf (stderr, "Failed to read the key databases: %m\n");
 error:
 	if (key)
 		free (key);
@@ -1552,29 +2480,1875 @@ error:
 	return ret;
 }
 
-static int
-reset_moks (const MokRequest req, const char *pw_hash_file, const int root_pw)
+/* Look a certificate up in every database. This may run in any thread. */
+static void
+test_input_cert (const unsigned int index, void *data)
 {
-	if (update_request (NULL, 0, req, pw_hash_file, root_pw)) {
-		fprintf (stderr, "Failed to issue a reset request\n");
-		return -1;
+	CertBatch *batch = data;
+	CertInput *input = &batch->certs[index];
+	const void *mok = input->cert;
+	const uint32_t mok_size = input->cert_size;
+	const efi_guid_t *type = &efi_guid_x509_cert;
+
+	input->state = 0;
+	if (!is_valid_cert (mok, mok_size)) {
+		input->verdict = CERT_INVALID;
+		return;
 	}
+	input->verdict = CERT_VALID_REQUEST;
 
-	return 0;
+	if (batch->file_index) {
+		if (sig_index_find (batch->file_index, type, mok, mok_size) >= 0)
+			input->state |= KEY_IN_FILE;
+		return;
+	}
+
+	if (get_key_state (mok, mok_size, batch->req, check_keyring,
+			   &input->state) < 0) {
+		input->verdict = CERT_READ_ERROR;
+		return;
+	}
+	/* The CA is only looked at with --ca-check, as for a single key */
+	if (!force_ca_check)
+		input->state &= ~(KEY_CA_ENROLLED | KEY_CA_BLOCKED);
+	if (input->state)
+		input->verdict = CERT_INVALID_REQUEST;
 }
 
-static int
-generate_pw_hash (const char *input_pw)
+static const char *
+yes_no (const unsigned int state, const KeyState flag)
 {
-	char settings[SETTINGS_LEN];
-	char *next;
-	char *password = NULL;
-	char *crypt_string;
-	const char *prefix;
-	size_t settings_len = sizeof (settings) - 2;
-	unsigned int pw_len, salt_size;
+	return (state & flag) ? "yes" : "no";
+}
 
-	if (input_pw) {
+static const char *
+ca_state_name (const unsigned int state)
+{
+	if (state & KEY_CA_BLOCKED)
+		return "blocked";
+	if (state & KEY_CA_ENROLLED)
+		return "enrolled";
+	return "-";
+}
+
+static void
+print_test_table (const CertBatch *batch, const char *file)
+{
+	if (file)
+		printf ("%-8s %s\n", "IN FILE", "KEY");
+	else
+		printf ("%-8s %-8s %-8s %-8s %-8s %s\n", "ENROLLED", "PENDING",
+			"BLOCKED", "KEYRING", "CA", "KEY");
+
+	for (unsigned int i = 0; i < batch->cert_num; i++) {
+		const CertInput *input = &batch->certs[i];
+		const unsigned int state = input->state;
+
+		if (input->verdict == CERT_INVALID)
+			printf ("%-8s %s\n", "invalid", input->name);
+		else if (input->verdict == CERT_READ_ERROR)
+			printf ("%-8s %s\n", "error", input->name);
+		else if (file)
+			printf ("%-8s %s\n", yes_no (state, KEY_IN_FILE),
+				input->name);
+		else
+			printf ("%-8s %-8s %-8s %-8s %-8s %s\n",
+				yes_no (state, KEY_ENROLLED),
+				yes_no (state, KEY_PENDING),
+				yes_no (state, KEY_BLOCKED),
+				yes_no (state, KEY_IN_KEYRING),
+				ca_state_name (state), input->name);
+	}
+}
+
+static void
+print_test_json (const CertBatch *batch, const char *file)
+{
+	printf ("[\n");
+	for (unsigned int i = 0; i < batch->cert_num; i++) {
+		const CertInput *input = &batch->certs[i];
+		const unsigned int state = input->state;
+
+		printf ("  {\"key\": ");
+		json_print_string (stdout, input->name);
+		printf (", \"valid\": %s",
+			input->verdict == CERT_INVALID ? "false" : "true");
+		if (input->verdict == CERT_INVALID) {
+			/* Nothing else to report */
+		} else if (input->verdict == CERT_READ_ERROR) {
+			printf (", \"error\": \"failed to read the databases\"");
+		} else if (file) {
+			printf (", \"in_file\": %s",
+				(state & KEY_IN_FILE) ? "true" : "false");
+		} else {
+			printf (", \"enrolled\": %s, \"pending\": %s, "
+				"\"blocked\": %s, \"in_keyring\": %s, "
+				"\"ca_enrolled\": %s, \"ca_blocked\": %s",
+				(state & KEY_ENROLLED) ? "true" : "false",
+				(state & KEY_PENDING) ? "true" : "false",
+				(state & KEY_BLOCKED) ? "true" : "false",
+				(state & KEY_IN_KEYRING) ? "true" : "false",
+				(state & KEY_CA_ENROLLED) ? "true" : "false",
+				(state & KEY_CA_BLOCKED) ? "true" : "false");
+		}
+		printf ("}%s\n", i + 1 < batch->cert_num ? "," : "");
+	}
+	printf ("]\n");
+}
+
+/*
+ * Test many certificates against one snapshot of the databases. The lookups
+ * run in parallel and the results are printed in the order of the arguments.
+ *
+ * Return 0 if none of the keys is enrolled, pending, blocked or found in the
+ * file, 1 if any is, and -1 on errors or invalid certificates.
+ */
+static int
+test_key_batch (const MokRequest req, char **key_files, const uint32_t total,
+		const char *file, const int json)
+{
+	CertBatch batch;
+	SigIndex file_index;
+	EslFile esl;
+	int esl_opened = 0;
+	int ret = -1;
+
+	sig_index_init (&file_index);
+
+	if (load_cert_batch (&batch, key_files, total) < 0)
+		goto error;
+
+	if (file) {
+		if (esl_file_open (file, &esl) < 0)
+			goto error;
+		esl_opened = 1;
+
+		if (sig_index_add_esl (&file_index, esl.data, esl.data_size) < 0) {
+			fprintf (stderr, "Failed to index %s\n", file);
+			goto error;
+		}
+		batch.file_index = &file_index;
+	}
+
+	batch.req = req;
+	run_parallel (batch.cert_num, test_input_cert, &batch);
+
+	if (json)
+		print_test_json (&batch, file);
+	else
+		print_test_table (&batch, file);
+
+	ret = 0;
+	for (unsigned int i = 0; i < batch.cert_num; i++) {
+		if (batch.certs[i].verdict == CERT_INVALID ||
+		    batch.certs[i].verdict == CERT_READ_ERROR) {
+			ret = -1;
+			break;
+		}
+		if (batch.certs[i].state)
+			ret = 1;
+	}
+
+error:
+	free_cert_batch (&batch);
+	sig_index_free (&file_index);
+	if (esl_opened)
+		esl_file_close (&esl);
+
+	return ret;
+}
+
+static int
+run_test_key (const MokRequest req, char **key_files, const uint32_t total,
+	      const char *file, const int json)
+{
+	struct stat buf;
+
+	/* Keep the plain messages for a single key file */
+	if (total == 1 && !json && strcmp (key_files[0], "-") != 0 &&
+	    (stat (key_files[0], &buf) != 0 || !S_ISDIR (buf.st_mode)))
+		return test_key (req, key_files[0], file);
+
+	return test_key_batch (req, key_files, total, file, json);
+}
+
+static const CachedVar *
+get_daemon_var (const DaemonRequest *req, const char **errorp)
+{
+	const char *name = daemon_param (req, "db");
+	const efi_guid_t *guid;
+	const CachedVar *var;
+
+	*errorp = NULL;
+	if (!name) {
+		*errorp = "missing \"db\"";
+		return NULL;
+	}
+
+	guid = find_sig_db_var (name);
+	if (!guid) {
+		*errorp = "unknown database";
+		return NULL;
+	}
+
+	var = var_cache_get (name, *guid);
+	if (!var)
+		*errorp = "failed to read the variable";
+	return var;
+}
+
+static void
+print_hex (FILE *out, const uint8_t *data, const size_t data_size)
+{
+	for (size_t i = 0; i < data_size; i++)
+		fprintf (out, "%02x", data[i]);
+}
+
+static int
+get_var_flag (const char *name, const efi_guid_t guid)
+{
+	const CachedVar *var = var_cache_get (name, guid);
+
+	if (!var || !var->data || var->data_size != 1)
+		return -1;
+
+	return var->data[0];
+}
+
+static const char *
+json_bool (const int value)
+{
+	if (value < 0)
+		return "null";
+	return value ? "true" : "false";
+}
+
+static const char *
+daemon_status (FILE *out)
+{
+	const CachedVar *var;
+	const efi_guid_t *guid;
+	const char *name;
+
+	fprintf (out, "{\"secure_boot\": %s, \"setup_mode\": %s, \"databases\": {",
+		 json_bool (get_var_flag ("SecureBoot", efi_guid_global)),
+		 json_bool (get_var_flag ("SetupMode", efi_guid_global)));
+
+	for (unsigned int i = 0; (name = get_sig_db_var (i, &guid)); i++) {
+		var = var_cache_get (name, *guid);
+		fprintf (out, "%s\"%s\": ", i ? ", " : "", name);
+		if (var && var->data)
+			fprintf (out, "{\"entries\": %u, \"size\": %zu}",
+				 var->index.entry_num, var->data_size);
+		else
+			fprintf (out, "null");
+	}
+	fprintf (out, "}}");
+
+	return NULL;
+}
+
+static int
+print_sig_entries_json (FILE *out, const CachedVar *var)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	int is_x509, ret = 0;
+
+	fprintf (out, "[");
+	for (uint32_t i = 0; i < var->index.entry_num; i++) {
+		const SigEntry *entry = &var->index.entries[i];
+		char *subject = NULL;
+		int64_t not_after;
+
+		/* Stop before the entry to keep the array well-formed */
+		is_x509 = efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0;
+		if (is_x509 && !SHA256 (entry->data, entry->data_size, digest)) {
+			ret = -1;
+			break;
+		}
+
+		fprintf (out, "%s{\"type\": \"%s\", ", i ? ", " : "",
+			 sig_type_name (&entry->type));
+
+		if (!is_x509) {
+			fprintf (out, "\"hash\": \"");
+			print_hex (out, entry->data, entry->data_size);
+			fprintf (out, "\"}");
+			continue;
+		}
+
+		fprintf (out, "\"sha256\": \"");
+		print_hex (out, digest, sizeof(digest));
+		fprintf (out, "\"");
+		if (get_cert_validity (entry->data, entry->data_size,
+				       &not_after, &subject) == 0) {
+			fprintf (out, ", \"subject\": ");
+			json_print_string (out, subject);
+			fprintf (out, ", \"expires_in\": %"PRId64, not_after);
+			free (subject);
+		}
+		fprintf (out, "}");
+	}
+	fprintf (out, "]");
+
+	return ret;
+}
+
+static const char *
+daemon_list (const DaemonRequest *req, FILE *out)
+{
+	const CachedVar *var;
+	const char *error;
+
+	var = get_daemon_var (req, &error);
+	if (!var)
+		return error;
+
+	if (print_sig_entries_json (out, var) < 0)
+		return "failed to hash the certificates";
+
+	return NULL;
+}
+
+static const char *
+daemon_digest (const DaemonRequest *req, FILE *out)
+{
+	const CachedVar *var;
+	const char *error;
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+
+	var = get_daemon_var (req, &error);
+	if (!var)
+		return error;
+
+	if (!var->data) {
+		fprintf (out, "{\"exists\": false}");
+		return NULL;
+	}
+
+	if (!SHA256 (var->data, var->data_size, digest))
+		return "failed to hash the variable";
+	fprintf (out, "{\"exists\": true, \"size\": %zu, \"sha256\": \"",
+		 var->data_size);
+	print_hex (out, digest, sizeof(digest));
+	fprintf (out, "\"}");
+
+	return NULL;
+}
+
+static const char *
+daemon_test_key (const DaemonRequest *req, FILE *out)
+{
+	const char *cert_b64 = daemon_param (req, "cert");
+	const char *mokx = daemon_param (req, "mokx");
+	MokRequest mok_req;
+	unsigned int state;
+	uint8_t *cert;
+	size_t b64_len;
+	int cert_size, rc;
+
+	if (!cert_b64)
+		return "missing \"cert\"";
+
+	b64_len = strlen (cert_b64);
+	if (b64_len == 0 || b64_len % 4 != 0 || b64_len > INT32_MAX)
+		return "invalid base64";
+
+	cert = malloc (b64_len / 4 * 3);
+	if (!cert)
+		return "out of memory";
+
+	cert_size = EVP_DecodeBlock (cert, (const uint8_t *)cert_b64, b64_len);
+	if (cert_size < 0) {
+		free (cert);
+		return "invalid base64";
+	}
+	/* EVP_DecodeBlock counts the padding as data */
+	for (size_t i = b64_len; i > 0 && cert_b64[i - 1] == '='; i--)
+		cert_size--;
+
+	mok_req = (mokx && strcmp (mokx, "true") == 0) ?
+		  MOK_REQ_ENROLL_BLACKLIST : MOK_REQ_ENROLL_MOK;
+
+	if (!is_valid_cert (cert, cert_size)) {
+		free (cert);
+		return "not a valid x509 certificate";
+	}
+	rc = get_key_state (cert, cert_size, mok_req, check_keyring, &state);
+	free (cert);
+	if (rc < 0)
+		return "failed to read the databases";
+
+	fprintf (out, "{\"enrolled\": %s, \"pending\": %s, \"blocked\": %s, "
+		 "\"in_keyring\": %s, \"ca_enrolled\": %s, \"ca_blocked\": %s}",
+		 json_bool (state & KEY_ENROLLED),
+		 json_bool (state & KEY_PENDING),
+		 json_bool (state & KEY_BLOCKED),
+		 json_bool (state & KEY_IN_KEYRING),
+		 json_bool (state & KEY_CA_ENROLLED),
+		 json_bool (state & KEY_CA_BLOCKED));
+
+	return NULL;
+}
+
+/*
+ * Serve the read-only queries from the cached databases. The requests to
+ * change the variables still go through the command line, and the cache
+ * drops the variables changed since the last query.
+ */
+static const char *
+handle_daemon_request (const DaemonRequest *req, FILE *out, void *data)
+{
+	const char *method = daemon_param (req, "method");
+
+	(void)data;
+
+	if (!method)
+		return "missing \"method\"";
+
+	var_cache_refresh ();
+
+	if (strcmp (method, "status") == 0)
+		return daemon_status (out);
+	if (strcmp (method, "list") == 0)
+		return daemon_list (req, out);
+	if (strcmp (method, "digest") == 0)
+		return daemon_digest (req, out);
+	if (strcmp (method, "test-key") == 0)
+		return daemon_test_key (req, out);
+
+	return "unknown method";
+}
+
+static int
+write_data_to_file (const char *file, const void *data, const size_t data_size)
+{
+	size_t offset = 0;
+	ssize_t write_size;
+	mode_t mode;
+	int fd;
+
+	/* mode 644 */
+	mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+	fd = open (file, O_CREAT | O_WRONLY | O_TRUNC, mode);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to open %s: %m\n", file);
+		return -1;
+	}
+
+	while (offset < data_size) {
+		write_size = write (fd, data + offset, data_size - offset);
+		if (write_size < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf (stderr, "Failed to write %s: %m\n", file);
+			close (fd);
+			return -1;
+		}
+		offset += write_size;
+	}
+
+	if (close (fd) < 0) {
+		fprintf (stderr, "Failed to write %s: %m\n", file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Compare a dbx update against the current dbx and report how many entries
+ * are new and how much NVRAM the update needs. The current dbx is read from
+ * the firmware unless a snapshot file is given.
+ */
+static int
+check_dbx_update (const char *update_file, const char *dbx_file,
+		  const char *delta_file)
+{
+	EslFile update, snapshot;
+	uint8_t *dbx_data = NULL;
+	size_t dbx_size = 0;
+	uint8_t *delta = NULL;
+	size_t delta_size = 0;
+	SigIndex update_index, dbx_index, delta_index;
+	uint32_t present = 0;
+	int ret = -1;
+
+	memset (&snapshot, 0, sizeof(snapshot));
+	sig_index_init (&update_index);
+	sig_index_init (&dbx_index);
+	sig_index_init (&delta_index);
+
+	if (esl_file_open (update_file, &update) < 0)
+		return -1;
+
+	if (dbx_file) {
+		if (esl_file_open_var (dbx_file, "dbx", &snapshot) < 0)
+			goto error;
+		dbx_size = snapshot.data_size;
+		if (sig_index_add_esl (&dbx_index, snapshot.data,
+				       snapshot.data_size) < 0) {
+			fprintf (stderr, "Failed to parse %s\n", dbx_file);
+			goto error;
+		}
+	} else {
+		if (get_db_variable ("dbx", efi_guid_security, &dbx_data,
+				     &dbx_size) < 0) {
+			if (errno != ENOENT) {
+				fprintf (stderr, "Failed to read dbx: %m\n");
+				goto error;
+			}
+			dbx_size = 0;
+		}
+		if (sig_index_add_esl (&dbx_index, dbx_data, dbx_size) < 0) {
+			fprintf (stderr, "Corrupted variable \"dbx\"\n");
+			goto error;
+		}
+	}
+
+	if (sig_index_add_esl (&update_index, update.data,
+			       update.data_size) < 0) {
+		fprintf (stderr, "Failed to parse %s\n", update_file);
+		goto error;
+	}
+
+	for (uint32_t i = 0; i < update_index.entry_num; i++) {
+		const SigEntry *entry = &update_index.entries[i];
+
+		if (sig_index_find (&dbx_index, &entry->type, entry->data,
+				    entry->data_size) >= 0) {
+			present++;
+			continue;
+		}
+
+		if (sig_index_add (&delta_index, &entry->type, &entry->owner,
+				   entry->data, entry->data_size) < 0)
+			goto error;
+	}
+
+	if (sig_index_to_esl (&delta_index, &delta, &delta_size) < 0) {
+		fprintf (stderr, "Failed to build the delta signature lists\n");
+		goto error;
+	}
+
+	printf ("Update file:       %s (%s)\n", update_file,
+		esl_format_name (update.format));
+	printf ("Update entries:    %u (%zu bytes)\n", update_index.entry_num,
+		update.data_size);
+	printf ("Already present:   %u\n", present);
+	printf ("New entries:       %u\n", delta_index.entry_num);
+	printf ("Current dbx:       %u entries (%zu bytes)\n",
+		dbx_index.entry_num, dbx_size);
+	printf ("NVRAM needed:      %zu bytes\n", delta_size);
+	printf ("dbx after update:  %u entries (%zu bytes)\n",
+		dbx_index.entry_num + delta_index.entry_num,
+		dbx_size + delta_size);
+
+	if (delta_file) {
+		if (write_data_to_file (delta_file, delta, delta_size) < 0)
+			goto error;
+		printf ("Wrote the delta signature lists to %s\n", delta_file);
+	}
+
+	ret = 0;
+error:
+	free (delta);
+	free (dbx_data);
+	sig_index_free (&delta_index);
+	sig_index_free (&dbx_index);
+	sig_index_free (&update_index);
+	esl_file_close (&snapshot);
+	esl_file_close (&update);
+
+	return ret;
+}
+
+typedef struct {
+	unsigned int checked;
+	unsigned int differ;
+} EventLogCheck;
+
+/* The variables shim measures and the runtime copies it leaves behind */
+static const struct {
+	const char *measured;
+	const char *runtime;
+} shim_measured_vars[] = {
+	{ "MokList",        "MokListRT" },
+	{ "MokListX",       "MokListXRT" },
+	{ "MokListTrusted", "MokListTrustedRT" },
+	{ "SbatLevel",      "SbatLevelRT" },
+};
+
+static const char *
+get_shim_runtime_var (const char *measured)
+{
+	for (unsigned int i = 0; i < sizeof(shim_measured_vars) / sizeof(shim_measured_vars[0]); i++) {
+		if (strcmp (shim_measured_vars[i].measured, measured) == 0)
+			return shim_measured_vars[i].runtime;
+	}
+
+	return NULL;
+}
+
+static int
+read_runtime_var (const char *name, const efi_guid_t guid, uint8_t **datap,
+		  size_t *data_sizep)
+{
+	*datap = NULL;
+	*data_sizep = 0;
+
+	if (get_db_variable (name, guid, datap, data_sizep) < 0) {
+		if (errno != ENOENT) {
+			fprintf (stderr, "Failed to read %s: %m\n", name);
+			return -1;
+		}
+		*datap = NULL;
+		*data_sizep = 0;
+	}
+
+	return 0;
+}
+
+static int
+print_sig_entry (const char *prefix, const SigEntry *entry)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+
+	if (efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0) {
+		if (!SHA256 (entry->data, entry->data_size, digest)) {
+			fprintf (stderr, "Failed to hash the certificate\n");
+			return -1;
+		}
+		printf ("  %s x509 sha256 ", prefix);
+		print_hex (stdout, digest, sizeof(digest));
+	} else {
+		printf ("  %s %s ", prefix, sig_type_name (&entry->type));
+		print_hex (stdout, entry->data, entry->data_size);
+	}
+	printf ("\n");
+
+	return 0;
+}
+
+/* Compare the signature lists measured at boot with the runtime variable */
+static int
+check_measured_esl (const TcgEvent *event, const char *name,
+		    const efi_guid_t guid, const uint8_t *data,
+		    const size_t data_size, EventLogCheck *check)
+{
+	SigIndex measured, runtime;
+	uint8_t *var_data;
+	size_t var_size;
+	unsigned int added = 0, removed = 0;
+	int ret = -1;
+
+	sig_index_init (&measured);
+	sig_index_init (&runtime);
+
+	if (read_runtime_var (name, guid, &var_data, &var_size) < 0)
+		return -1;
+
+	if (sig_index_add_esl (&measured, data, data_size) < 0) {
+		fprintf (stderr, "Corrupted %s in the event log\n", name);
+		goto error;
+	}
+	if (sig_index_add_esl (&runtime, var_data, var_size) < 0) {
+		fprintf (stderr, "Corrupted variable \"%s\"\n", name);
+		goto error;
+	}
+
+	for (uint32_t i = 0; i < measured.entry_num; i++) {
+		const SigEntry *entry = &measured.entries[i];
+
+		if (sig_index_find (&runtime, &entry->type, entry->data,
+				    entry->data_size) < 0)
+			removed++;
+	}
+	for (uint32_t i = 0; i < runtime.entry_num; i++) {
+		const SigEntry *entry = &runtime.entries[i];
+
+		if (sig_index_find (&measured, &entry->type, entry->data,
+				    entry->data_size) < 0)
+			added++;
+	}
+
+	check->checked++;
+	if (added == 0 && removed == 0) {
+		printf ("PCR%u %s: matches the runtime variable (%u entries)\n",
+			event->pcr, name, measured.entry_num);
+		ret = 0;
+		goto error;
+	}
+
+	check->differ++;
+	printf ("PCR%u %s: %u added and %u removed since boot\n", event->pcr,
+		name, added, removed);
+	for (uint32_t i = 0; i < measured.entry_num; i++) {
+		const SigEntry *entry = &measured.entries[i];
+
+		if (sig_index_find (&runtime, &entry->type, entry->data,
+				    entry->data_size) < 0 &&
+		    print_sig_entry ("-", entry) < 0)
+			goto error;
+	}
+	for (uint32_t i = 0; i < runtime.entry_num; i++) {
+		const SigEntry *entry = &runtime.entries[i];
+
+		if (sig_index_find (&measured, &entry->type, entry->data,
+				    entry->data_size) < 0 &&
+		    print_sig_entry ("+", entry) < 0)
+			goto error;
+	}
+
+	ret = 0;
+error:
+	sig_index_free (&runtime);
+	sig_index_free (&measured);
+	free (var_data);
+
+	return ret;
+}
+
+static int
+check_measured_data (const TcgEvent *event, const char *name,
+		     const char *runtime_name, const efi_guid_t guid,
+		     const uint8_t *data, const size_t data_size,
+		     EventLogCheck *check)
+{
+	uint8_t *var_data;
+	size_t var_size;
+	int same;
+
+	if (read_runtime_var (runtime_name, guid, &var_data, &var_size) < 0)
+		return -1;
+
+	same = var_size == data_size && memcmp (var_data, data, data_size) == 0;
+	check->checked++;
+	if (same) {
+		printf ("PCR%u %s: matches %s\n", event->pcr, name, runtime_name);
+	} else {
+		check->differ++;
+		printf ("PCR%u %s: differs from %s\n", event->pcr, name,
+			runtime_name);
+	}
+	free (var_data);
+
+	return 0;
+}
+
+/* The key which verified an image at boot should still be enrolled */
+static int
+check_measured_authority (const TcgEvent *event, const char *name,
+			  const efi_guid_t guid, const uint8_t *data,
+			  const size_t data_size, EventLogCheck *check)
+{
+	SigIndex runtime;
+	const char *runtime_name = get_shim_runtime_var (name);
+	const SigType *info;
+	const uint8_t *entry;
+	uint8_t *var_data;
+	size_t var_size, entry_size;
+	int found;
+
+	/* EFI_SIGNATURE_DATA: the owner and the certificate or the hash */
+	if (data_size <= sizeof(efi_guid_t))
+		return 0;
+	entry = data + sizeof(efi_guid_t);
+	entry_size = data_size - sizeof(efi_guid_t);
+
+	if (!runtime_name)
+		runtime_name = name;
+	if (read_runtime_var (runtime_name, guid, &var_data, &var_size) < 0)
+		return -1;
+
+	sig_index_init (&runtime);
+	if (sig_index_add_esl (&runtime, var_data, var_size) < 0) {
+		fprintf (stderr, "Corrupted variable \"%s\"\n", runtime_name);
+		free (var_data);
+		return -1;
+	}
+	found = sig_index_find (&runtime, &efi_guid_x509_cert, entry,
+				entry_size) >= 0;
+	/* The authority may be a hash entry when the image was in db by hash */
+	for (unsigned int i = 0; !found && (info = get_sig_type (i)); i++) {
+		if (info->data_size == entry_size)
+			found = sig_index_find (&runtime, info->guid, entry,
+						entry_size) >= 0;
+	}
+	sig_index_free (&runtime);
+	free (var_data);
+
+	check->checked++;
+	if (found) {
+		printf ("PCR%u %s authority: still in %s\n", event->pcr, name,
+			runtime_name);
+	} else {
+		check->differ++;
+		printf ("PCR%u %s authority: no longer in %s\n", event->pcr,
+			name, runtime_name);
+	}
+
+	return 0;
+}
+
+/* shim logs MokList and friends with only their name as the event data */
+static int
+check_measured_digest (const TcgEvent *event, EventLogCheck *check)
+{
+	char name[32];
+	const char *runtime_name;
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	uint8_t *var_data, *hashed;
+	size_t var_size;
+	int same;
+
+	if (event->data_size == 0 || event->data_size >= sizeof(name))
+		return 0;
+	memcpy (name, event->data, event->data_size);
+	name[event->data_size] = '\0';
+
+	runtime_name = get_shim_runtime_var (name);
+	if (!runtime_name || !event->digest)
+		return 0;
+
+	/* The spec ID event of the log declares the digest sizes */
+	if (event->digest_size != (event->digest_alg == TPM_ALG_SHA256 ?
+				   SHA256_DIGEST_LENGTH : SHA_DIGEST_LENGTH)) {
+		fprintf (stderr, "Invalid %s digest size %u for %s\n",
+			 eventlog_alg_name (event->digest_alg),
+			 event->digest_size, name);
+		return -1;
+	}
+
+	if (read_runtime_var (runtime_name, efi_guid_shim, &var_data,
+			      &var_size) < 0)
+		return -1;
+
+	if (event->digest_alg == TPM_ALG_SHA256)
+		hashed = SHA256 (var_data, var_size, digest);
+	else
+		hashed = SHA1 (var_data, var_size, digest);
+	free (var_data);
+	if (!hashed) {
+		fprintf (stderr, "Failed to hash %s\n", runtime_name);
+		return -1;
+	}
+	same = memcmp (digest, event->digest, event->digest_size) == 0;
+
+	check->checked++;
+	if (same) {
+		printf ("PCR%u %s: matches %s\n", event->pcr, name, runtime_name);
+	} else {
+		check->differ++;
+		printf ("PCR%u %s: differs from %s\n", event->pcr, name,
+			runtime_name);
+	}
+
+	return 0;
+}
+
+static int
+check_event (const TcgEvent *event, void *data)
+{
+	EventLogCheck *check = data;
+	const efi_guid_t *db_guid;
+	const uint8_t *var_data;
+	size_t var_size;
+	efi_guid_t guid;
+	char name[64];
+
+	if (event->type == EV_IPL)
+		return check_measured_digest (event, check);
+
+	if (event->type != EV_EFI_VARIABLE_DRIVER_CONFIG &&
+	    event->type != EV_EFI_VARIABLE_AUTHORITY)
+		return 0;
+
+	if (eventlog_variable (event, &guid, name, sizeof(name), &var_data,
+			       &var_size) < 0)
+		return 0;
+
+	if (event->type == EV_EFI_VARIABLE_AUTHORITY) {
+		if (strcmp (name, "SbatLevel") == 0)
+			return check_measured_data (event, name, "SbatLevelRT",
+						    guid, var_data, var_size,
+						    check);
+		if (strcmp (name, "db") == 0 || strcmp (name, "MokList") == 0)
+			return check_measured_authority (event, name, guid,
+							 var_data, var_size,
+							 check);
+		return 0;
+	}
+
+	if (strcmp (name, "SecureBoot") == 0)
+		return check_measured_data (event, name, name, guid, var_data,
+					    var_size, check);
+
+	db_guid = find_sig_db_var (name);
+	if (db_guid && efi_guid_cmp (db_guid, &guid) == 0)
+		return check_measured_esl (event, name, guid, var_data,
+					   var_size, check);
+
+	return 0;
+}
+
+/*
+ * Compare the Secure Boot and MOK state measured into the TPM event log
+ * with the runtime variables, which may have changed since boot.
+ */
+static int
+check_eventlog (const char *file)
+{
+	EventLogCheck check = { 0, 0 };
+	FILE *fp;
+	int ret;
+
+	if (!file)
+		file = EVENTLOG_DEFAULT_PATH;
+
+	fp = fopen (file, "r");
+	if (!fp) {
+		fprintf (stderr, "Failed to open %s: %m\n", file);
+		return -1;
+	}
+
+	ret = eventlog_parse (fp, check_event, &check);
+	fclose (fp);
+	if (ret < 0)
+		return -1;
+
+	if (check.checked == 0) {
+		printf ("No measured Secure Boot or MOK variable in %s\n", file);
+		return 0;
+	}
+
+	printf ("%u measurements checked, %u differ\n", check.checked,
+		check.differ);
+
+	return check.differ ? 1 : 0;
+}
+
+typedef enum {
+	EXPORT_DER = 0,
+	EXPORT_ESL,
+	EXPORT_PEM,
+	EXPORT_TAR,
+	EXPORT_HASHLIST,
+} ExportFormat;
+
+typedef struct {
+	FILE         *out;
+	ExportFormat  format;
+	const char   *prefix;
+	unsigned int  index;
+	unsigned int  skipped;
+	time_t        mtime;
+} DbExport;
+
+#define TAR_BLOCK_SIZE 512
+#define EXPORT_BUF_SIZE (1024 * 1024)
+
+static const char *
+get_export_ext (const efi_guid_t *type)
+{
+	const char *name = sig_type_name (type);
+
+	if (strcmp (name, "x509") == 0)
+		return "der";
+	if (strcmp (name, "unknown") == 0)
+		return "bin";
+	return name;
+}
+
+static int
+write_tar_header (FILE *out, const char *name, const size_t size,
+		  const time_t mtime)
+{
+	uint8_t header[TAR_BLOCK_SIZE];
+	unsigned int checksum = 0;
+
+	memset (header, 0, sizeof(header));
+	memcpy (header, name, strnlen (name, 100));
+	snprintf ((char *)header + 100, 8, "%07o", 0644);
+	snprintf ((char *)header + 108, 8, "%07o", 0);
+	snprintf ((char *)header + 116, 8, "%07o", 0);
+	snprintf ((char *)header + 124, 12, "%011zo", size);
+	snprintf ((char *)header + 136, 12, "%011llo", (unsigned long long)mtime);
+	header[156] = '0';
+	memcpy (header + 257, "ustar", 6);
+	memcpy (header + 263, "00", 2);
+
+	/* The checksum is counted with its own field as spaces */
+	memset (header + 148, ' ', 8);
+	for (unsigned int i = 0; i < sizeof(header); i++)
+		checksum += header[i];
+	snprintf ((char *)header + 148, 8, "%06o", checksum);
+
+	return fwrite (header, 1, sizeof(header), out) == sizeof(header) ? 0 : -1;
+}
+
+static int
+write_tar_file (FILE *out, const char *name, const void *data,
+		const size_t size, const time_t mtime)
+{
+	static const uint8_t padding[TAR_BLOCK_SIZE];
+	size_t pad = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+	if (write_tar_header (out, name, size, mtime) < 0 ||
+	    fwrite (data, 1, size, out) != size ||
+	    fwrite (padding, 1, pad, out) != pad)
+		return -1;
+
+	return 0;
+}
+
+static int
+write_pem_cert (FILE *out, const uint8_t *cert, const uint32_t cert_size)
+{
+	char *b64;
+	int b64_len;
+
+	b64 = malloc ((cert_size + 2) / 3 * 4 + 1);
+	if (!b64) {
+		fprintf (stderr, "Failed to allocate space: %m\n");
+		return -1;
+	}
+	b64_len = EVP_EncodeBlock ((unsigned char *)b64, cert, cert_size);
+	if (b64_len < 0) {
+		fprintf (stderr, "Failed to encode the certificate\n");
+		free (b64);
+		return -1;
+	}
+
+	fprintf (out, "-----BEGIN CERTIFICATE-----\n");
+	for (int i = 0; i < b64_len; i += 64)
+		fprintf (out, "%.*s\n", b64_len - i < 64 ? b64_len - i : 64,
+			 b64 + i);
+	fprintf (out, "-----END CERTIFICATE-----\n");
+	free (b64);
+
+	return 0;
+}
+
+static int
+print_sig_line (FILE *out, const efi_guid_t *type, const efi_guid_t *owner,
+		const uint8_t *data, const uint32_t data_size)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	char *type_str = NULL, *owner_str = NULL;
+	const char *name = sig_type_name (type);
+	int ret = -1;
+
+	if (strcmp (name, "unknown") == 0 && efi_guid_to_str (type, &type_str) >= 0)
+		name = type_str;
+	if (efi_guid_to_str (owner, &owner_str) < 0)
+		owner_str = NULL;
+
+	fprintf (out, "%s ", name);
+	if (efi_guid_cmp (type, &efi_guid_x509_cert) == 0) {
+		/* The fingerprint of the certificate */
+		if (!SHA256 (data, data_size, digest)) {
+			fprintf (stderr, "Failed to hash the certificate\n");
+			goto error;
+		}
+		print_hex (out, digest, sizeof(digest));
+	} else {
+		print_hex (out, data, data_size);
+	}
+	fprintf (out, " %s\n", owner_str ? owner_str : "-");
+	ret = 0;
+error:
+	free (type_str);
+	free (owner_str);
+
+	return ret;
+}
+
+static int
+export_signature (const efi_guid_t *type, const efi_guid_t *owner,
+		  const uint8_t *data, const uint32_t data_size, void *user_data)
+{
+	DbExport *export = user_data;
+	int is_x509 = efi_guid_cmp (type, &efi_guid_x509_cert) == 0;
+	char filename[PATH_MAX];
+
+	export->index++;
+
+	switch (export->format) {
+	case EXPORT_PEM:
+		fprintf (export->out, "# %s-%04u ", export->prefix,
+			 export->index);
+		if (print_sig_line (export->out, type, owner, data,
+				    data_size) < 0)
+			return -1;
+		if (is_x509)
+			return write_pem_cert (export->out, data, data_size);
+		return 0;
+	case EXPORT_TAR:
+		snprintf (filename, sizeof(filename), "%s-%04u.%s",
+			  export->prefix, export->index, get_export_ext (type));
+		return write_tar_file (export->out, filename, data, data_size,
+				       export->mtime);
+	case EXPORT_HASHLIST:
+		return print_sig_line (export->out, type, owner, data,
+				       data_size);
+	case EXPORT_DER:
+	case EXPORT_ESL:
+		break;
+	}
+
+	return 0;
+}
+
+/* Number the files by the place of the certificate in the database */
+static int
+export_der_certs (const uint8_t *data, const size_t data_size,
+		  DbExport *export)
+{
+	MokListNode *list;
+	uint32_t mok_num, sig_size;
+	char filename[PATH_MAX];
+	int ret = -1;
+
+	list = build_mok_list (data, data_size, &mok_num);
+	if (list == NULL)
+		return -1;
+
+	for (uint32_t i = 0; i < mok_num; i++) {
+		efi_guid_t sigtype = list[i].header->SignatureType;
+
+		if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0) {
+			sig_size = signature_size (&sigtype);
+			export->skipped += sig_size ? list[i].mok_size / sig_size : 1;
+			continue;
+		}
+
+		snprintf (filename, sizeof(filename), "%s-%04u.der",
+			  export->prefix, i + 1);
+		if (write_data_to_file (filename, list[i].mok,
+					list[i].mok_size) < 0)
+			goto error;
+	}
+
+	ret = 0;
+error:
+	free (list);
+
+	return ret;
+}
+
+/*
+ * Export the keys and hashes of the database. The DER format writes one
+ * file per certificate in the current directory; the other formats write
+ * one stream to the output file or stdout.
+ */
+static int
+export_db_keys (const DBName db_name, const ExportFormat format,
+		const char *output)
+{
+	static const uint8_t tar_end[TAR_BLOCK_SIZE * 2];
+	const char *db_var_name;
+	uint8_t *data = NULL;
+	size_t data_size = 0;
+	const efi_guid_t *guid = get_db_info (db_name)->guid;
+	DbExport export;
+	int ret = -1;
+
+	db_var_name = get_db_var_name (db_name);
+
+	if (get_db_variable (db_var_name, *guid, &data, &data_size) < 0) {
+		if (errno != ENOENT) {
+			fprintf (stderr, "Failed to read %s: %m\n", db_var_name);
+			return -1;
+		}
+		if (format == EXPORT_DER) {
+			printf ("%s is empty\n", db_var_name);
+			return 0;
+		}
+		data = NULL;
+		data_size = 0;
+	}
+
+	memset (&export, 0, sizeof(export));
+	export.format = format;
+	export.prefix = get_db_friendly_name (db_name);
+	export.mtime = time (NULL);
+
+	if (format != EXPORT_DER) {
+		if (!output || strcmp (output, "-") == 0) {
+			output = "stdout";
+			export.out = stdout;
+		} else {
+			export.out = fopen (output, "w");
+			if (!export.out) {
+				fprintf (stderr, "Failed to open %s: %m\n", output);
+				goto error;
+			}
+		}
+		setvbuf (export.out, NULL, _IOFBF, EXPORT_BUF_SIZE);
+	}
+
+	if (format == EXPORT_DER) {
+		if (export_der_certs (data, data_size, &export) < 0)
+			goto error;
+	} else if (format == EXPORT_ESL) {
+		if (data_size && fwrite (data, 1, data_size, export.out) != data_size)
+			goto write_error;
+	} else if (walk_signatures (data, data_size, export_signature,
+				    &export) < 0) {
+		/* Other failures than writing are already reported */
+		if (ferror (export.out))
+			goto write_error;
+		goto error;
+	}
+
+	if (format == EXPORT_TAR &&
+	    fwrite (tar_end, 1, sizeof(tar_end), export.out) != sizeof(tar_end))
+		goto write_error;
+
+	if (export.skipped)
+		fprintf (stderr, "Skipped %u hash entries, use --export-format "
+			 "to export them\n", export.skipped);
+
+	if (export.out) {
+		if (fflush (export.out) != 0 || ferror (export.out))
+			goto write_error;
+		if (export.out != stdout && fclose (export.out) != 0) {
+			export.out = NULL;
+			goto write_error;
+		}
+		export.out = NULL;
+	}
+
+	ret = 0;
+	goto error;
+write_error:
+	fprintf (stderr, "Failed to write %s: %m\n", output);
+error:
+	if (export.out && export.out != stdout)
+		fclose (export.out);
+	free (data);
+
+	return ret;
+}
+
+#define SBAT_ORIGINAL "sbat,1,2021030218\n"
+
+typedef struct {
+	uint16_t      alg;
+	uint16_t      size;
+	const EVP_MD *md;		/* NULL if OpenSSL lacks the algorithm */
+	int           predict_ok;	/* 0 once an event can't be predicted */
+	uint8_t       replayed[EVENTLOG_MAX_DIGEST];
+	uint8_t       predicted[EVENTLOG_MAX_DIGEST];
+} PcrBank;
+
+typedef struct {
+	PcrBank      banks[EVENTLOG_MAX_BANKS];
+	uint32_t     bank_num;
+	unsigned int events;
+	unsigned int changed;
+	SigIndex     mok_del;		/* the pending MOK deletions */
+	SigIndex     mokx_new;		/* the pending MOKX enrollments */
+	uint8_t     *mok_del_data;
+	uint8_t     *mokx_new_data;
+	uint8_t     *sbat_level;	/* NULL if it can't be predicted */
+	size_t       sbat_level_size;
+} Pcr7Prediction;
+
+static int
+hash_data (const EVP_MD *md, const void *data1, const size_t size1,
+	   const void *data2, const size_t size2, uint8_t *digest)
+{
+	EVP_MD_CTX *ctx;
+	int ret = -1;
+
+	ctx = EVP_MD_CTX_new ();
+	if (!ctx)
+		return -1;
+
+	if (EVP_DigestInit_ex (ctx, md, NULL) &&
+	    EVP_DigestUpdate (ctx, data1, size1) &&
+	    (size2 == 0 || EVP_DigestUpdate (ctx, data2, size2)) &&
+	    EVP_DigestFinal_ex (ctx, digest, NULL))
+		ret = 0;
+
+	EVP_MD_CTX_free (ctx);
+
+	return ret;
+}
+
+static PcrBank *
+get_pcr_bank (Pcr7Prediction *pred, const TcgDigest *digest)
+{
+	PcrBank *bank;
+	const char *name;
+
+	for (uint32_t i = 0; i < pred->bank_num; i++) {
+		if (pred->banks[i].alg == digest->alg)
+			return &pred->banks[i];
+	}
+
+	if (pred->bank_num == EVENTLOG_MAX_BANKS)
+		return NULL;
+
+	bank = &pred->banks[pred->bank_num++];
+	memset (bank, 0, sizeof(*bank));
+	bank->alg = digest->alg;
+	bank->size = digest->size;
+	name = eventlog_alg_name (digest->alg);
+	if (name)
+		bank->md = EVP_get_digestbyname (name);
+	bank->predict_ok = bank->md != NULL;
+
+	return bank;
+}
+
+static void
+pcr_extend (const PcrBank *bank, uint8_t *pcr, const uint8_t *digest)
+{
+	uint8_t new_pcr[EVP_MAX_MD_SIZE];
+
+	if (!bank->md ||
+	    hash_data (bank->md, pcr, bank->size, digest, bank->size,
+		       new_pcr) < 0)
+		return;
+	memcpy (pcr, new_pcr, bank->size);
+}
+
+/* Build the UEFI_VARIABLE_DATA of the event with the new variable data */
+static uint8_t *
+build_variable_data (const TcgEvent *event, const uint8_t *old_data,
+		     const uint8_t *new_data, const size_t new_size,
+		     size_t *sizep)
+{
+	size_t header_size = old_data - event->data;
+	uint64_t var_size = new_size;
+	uint8_t *data;
+
+	data = malloc (header_size + new_size);
+	if (!data)
+		return NULL;
+
+	memcpy (data, event->data, header_size);
+	memcpy (data + sizeof(efi_guid_t) + sizeof(uint64_t), &var_size,
+		sizeof(var_size));
+	if (new_size)
+		memcpy (data + header_size, new_data, new_size);
+	*sizep = header_size + new_size;
+
+	return data;
+}
+
+/*
+ * The firmware should hash the whole UEFI_VARIABLE_DATA, but some only
+ * hash the variable data. Find out which from the digest in the log.
+ */
+static int
+predict_variable_digest (const PcrBank *bank, const TcgDigest *digest,
+			 const TcgEvent *event, const uint8_t *var_data,
+			 const size_t var_size, const uint8_t *new_event,
+			 const size_t new_event_size, const uint8_t *new_data,
+			 const size_t new_size, uint8_t *predicted)
+{
+	uint8_t check[EVP_MAX_MD_SIZE];
+
+	if (!bank->md)
+		return -1;
+
+	if (hash_data (bank->md, event->data, event->data_size, NULL, 0,
+		       check) == 0 &&
+	    memcmp (check, digest->value, digest->size) == 0)
+		return hash_data (bank->md, new_event, new_event_size, NULL, 0,
+				  predicted);
+
+	if (hash_data (bank->md, var_data, var_size, NULL, 0, check) == 0 &&
+	    memcmp (check, digest->value, digest->size) == 0)
+		return hash_data (bank->md, new_data, new_size, NULL, 0,
+				  predicted);
+
+	return -1;
+}
+
+/* Warn if the key which verified an image at boot is going away */
+static void
+check_pending_authority (const Pcr7Prediction *pred, const char *name,
+			 const uint8_t *data, const size_t data_size)
+{
+	const uint8_t *cert = data + sizeof(efi_guid_t);
+	size_t cert_size = data_size - sizeof(efi_guid_t);
+
+	if (data_size <= sizeof(efi_guid_t))
+		return;
+
+	if (strcmp (name, "MokList") == 0 &&
+	    (sig_index_find (&pred->mok_del, &efi_guid_x509_cert, cert,
+			     cert_size) >= 0 ||
+	     sig_index_find (&pred->mokx_new, &efi_guid_x509_cert, cert,
+			     cert_size) >= 0))
+		fprintf (stderr, "Warning: a pending request removes or blocks "
+			 "the MOK which verified an image at boot\n");
+}
+
+/* Find the variable data the next boot will measure for the event */
+static int
+get_next_boot_data (Pcr7Prediction *pred, const TcgEvent *event,
+		    const char *name, const efi_guid_t guid,
+		    uint8_t **datap, size_t *sizep)
+{
+	const efi_guid_t *db_guid;
+
+	*datap = NULL;
+	*sizep = 0;
+
+	if (event->type == EV_EFI_VARIABLE_AUTHORITY) {
+		if (strcmp (name, "SbatLevel") != 0 || !pred->sbat_level)
+			return 0;
+		*datap = malloc (pred->sbat_level_size);
+		if (!*datap)
+			return -1;
+		memcpy (*datap, pred->sbat_level, pred->sbat_level_size);
+		*sizep = pred->sbat_level_size;
+		return 1;
+	}
+
+	if (event->type != EV_EFI_VARIABLE_DRIVER_CONFIG)
+		return 0;
+
+	db_guid = find_sig_db_var (name);
+	if (strcmp (name, "SecureBoot") != 0 &&
+	    !(db_guid && efi_guid_cmp (db_guid, &guid) == 0))
+		return 0;
+
+	if (read_runtime_var (name, guid, datap, sizep) < 0)
+		return -1;
+
+	return 1;
+}
+
+static int
+predict_event (const TcgEvent *event, void *data)
+{
+	Pcr7Prediction *pred = data;
+	const uint8_t *var_data = NULL;
+	size_t var_size = 0;
+	uint8_t *new_data = NULL, *new_event = NULL;
+	size_t new_size, new_event_size = 0;
+	efi_guid_t guid;
+	char name[64];
+	int substitute = 0, ret = -1;
+
+	if (event->pcr != 7 || event->type == EV_NO_ACTION)
+		return 0;
+	pred->events++;
+
+	if ((event->type == EV_EFI_VARIABLE_DRIVER_CONFIG ||
+	     event->type == EV_EFI_VARIABLE_AUTHORITY) &&
+	    eventlog_variable (event, &guid, name, sizeof(name), &var_data,
+			       &var_size) == 0) {
+		if (event->type == EV_EFI_VARIABLE_AUTHORITY)
+			check_pending_authority (pred, name, var_data,
+						 var_size);
+
+		substitute = get_next_boot_data (pred, event, name, guid,
+						 &new_data, &new_size);
+		if (substitute < 0)
+			return -1;
+		if (substitute &&
+		    new_size == var_size &&
+		    (var_size == 0 || memcmp (new_data, var_data, var_size) == 0))
+			substitute = 0;
+	}
+
+	if (substitute) {
+		new_event = build_variable_data (event, var_data, new_data,
+						 new_size, &new_event_size);
+		if (!new_event) {
+			fprintf (stderr, "Failed to allocate space: %m\n");
+			goto error;
+		}
+		pred->changed++;
+		printf ("%s: changes from %zu to %zu bytes\n", name, var_size,
+			new_size);
+	}
+
+	for (uint32_t i = 0; i < event->digest_num; i++) {
+		const TcgDigest *digest = &event->digests[i];
+		uint8_t predicted[EVENTLOG_MAX_DIGEST];
+		PcrBank *bank;
+
+		bank = get_pcr_bank (pred, digest);
+		if (!bank || bank->size != digest->size) {
+			fprintf (stderr, "Inconsistent digests in the event log\n");
+			goto error;
+		}
+
+		pcr_extend (bank, bank->replayed, digest->value);
+
+		if (!substitute) {
+			pcr_extend (bank, bank->predicted, digest->value);
+			continue;
+		}
+
+		if (predict_variable_digest (bank, digest, event, var_data,
+					     var_size, new_event,
+					     new_event_size, new_data,
+					     new_size, predicted) < 0) {
+			fprintf (stderr, "Warning: can't predict the %s digest "
+				 "of %s\n", eventlog_alg_name (digest->alg) ?: "unknown",
+				 name);
+			bank->predict_ok = 0;
+			continue;
+		}
+		pcr_extend (bank, bank->predicted, predicted);
+	}
+
+	ret = 0;
+error:
+	free (new_event);
+	free (new_data);
+
+	return ret;
+}
+
+/* shim applies a pending SbatPolicy to SbatLevel before measuring it */
+static int
+predict_sbat_level (Pcr7Prediction *pred)
+{
+	uint8_t *policy = NULL, *sb = NULL;
+	size_t policy_size, sb_size;
+	uint32_t attributes;
+	int secure_boot;
+
+	if (get_efi_variable (efi_guid_shim, "SbatPolicy", &policy,
+			      &policy_size, &attributes) < 0) {
+		if (errno != ENOENT) {
+			fprintf (stderr, "Failed to read SbatPolicy: %m\n");
+			return -1;
+		}
+		policy = NULL;
+	}
+
+	if (!policy || policy_size != 1 || policy[0] == 0) {
+		free (policy);
+		if (read_runtime_var ("SbatLevelRT", efi_guid_shim,
+				      &pred->sbat_level,
+				      &pred->sbat_level_size) < 0)
+			return -1;
+		return 0;
+	}
+
+	if (policy[0] == 3) {
+		if (get_efi_variable (efi_guid_global, "SecureBoot", &sb,
+				      &sb_size, &attributes) < 0)
+			sb = NULL;
+		secure_boot = sb && sb_size == 1 && sb[0] == 1;
+		free (sb);
+
+		if (!secure_boot) {
+			free (policy);
+			pred->sbat_level = (uint8_t *)strdup (SBAT_ORIGINAL);
+			if (!pred->sbat_level)
+				return -1;
+			pred->sbat_level_size = strlen (SBAT_ORIGINAL);
+			return 0;
+		}
+		fprintf (stderr, "Warning: shim doesn't reset SbatLevel with "
+			 "Secure Boot enabled\n");
+		free (policy);
+		return read_runtime_var ("SbatLevelRT", efi_guid_shim,
+					 &pred->sbat_level,
+					 &pred->sbat_level_size);
+	}
+
+	fprintf (stderr, "Warning: the pending SbatPolicy applies the "
+		 "revocations built into shim, keeping the measured SbatLevel\n");
+	free (policy);
+
+	return 0;
+}
+
+static int
+is_pending_var (const char *name)
+{
+	uint8_t *data;
+	size_t data_size;
+	uint32_t attributes;
+
+	if (get_efi_variable (efi_guid_shim, name, &data, &data_size,
+			      &attributes) < 0)
+		return 0;
+	free (data);
+
+	return 1;
+}
+
+static int
+index_pending_var (const char *name, uint8_t **datap, SigIndex *index)
+{
+	size_t data_size;
+	uint32_t attributes;
+
+	*datap = NULL;
+	if (get_efi_variable (efi_guid_shim, name, datap, &data_size,
+			      &attributes) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		fprintf (stderr, "Failed to read %s: %m\n", name);
+		return -1;
+	}
+
+	if (sig_index_add_esl (index, *datap, data_size) < 0) {
+		fprintf (stderr, "Corrupted request \"%s\"\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Replay the PCR7 events in the event log with the variables the next
+ * boot will measure: the db variables as they are now and the SbatLevel
+ * after the pending SbatPolicy.
+ */
+static int
+predict_pcr7 (const char *file)
+{
+	Pcr7Prediction pred;
+	FILE *fp;
+	const char *alg;
+	int unknown = 0, ret = -1;
+
+	memset (&pred, 0, sizeof(pred));
+	sig_index_init (&pred.mok_del);
+	sig_index_init (&pred.mokx_new);
+
+	if (!file)
+		file = EVENTLOG_DEFAULT_PATH;
+
+	if (index_pending_var ("MokDel", &pred.mok_del_data,
+			       &pred.mok_del) < 0 ||
+	    index_pending_var ("MokXNew", &pred.mokx_new_data,
+			       &pred.mokx_new) < 0 ||
+	    predict_sbat_level (&pred) < 0)
+		goto error;
+
+	/* The toggles change which keys shim verifies the images with */
+	if (is_pending_var ("MokSB") || is_pending_var ("MokDB"))
+		fprintf (stderr, "Warning: a pending MokSB or MokDB request may "
+			 "change the keys which verify the images\n");
+
+	fp = fopen (file, "r");
+	if (!fp) {
+		fprintf (stderr, "Failed to open %s: %m\n", file);
+		goto error;
+	}
+	ret = eventlog_parse (fp, predict_event, &pred);
+	fclose (fp);
+	if (ret < 0)
+		goto error;
+	ret = -1;
+
+	if (pred.events == 0) {
+		fprintf (stderr, "No PCR7 event in %s\n", file);
+		goto error;
+	}
+
+	printf ("%u PCR7 events, %u changed for the next boot\n", pred.events,
+		pred.changed);
+	for (uint32_t i = 0; i < pred.bank_num; i++) {
+		const PcrBank *bank = &pred.banks[i];
+
+		alg = eventlog_alg_name (bank->alg);
+		if (!alg)
+			alg = "unknown";
+		printf ("%-7s current:   ", alg);
+		if (bank->md)
+			print_hex (stdout, bank->replayed, bank->size);
+		else
+			printf ("unknown");
+		printf ("\n%-7s predicted: ", alg);
+		if (bank->predict_ok)
+			print_hex (stdout, bank->predicted, bank->size);
+		else
+			printf ("unknown");
+		printf ("\n");
+		if (!bank->predict_ok)
+			unknown = 1;
+	}
+
+	ret = unknown;
+error:
+	free (pred.sbat_level);
+	free (pred.mok_del_data);
+	free (pred.mokx_new_data);
+	sig_index_free (&pred.mokx_new);
+	sig_index_free (&pred.mok_del);
+
+	return ret;
+}
+
+typedef struct {
+	const char *db_name;
+	char       *subject;
+	int64_t     not_after;
+} CertExpiry;
+
+static int
+compare_cert_expiry (const void *a, const void *b)
+{
+	const CertExpiry *ca = a;
+	const CertExpiry *cb = b;
+
+	if (ca->not_after < cb->not_after)
+		return -1;
+	if (ca->not_after > cb->not_after)
+		return 1;
+	return strcmp (ca->db_name, cb->db_name);
+}
+
+static int
+check_cert_expiry (const long days)
+{
+	const struct {
+		const char       *name;
+		const efi_guid_t *guid;
+	} dbs[] = {
+		{ "PK",         &efi_guid_global },
+		{ "KEK",        &efi_guid_global },
+		{ "db",         &efi_guid_security },
+		{ "MokListRT",  &efi_guid_shim },
+		{ "MokListXRT", &efi_guid_shim },
+		{ "MokNew",     &efi_guid_shim },
+	};
+	const int64_t limit = (int64_t)days * 86400;
+	CertExpiry *certs = NULL, *certs_new;
+	unsigned int cert_num = 0, expiring = 0, expired = 0;
+	char date[32];
+	int ret = -1;
+
+	for (unsigned int d = 0; d < sizeof(dbs)/sizeof(dbs[0]); d++) {
+		uint8_t *data = NULL;
+		size_t data_size = 0;
+		MokListNode *list;
+		uint32_t mok_num;
+
+		/* A database which can't be checked isn't a passed check */
+		if (get_db_variable (dbs[d].name, *dbs[d].guid, &data,
+				     &data_size) < 0) {
+			if (errno == ENOENT)
+				continue;
+			fprintf (stderr, "Failed to read %s: %m\n", dbs[d].name);
+			goto error;
+		}
+		if (data_size == 0) {
+			free (data);
+			continue;
+		}
+
+		list = build_mok_list (data, data_size, &mok_num);
+		if (list == NULL) {
+			fprintf (stderr, "Failed to parse %s\n", dbs[d].name);
+			free (data);
+			goto error;
+		}
+
+		for (unsigned int i = 0; i < mok_num; i++) {
+			efi_guid_t sigtype = list[i].header->SignatureType;
+			CertExpiry *cert;
+
+			if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0)
+				continue;
+
+			certs_new = realloc (certs, sizeof(CertExpiry) * (cert_num + 1));
+			if (!certs_new) {
+				fprintf (stderr, "Failed to allocate certificate list\n");
+				free (list);
+				free (data);
+				goto error;
+			}
+			certs = certs_new;
+
+			cert = &certs[cert_num];
+			cert->db_name = dbs[d].name;
+			if (get_cert_validity (list[i].mok, list[i].mok_size,
+					       &cert->not_after,
+					       &cert->subject) < 0) {
+				fprintf (stderr, "Invalid X509 certificate in %s\n",
+					 dbs[d].name);
+				continue;
+			}
+			cert_num++;
+		}
+
+		free (list);
+		free (data);
+	}
+
+	if (cert_num > 0)
+		qsort (certs, cert_num, sizeof(CertExpiry), compare_cert_expiry);
+
+	for (unsigned int i = 0; i < cert_num; i++) {
+		time_t expiry = time (NULL) + certs[i].not_after;
+		int64_t remain = certs[i].not_after;
+
+		/* sorted by expiry time, so the rest are all valid long enough */
+		if (remain > limit)
+			break;
+
+		if (expiring == 0)
+			printf ("%-10s  %6s  %-10s  %s\n", "EXPIRES", "DAYS",
+				"DATABASE", "SUBJECT");
+
+		strftime (date, sizeof(date), "%Y-%m-%d", gmtime (&expiry));
+		printf ("%-10s  %6" PRId64 "  %-10s  %s\n", date,
+			remain >= 0 ? remain / 86400 : -((-remain + 86399) / 86400),
+			certs[i].db_name, certs[i].subject);
+
+		expiring++;
+		if (remain < 0)
+			expired++;
+	}
+
+	if (expiring == 0) {
+		printf ("None of the %u certificates expires within %ld days\n",
+			cert_num, days);
+		ret = 0;
+	} else {
+		printf ("%u of %u certificates expire within %ld days, %u expired\n",
+			expiring, cert_num, days, expired);
+		ret = expired ? 2 : 1;
+	}
+
+error:
+	for (unsigned int i = 0; i < cert_num; i++)
+		free (certs[i].subject);
+	free (certs);
+
+	return ret;
+}
+
+static int
+reset_moks (const MokRequest req, const char *pw_hash_file, const int root_pw)
+{
+	if (update_request (NULL, 0, req, pw_hash_file, root_pw)) {
+		fprintf (stderr, "Failed to issue a reset request\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+generate_pw_hash (const char *input_pw)
+{
+	char settings[SETTINGS_LEN];
+	char *password = NULL;
+	char *crypt_string;
+	unsigned int pw_len;
+	uint64_t start;
+
+	if (input_pw) {
 		pw_len = strlen (input_pw);
 		if (pw_len > PASSWORD_MAX || pw_len < PASSWORD_MIN) {
 			fprintf (stderr, "invalid password length\n");
@@ -1594,23 +4368,16 @@ generate_pw_hash (const char *input_pw)
 		}
 	}
 
-	prefix = get_crypt_prefix (DEFAULT_CRYPT_METHOD);
-	if (!prefix)
-		return -1;
-
-	memset (settings, 0, sizeof (settings));
-	next = stpncpy (settings, prefix, settings_len);
-	salt_size = get_pw_salt_size (DEFAULT_CRYPT_METHOD);
-	if (salt_size > settings_len - (next - settings)) {
-		free(password);
-		errno = EOVERFLOW;
+	if (generate_pw_settings (settings, DEFAULT_CRYPT_METHOD) < 0) {
+		fprintf (stderr, "Failed to generate salt: %m\n");
+		free (password);
 		return -1;
 	}
-	generate_pw_salt (next, salt_size);
-	next += salt_size;
-	*next = '\0';
 
+	start = perf_start ();
 	crypt_string = crypt (password, settings);
+	perf_stop (PERF_CRYPT, start, 0,
+		   get_crypt_prefix (DEFAULT_CRYPT_METHOD));
 	free (password);
 	if (!crypt_string) {
 		fprintf (stderr, "Failed to generate hash\n");
@@ -1622,137 +4389,661 @@ generate_pw_hash (const char *input_pw)
 	return 0;
 }
 
+typedef struct {
+	char **passwords;
+	char **hashes;
+} PwBatch;
+
+static void
+hash_batch_password (const unsigned int index, void *data)
+{
+	PwBatch *batch = data;
+	struct crypt_data *cd;
+	char settings[SETTINGS_LEN];
+	char *crypt_string;
+	uint64_t start;
+
+	if (generate_pw_settings (settings, DEFAULT_CRYPT_METHOD) < 0)
+		return;
+
+	/* struct crypt_data is too large for the worker stacks */
+	cd = calloc (1, sizeof (struct crypt_data));
+	if (!cd)
+		return;
+
+	start = perf_start ();
+	crypt_string = crypt_r (batch->passwords[index], settings, cd);
+	perf_stop (PERF_CRYPT, start, 0,
+		   get_crypt_prefix (DEFAULT_CRYPT_METHOD));
+	if (crypt_string && crypt_string[0] != '*')
+		batch->hashes[index] = strdup (crypt_string);
+
+	explicit_bzero (cd, sizeof (struct crypt_data));
+	free (cd);
+}
+
+static int
+generate_pw_hash_batch (const char *file)
+{
+	PwBatch batch = { NULL, NULL };
+	FILE *fp;
+	char *line = NULL;
+	size_t n = 0, alloc = 0;
+	ssize_t len;
+	unsigned int count = 0, line_num = 0;
+	int ret = -1;
+
+	if (strcmp (file, "-") == 0) {
+		fp = stdin;
+	} else {
+		fp = fopen (file, "r");
+		if (!fp) {
+			fprintf (stderr, "Failed to open %s: %m\n", file);
+			return -1;
+		}
+	}
+
+	while ((len = getline (&line, &n, fp)) >= 0) {
+		line_num++;
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len > 0 && line[len - 1] == '\r')
+			line[--len] = '\0';
+
+		if (len > PASSWORD_MAX || len < PASSWORD_MIN) {
+			fprintf (stderr, "line %u: password should be %d~%d characters\n",
+				 line_num, PASSWORD_MIN, PASSWORD_MAX);
+			goto error;
+		}
+
+		if (count == alloc) {
+			char **passwords;
+
+			alloc = alloc ? alloc * 2 : 64;
+			passwords = realloc (batch.passwords, alloc * sizeof (char *));
+			if (!passwords) {
+				fprintf (stderr, "Failed to allocate space: %m\n");
+				goto error;
+			}
+			batch.passwords = passwords;
+		}
+
+		batch.passwords[count] = strdup (line);
+		if (!batch.passwords[count]) {
+			fprintf (stderr, "Failed to duplicate string\n");
+			goto error;
+		}
+		count++;
+	}
+
+	if (ferror (fp)) {
+		fprintf (stderr, "Failed to read %s: %m\n", file);
+		goto error;
+	}
+
+	if (count == 0) {
+		ret = 0;
+		goto error;
+	}
+
+	batch.hashes = calloc (count, sizeof (char *));
+	if (!batch.hashes) {
+		fprintf (stderr, "Failed to allocate space: %m\n");
+		goto error;
+	}
+
+	/* Calibrate once before the workers need the rounds */
+	if (calibrate_pw_rounds () < 0)
+		goto error;
+
+	run_parallel (count, hash_batch_password, &batch);
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (!batch.hashes[i]) {
+			fprintf (stderr, "Failed to generate hash for line %u\n",
+				 i + 1);
+			goto error;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+		printf ("%s\n", batch.hashes[i]);
+
+	ret = 0;
+error:
+	for (unsigned int i = 0; i < count; i++) {
+		explicit_bzero (batch.passwords[i], strlen (batch.passwords[i]));
+		free (batch.passwords[i]);
+		if (batch.hashes)
+			free (batch.hashes[i]);
+	}
+	free (batch.passwords);
+	free (batch.hashes);
+	if (line) {
+		explicit_bzero (line, n);
+		free (line);
+	}
+	if (fp != stdin)
+		fclose (fp);
+
+	return ret;
+}
+
+static int
+set_timeout (const char *t)
+{
+	int timeout = strtol(t, NULL, 10);
+
+	if (errno == ERANGE || timeout > 0x7fff)
+		timeout = 0x7fff;
+	if (timeout < 0)
+		timeout = -1;
+
+	if (timeout != 10) {
+		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
+				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
+				      | EFI_VARIABLE_RUNTIME_ACCESS;
+		if (set_efi_variable (efi_guid_shim, "MokTimeout",
+				      (uint8_t *)&timeout, sizeof (timeout),
+				      attributes, S_IRUSR | S_IWUSR) < 0) {
+			fprintf (stderr, "Failed to set MokTimeout\n");
+			return -1;
+		}
+	} else {
+		return test_and_delete_mok_var ("MokTimeout");
+	}
+
+	return 0;
+}
+
+static int
+print_var_content (const char *var_name, const efi_guid_t guid)
+{
+	uint8_t *data = NULL;
+	size_t data_size;
+	uint32_t attributes;
+	int ret;
+
+	ret = get_efi_variable (guid, var_name, &data, &data_size, &attributes);
+	if (ret < 0) {
+		if (errno == ENOENT) {
+			printf ("%s is empty\n", var_name);
+			return 0;
+		}
+
+		fprintf (stderr, "Failed to read %s: %m\n", var_name);
+		return -1;
+	}
+
+	printf ("%s", data);
+	free (data);
+
+	return ret;
+}
+
+static int
+set_verbosity (const uint8_t verbosity)
+{
+	if (verbosity) {
+		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
+				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
+				      | EFI_VARIABLE_RUNTIME_ACCESS;
+		if (set_efi_variable (efi_guid_shim, "SHIM_VERBOSE",
+				      (uint8_t *)&verbosity, sizeof (verbosity),
+				      attributes, S_IRUSR | S_IWUSR) < 0) {
+			fprintf (stderr, "Failed to set SHIM_VERBOSE\n");
+			return -1;
+		}
+	} else {
+		return test_and_delete_mok_var ("SHIM_VERBOSE");
+	}
+
+	return 0;
+}
+
+static int
+set_fallback_verbosity (const uint8_t verbosity)
+{
+	if (verbosity) {
+		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
+				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
+				      | EFI_VARIABLE_RUNTIME_ACCESS;
+		if (set_efi_variable (efi_guid_shim, "FALLBACK_VERBOSE",
+				      (uint8_t *)&verbosity, sizeof (verbosity),
+				      attributes, S_IRUSR | S_IWUSR) < 0) {
+			fprintf (stderr, "Failed to set FALLBACK_VERBOSE\n");
+			return -1;
+		}
+	} else {
+		return test_and_delete_mok_var ("FALLBACK_VERBOSE");
+	}
+
+	return 0;
+}
+
+static int
+set_fallback_noreboot (const uint8_t noreboot)
+{
+	if (noreboot) {
+		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
+				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
+				      | EFI_VARIABLE_RUNTIME_ACCESS;
+		if (set_efi_variable (efi_guid_shim, "FB_NO_REBOOT",
+				      (uint8_t *)&noreboot, sizeof (noreboot),
+				      attributes, S_IRUSR | S_IWUSR) < 0) {
+			fprintf (stderr, "Failed to set FB_NO_REBOOT\n");
+			return -1;
+		}
+	} else {
+		return test_and_delete_mok_var ("FB_NO_REBOOT");
+	}
+
+	return 0;
+}
+
+static inline int
+list_db (const DBName db_name)
+{
+	const DBInfo *info = get_db_info (db_name);
+
+	return list_keys_in_var (info->var_name, *info->guid);
+}
+
+/* Return the database selected by the long option, or -1 */
+static int
+find_db_option (const char *option)
+{
+	const DBInfo *info;
+
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+		info = get_db_info (i);
+		if (info->option && strcmp (info->option, option) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+load_db_var (const unsigned int index, void *data)
+{
+	const CachedVar **vars = data;
+	const DBInfo *info = get_db_info (index);
+
+	vars[index] = var_cache_get (info->var_name, *info->guid);
+}
+
+/*
+ * List every database in one pass. The variables are read concurrently
+ * through the cache and then printed in the order of the registry.
+ */
+static int
+list_all_dbs (const int json)
+{
+	const CachedVar *vars[DB_NAME_NUM];
+	const DBInfo *info;
+	int ret = 0;
+
+	run_parallel (DB_NAME_NUM, load_db_var, vars);
+
+	if (json)
+		printf ("{");
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+		info = get_db_info (i);
+
+		if (!vars[i]) {
+			fprintf (stderr, "Failed to read %s\n", info->var_name);
+			ret = -1;
+		}
+
+		if (json) {
+			printf ("%s\"%s\": ", i ? ", " : "", info->var_name);
+			if (!vars[i] || !vars[i]->data) {
+				printf ("null");
+			} else if (print_sig_entries_json (stdout, vars[i]) < 0) {
+				fprintf (stderr, "Failed to hash %s\n",
+					 info->var_name);
+				ret = -1;
+			}
+			continue;
+		}
+
+		printf ("%s=== %s ===\n", i ? "\n" : "", info->var_name);
+		if (!vars[i] || !vars[i]->data || vars[i]->data_size == 0) {
+			printf ("%s is empty\n", info->var_name);
+			continue;
+		}
+		if (list_keys (vars[i]->data, vars[i]->data_size) < 0)
+			ret = -1;
+	}
+	if (json)
+		printf ("}\n");
+
+	return ret;
+}
+
+/* The diff operand which stands for the current variables */
+#define DIFF_LIVE "live"
+
+typedef struct {
+	const char     *source;
+	int             live;
+	int             full;		/* all the databases, live or snapshot */
+	int             esl_opened;
+	EslFile         esl;
+	Snapshot        snap;
+	SigIndex        indexes[DB_NAME_NUM];
+	uint8_t        *bufs[DB_NAME_NUM];
+	const SigIndex *dbs[DB_NAME_NUM];	/* NULL if not in the source */
+} DiffSide;
+
+typedef struct {
+	int          json;
+	unsigned int added;
+	unsigned int removed;
+} DiffResult;
+
 static int
-set_timeout (const char *t)
+load_diff_snapshot (const char *source, DiffSide *side)
 {
-	int timeout = strtol(t, NULL, 10);
+	const uint8_t *data;
+	size_t data_size;
 
-	if (errno == ERANGE || timeout > 0x7fff)
-		timeout = 0x7fff;
-	if (timeout < 0)
-		timeout = -1;
+	if (snapshot_open (source, &side->snap) < 0)
+		return -1;
+	side->full = 1;
 
-	if (timeout != 10) {
-		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
-				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
-				      | EFI_VARIABLE_RUNTIME_ACCESS;
-		if (efi_set_variable (efi_guid_shim, "MokTimeout",
-				      (uint8_t *)&timeout, sizeof (timeout),
-				      attributes, S_IRUSR | S_IWUSR) < 0) {
-			fprintf (stderr, "Failed to set MokTimeout\n");
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+		if (snapshot_get_db (&side->snap, get_db_var_name (i), &data,
+				     &data_size, &side->bufs[i]) < 0) {
+			if (errno == ENOENT)
+				continue;
+			fprintf (stderr, "Failed to read %s in %s\n",
+				 get_db_var_name (i), source);
 			return -1;
 		}
-	} else {
-		return test_and_delete_mok_var ("MokTimeout");
+		if (sig_index_add_esl (&side->indexes[i], data, data_size) < 0) {
+			fprintf (stderr, "Failed to parse %s in %s\n",
+				 get_db_var_name (i), source);
+			return -1;
+		}
+		side->dbs[i] = &side->indexes[i];
 	}
 
 	return 0;
 }
 
+/*
+ * Load one side of the diff. "live" reads every database through the
+ * variable cache, and so does a snapshot from the file; any other file
+ * holds the signature lists of the selected database.
+ */
 static int
-print_var_content (const char *var_name, const efi_guid_t guid)
+load_diff_side (const char *source, const DBName db_name, DiffSide *side)
 {
-	uint8_t *data = NULL;
-	size_t data_size;
-	uint32_t attributes;
-	int ret;
-
-	ret = efi_get_variable (guid, var_name, &data, &data_size, &attributes);
-	if (ret < 0) {
-		if (errno == ENOENT) {
-			printf ("%s is empty\n", var_name);
-			return 0;
+	const CachedVar *vars[DB_NAME_NUM];
+
+	memset (side, 0, sizeof(DiffSide));
+	side->source = source;
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++)
+		sig_index_init (&side->indexes[i]);
+
+	if (strcmp (source, DIFF_LIVE) == 0) {
+		side->live = 1;
+		side->full = 1;
+		run_parallel (DB_NAME_NUM, load_db_var, vars);
+		for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+			if (!vars[i]) {
+				fprintf (stderr, "Failed to read %s\n",
+					 get_db_var_name (i));
+				return -1;
+			}
+			if (vars[i]->data)
+				side->dbs[i] = &vars[i]->index;
 		}
+		return 0;
+	}
 
-		fprintf (stderr, "Failed to read %s: %m\n", var_name);
+	if (esl_file_open_var (source, get_db_var_name (db_name),
+			       &side->esl) < 0)
 		return -1;
+	side->esl_opened = 1;
+
+	/* The standard input can't be mapped again */
+	if (side->esl.format == ESL_FORMAT_SNAPSHOT &&
+	    strcmp (source, "-") != 0) {
+		esl_file_close (&side->esl);
+		side->esl_opened = 0;
+		return load_diff_snapshot (source, side);
 	}
 
-	printf ("%s", data);
-	free (data);
+	if (sig_index_add_esl (&side->indexes[db_name], side->esl.data,
+			       side->esl.data_size) < 0) {
+		fprintf (stderr, "Failed to parse %s\n", source);
+		return -1;
+	}
+	side->dbs[db_name] = &side->indexes[db_name];
 
-	return ret;
+	return 0;
+}
+
+static void
+free_diff_side (DiffSide *side)
+{
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+		sig_index_free (&side->indexes[i]);
+		free (side->bufs[i]);
+	}
+	if (side->esl_opened)
+		esl_file_close (&side->esl);
+	snapshot_close (&side->snap);
 }
 
 static int
-set_verbosity (const uint8_t verbosity)
+print_diff_entry (DiffResult *result, const char *db, const int added,
+		  const SigEntry *entry)
 {
-	if (verbosity) {
-		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
-				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
-				      | EFI_VARIABLE_RUNTIME_ACCESS;
-		if (efi_set_variable (efi_guid_shim, "SHIM_VERBOSE",
-				      (uint8_t *)&verbosity, sizeof (verbosity),
-				      attributes, S_IRUSR | S_IWUSR) < 0) {
-			fprintf (stderr, "Failed to set SHIM_VERBOSE\n");
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	const uint8_t *value = entry->data;
+	size_t value_size = entry->data_size;
+	int is_x509 = efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0;
+	char *owner = NULL, *subject = NULL;
+	int64_t not_after;
+
+	if (is_x509) {
+		if (!SHA256 (entry->data, entry->data_size, digest)) {
+			fprintf (stderr, "Failed to hash the certificate\n");
 			return -1;
 		}
+		value = digest;
+		value_size = sizeof(digest);
+		if (get_cert_validity (entry->data, entry->data_size,
+				       &not_after, &subject) < 0)
+			subject = NULL;
+	}
+	if (efi_guid_to_str (&entry->owner, &owner) < 0)
+		owner = NULL;
+
+	if (result->json) {
+		printf ("%s{\"db\": \"%s\", \"change\": \"%s\", "
+			"\"type\": \"%s\", \"%s\": \"",
+			result->added + result->removed ? ", " : "", db,
+			added ? "added" : "removed",
+			sig_type_name (&entry->type), is_x509 ? "sha256" : "hash");
+		print_hex (stdout, value, value_size);
+		printf ("\", \"owner\": \"%s\"", owner ? owner : "");
+		if (subject) {
+			printf (", \"subject\": ");
+			json_print_string (stdout, subject);
+		}
+		printf ("}");
 	} else {
-		return test_and_delete_mok_var ("SHIM_VERBOSE");
+		printf ("%c %s %s ", added ? '+' : '-', db,
+			sig_type_name (&entry->type));
+		print_hex (stdout, value, value_size);
+		printf (" %s", owner ? owner : "-");
+		if (subject)
+			printf (" %s", subject);
+		printf ("\n");
 	}
 
+	if (added)
+		result->added++;
+	else
+		result->removed++;
+
+	free (owner);
+	free (subject);
+
 	return 0;
 }
 
+/* Print the entries of "from" which are not in "to" with the same owner */
 static int
-set_fallback_verbosity (const uint8_t verbosity)
+diff_db_entries (DiffResult *result, const char *db, const int added,
+		 const SigIndex *from, const SigIndex *to)
 {
-	if (verbosity) {
-		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
-				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
-				      | EFI_VARIABLE_RUNTIME_ACCESS;
-		if (efi_set_variable (efi_guid_shim, "FALLBACK_VERBOSE",
-				      (uint8_t *)&verbosity, sizeof (verbosity),
-				      attributes, S_IRUSR | S_IWUSR) < 0) {
-			fprintf (stderr, "Failed to set FALLBACK_VERBOSE\n");
+	int idx;
+
+	for (uint32_t i = 0; i < from->entry_num; i++) {
+		const SigEntry *entry = &from->entries[i];
+
+		idx = to ? sig_index_find (to, &entry->type, entry->data,
+					   entry->data_size) : -1;
+		if ((idx < 0 ||
+		     efi_guid_cmp (&to->entries[idx].owner, &entry->owner) != 0) &&
+		    print_diff_entry (result, db, added, entry) < 0)
 			return -1;
-		}
-	} else {
-		return test_and_delete_mok_var ("FALLBACK_VERBOSE");
 	}
 
 	return 0;
 }
 
+/*
+ * Show the signatures added and removed between two sources. Both sides
+ * are indexed once, so each entry costs one hash lookup on the other
+ * side. Return 0 if they are the same, 1 if they differ.
+ */
 static int
-set_fallback_noreboot (const uint8_t noreboot)
+diff_dbs (const char *source_a, const char *source_b, const DBName db_name,
+	  const int json)
 {
-	if (noreboot) {
-		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
-				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
-				      | EFI_VARIABLE_RUNTIME_ACCESS;
-		if (efi_set_variable (efi_guid_shim, "FB_NO_REBOOT",
-				      (uint8_t *)&noreboot, sizeof (noreboot),
-				      attributes, S_IRUSR | S_IWUSR) < 0) {
-			fprintf (stderr, "Failed to set FB_NO_REBOOT\n");
-			return -1;
-		}
-	} else {
-		return test_and_delete_mok_var ("FB_NO_REBOOT");
+	DiffSide a, b;
+	DiffResult result = { .json = json };
+	int compare_all, failed = 0;
+	int ret = -1;
+
+	/* The variables are read once, so both sides would be the same */
+	if (strcmp (source_a, DIFF_LIVE) == 0 &&
+	    strcmp (source_b, DIFF_LIVE) == 0) {
+		fprintf (stderr, "Compare the live variables with a snapshot "
+			 "made by --capture\n");
+		return -1;
 	}
 
-	return 0;
+	if (load_diff_side (source_a, db_name, &a) < 0) {
+		free_diff_side (&a);
+		return -1;
+	}
+	if (load_diff_side (source_b, db_name, &b) < 0)
+		goto error;
+
+	/* Without a database option, every database is compared */
+	compare_all = a.full && b.full && db_name == MOK_LIST_RT;
+
+	if (json)
+		printf ("{\"entries\": [");
+	for (unsigned int i = 0; i < DB_NAME_NUM && !failed; i++) {
+		if (!compare_all && i != db_name)
+			continue;
+		if ((a.dbs[i] &&
+		     diff_db_entries (&result, get_db_var_name (i), 0,
+				      a.dbs[i], b.dbs[i]) < 0) ||
+		    (b.dbs[i] &&
+		     diff_db_entries (&result, get_db_var_name (i), 1,
+				      b.dbs[i], a.dbs[i]) < 0))
+			failed = 1;
+	}
+	if (json)
+		printf ("], \"added\": %u, \"removed\": %u}\n",
+			result.added, result.removed);
+	if (failed)
+		goto error;
+	if (!json && result.added + result.removed == 0)
+		printf ("No difference\n");
+	else if (!json)
+		printf ("%u added, %u removed\n", result.added, result.removed);
+
+	ret = (result.added + result.removed) ? 1 : 0;
+error:
+	free_diff_side (&b);
+	free_diff_side (&a);
+
+	return ret;
 }
 
-static inline int
-list_db (const DBName db_name)
+/*
+ * Evaluate the rules file against the databases. Return 0 if every rule
+ * passes, 1 if any fails and -1 if a database can't be read.
+ */
+static int
+run_audit (const char *path, const int json)
 {
-	switch (db_name) {
-		case MOK_LIST_RT:
-			return list_keys_in_var ("MokListRT", efi_guid_shim);
-		case MOK_LIST_X_RT:
-			return list_keys_in_var ("MokListXRT", efi_guid_shim);
-		case PK:
-			return list_keys_in_var ("PK", efi_guid_global);
-		case KEK:
-			return list_keys_in_var ("KEK", efi_guid_global);
-		case DB:
-			return list_keys_in_var ("db", efi_guid_security);
-		case DBX:
-			return list_keys_in_var ("dbx", efi_guid_security);
-	}
+	AuditRules rules;
+	AuditResult result;
+	const AuditRule *rule;
+	const char *verdict;
+	unsigned int failed = 0, errors = 0;
 
-	return -1;
+	if (audit_load (path, &rules) < 0)
+		return -1;
+
+	if (json)
+		printf ("{\"rules\": [");
+	for (unsigned int i = 0; i < rules.rule_num; i++) {
+		rule = &rules.rules[i];
+		audit_eval (rule, &result);
+		if (result.error)
+			errors++;
+		else if (!result.passed)
+			failed++;
+		verdict = result.error ? "error" : result.passed ? "pass" : "fail";
+
+		if (json) {
+			printf ("%s{\"line\": %u, \"rule\": ", i ? ", " : "",
+				rule->line);
+			json_print_string (stdout, rule->text);
+			printf (", \"result\": \"%s\", \"db\": \"%s\"",
+				verdict, result.db);
+			if (result.detail) {
+				printf (", \"detail\": ");
+				json_print_string (stdout, result.detail);
+			}
+			printf ("}");
+		} else {
+			printf ("%s line %u: %s\n", result.error ? "ERROR" :
+				result.passed ? "PASS" : "FAIL", rule->line,
+				rule->text);
+			if (result.detail)
+				printf ("  %s: %s\n", result.db, result.detail);
+		}
+		free (result.detail);
+	}
+	if (json)
+		printf ("], \"passed\": %u, \"failed\": %u, \"errors\": %u}\n",
+			rules.rule_num - failed - errors, failed, errors);
+	else if (errors)
+		printf ("%u rules, %u failed, %u errors\n", rules.rule_num,
+			failed, errors);
+	else
+		printf ("%u rules, %u failed\n", rules.rule_num, failed);
+
+	audit_reset ();
+	audit_free (&rules);
+
+	if (errors)
+		return -1;
+	return failed ? 1 : 0;
 }
 
 static int
@@ -1762,7 +5053,7 @@ manage_sbat (const uint8_t sbat_policy)
 		uint32_t attributes = EFI_VARIABLE_NON_VOLATILE
 				      | EFI_VARIABLE_BOOTSERVICE_ACCESS
 				      | EFI_VARIABLE_RUNTIME_ACCESS;
-		if (efi_set_variable (efi_guid_shim, "SbatPolicy",
+		if (set_efi_variable (efi_guid_shim, "SbatPolicy",
 				      (uint8_t *)&sbat_policy,
 				      sizeof (sbat_policy),
 				      attributes, S_IRUSR | S_IWUSR) < 0) {
@@ -1775,23 +5066,74 @@ manage_sbat (const uint8_t sbat_policy)
 	return 0;
 }
 
+/*
+ * Collect the option argument and the following non-option arguments.
+ * getopt has already taken the option argument, either from the next word
+ * or after "=" in "--option=file", so the other files start at optind.
+ */
+static char **
+collect_file_args (int argc, char *argv[], int *total)
+{
+	char **files;
+	int f_ind, i;
+
+	*total = 0;
+	if (!optarg || (*optarg == '-' && strcmp (optarg, "-") != 0))
+		return NULL;
+
+	*total = 1;
+	for (f_ind = optind;
+	     f_ind < argc && (*argv[f_ind] != '-' ||
+			      strcmp (argv[f_ind], "-") == 0);
+	     f_ind++) {
+		(*total)++;
+	}
+
+	files = malloc (*total * sizeof (char *));
+	if (files == NULL) {
+		fprintf (stderr, "Could not allocate space: %m\n");
+		exit(1);
+	}
+	for (i = 0; i < *total; i++) {
+		files[i] = strdup (i == 0 ? optarg : argv[optind + i - 1]);
+		if (files[i] == NULL) {
+			fprintf (stderr, "Could not allocate space: %m\n");
+			exit(1);
+		}
+	}
+
+	return files;
+}
+
 int
 main (int argc, char *argv[])
 {
 	char **files = NULL;
-	char *key_file = NULL;
 	char *pw_hash_file = NULL;
 	char *input_pw = NULL;
 	char *hash_str = NULL;
 	char *timeout = NULL;
+	char *offline_file = NULL;
+	char *update_file = NULL;
+	char *output_file = NULL;
+	char *socket_path = NULL;
+	char *pw_batch_file = NULL;
+	char *eventlog_file = NULL;
+	char *audit_file = NULL;
+	char *capture_file = NULL;
+	ExportFormat export_format = EXPORT_DER;
+	int export_format_set = 0;
 	const char *option;
-	int c, i, f_ind, total = 0;
-	unsigned int command = 0;
+	int c, i, total = 0;
+	uint64_t command = 0;
 	int use_root_pw = 0;
+	int json = 0;
+	int trace_perf = 0;
 	uint8_t verbosity = 0;
 	uint8_t fb_verbosity = 0;
 	uint8_t fb_noreboot = 0;
 	uint8_t sbat_policy = 0;
+	long expiry_days = DEFAULT_EXPIRY_DAYS;
 	DBName db_name = MOK_LIST_RT;
 	int ret = -1;
 	int sb_check;
@@ -1799,11 +5141,6 @@ main (int argc, char *argv[])
 	force_ca_check = 0;
 	check_keyring = 1;
 
-	if (!efi_variables_supported ()) {
-		fprintf (stderr, "EFI variables are not supported on this system\n");
-		exit (1);
-	}
-
 	while (1) {
 		static struct option long_options[] = {
 			{"help",               no_argument,       0, 'h'},
@@ -1817,6 +5154,7 @@ main (int argc, char *argv[])
 			{"export",             no_argument,       0, 'x'},
 			{"password",           no_argument,       0, 'p'},
 			{"clear-password",     no_argument,       0, 'c'},
+			{"verify-password",    no_argument,       0, 0  },
 			{"disable-validation", no_argument,       0, 0  },
 			{"enable-validation",  no_argument,       0, 0  },
 			{"sb-state",           no_argument,       0, 0  },
@@ -1824,6 +5162,9 @@ main (int argc, char *argv[])
 			{"reset",              no_argument,       0, 0  },
 			{"hash-file",          required_argument, 0, 'f'},
 			{"generate-hash",      optional_argument, 0, 'g'},
+			{"generate-hash-batch", required_argument, 0, 0  },
+			{"hash-time",          required_argument, 0, 0  },
+			{"firmware-slowdown",  required_argument, 0, 0  },
 			{"root-pw",            no_argument,       0, 'P'},
 			{"ignore-db",          no_argument,       0, 0  },
 			{"use-db",             no_argument,       0, 0  },
@@ -1841,11 +5182,34 @@ main (int argc, char *argv[])
 			{"kek",                no_argument,       0, 0  },
 			{"db",                 no_argument,       0, 0  },
 			{"dbx",                no_argument,       0, 0  },
+			{"dbr",                no_argument,       0, 0  },
+			{"dbt",                no_argument,       0, 0  },
+			{"pk-default",         no_argument,       0, 0  },
+			{"kek-default",        no_argument,       0, 0  },
+			{"db-default",         no_argument,       0, 0  },
+			{"dbx-default",        no_argument,       0, 0  },
+			{"dbr-default",        no_argument,       0, 0  },
+			{"dbt-default",        no_argument,       0, 0  },
+			{"all",                no_argument,       0, 0  },
+			{"diff",               required_argument, 0, 0  },
+			{"audit",              required_argument, 0, 0  },
+			{"capture",            required_argument, 0, 0  },
 			{"list-sbat-revocations", no_argument,       0, 0  },
 			{"sbat",               no_argument,       0, 0  },
 			{"timeout",            required_argument, 0, 0  },
 			{"ca-check",           no_argument,       0, 0  },
 			{"ignore-keyring",     no_argument,       0, 0  },
+			{"check-expiry",       optional_argument, 0, 0  },
+			{"file",               required_argument, 0, 0  },
+			{"dbx-update-check",   required_argument, 0, 0  },
+			{"check-eventlog",     optional_argument, 0, 0  },
+			{"predict-pcr7",       optional_argument, 0, 0  },
+			{"output",             required_argument, 0, 0  },
+			{"export-format",      required_argument, 0, 0  },
+			{"json",               no_argument,       0, 0  },
+			{"compact",            no_argument,       0, 0  },
+			{"daemon",             required_argument, 0, 0  },
+			{"trace-perf",         optional_argument, 0, 0  },
 			{"version",            no_argument,       0, 'v'},
 			{0, 0, 0, 0}
 		};
@@ -1864,6 +5228,8 @@ main (int argc, char *argv[])
 				command |= REVOKE_IMPORT;
 			} else if (strcmp (option, "revoke-delete") == 0) {
 				command |= REVOKE_DELETE;
+			} else if (strcmp (option, "verify-password") == 0) {
+				command |= VERIFY_PASSWORD;
 			} else if (strcmp (option, "disable-validation") == 0) {
 				command |= DISABLE_VALIDATION;
 			} else if (strcmp (option, "enable-validation") == 0) {
@@ -1936,30 +5302,45 @@ main (int argc, char *argv[])
 					sbat_policy = 3;
 				else
 					command |= HELP;
-			} else if (strcmp (option, "pk") == 0) {
+			} else if (find_db_option (option) >= 0) {
 				if (db_name != MOK_LIST_RT) {
 					command |= HELP;
 				} else {
-					db_name = PK;
+					db_name = find_db_option (option);
 				}
-			} else if (strcmp (option, "kek") == 0) {
-				if (db_name != MOK_LIST_RT) {
+			} else if (strcmp (option, "all") == 0) {
+				command |= LIST_ALL;
+			} else if (strcmp (option, "audit") == 0) {
+				command |= AUDIT;
+				if (audit_file) {
 					command |= HELP;
-				} else {
-					db_name = KEK;
+					break;
 				}
-			} else if (strcmp (option, "db") == 0) {
-				if (db_name != MOK_LIST_RT) {
+				audit_file = strdup (optarg);
+				if (audit_file == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "capture") == 0) {
+				command |= CAPTURE;
+				if (capture_file) {
 					command |= HELP;
-				} else {
-					db_name = DB;
+					break;
 				}
-			} else if (strcmp (option, "dbx") == 0) {
-				if (db_name != MOK_LIST_RT) {
+				capture_file = strdup (optarg);
+				if (capture_file == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "diff") == 0) {
+				command |= DIFF;
+				if (files) {
 					command |= HELP;
-				} else {
-					db_name = DBX;
+					break;
 				}
+				files = collect_file_args (argc, argv, &total);
+				if (total != 2)
+					command |= HELP;
 			}  else if (strcmp (option, "list-sbat-revocations") == 0) {
 				command |= LIST_SBAT;
 			}  else if (strcmp (option, "sbat") == 0) {
@@ -1971,6 +5352,140 @@ main (int argc, char *argv[])
 				force_ca_check = 1;
 			} else if (strcmp (option, "ignore-keyring") == 0) {
 				check_keyring = 0;
+			} else if (strcmp (option, "file") == 0) {
+				if (offline_file) {
+					command |= HELP;
+					break;
+				}
+				offline_file = strdup (optarg);
+				if (offline_file == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "dbx-update-check") == 0) {
+				command |= DBX_UPDATE_CHECK;
+				if (update_file) {
+					command |= HELP;
+					break;
+				}
+				update_file = strdup (optarg);
+				if (update_file == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "check-eventlog") == 0 ||
+				   strcmp (option, "predict-pcr7") == 0) {
+				if (strcmp (option, "check-eventlog") == 0)
+					command |= CHECK_EVENTLOG;
+				else
+					command |= PREDICT_PCR7;
+				if (eventlog_file) {
+					command |= HELP;
+					break;
+				}
+				if (optarg) {
+					eventlog_file = strdup (optarg);
+					if (eventlog_file == NULL) {
+						fprintf (stderr, "Could not allocate space: %m\n");
+						exit(1);
+					}
+				}
+			} else if (strcmp (option, "output") == 0) {
+				if (output_file) {
+					command |= HELP;
+					break;
+				}
+				output_file = strdup (optarg);
+				if (output_file == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "export-format") == 0) {
+				if (export_format_set) {
+					command |= HELP;
+					break;
+				}
+				export_format_set = 1;
+				if (strcmp (optarg, "esl") == 0) {
+					export_format = EXPORT_ESL;
+				} else if (strcmp (optarg, "pem") == 0) {
+					export_format = EXPORT_PEM;
+				} else if (strcmp (optarg, "tar") == 0) {
+					export_format = EXPORT_TAR;
+				} else if (strcmp (optarg, "hashlist") == 0) {
+					export_format = EXPORT_HASHLIST;
+				} else {
+					fprintf (stderr, "Unknown export format: %s\n",
+						 optarg);
+					command |= HELP;
+				}
+			} else if (strcmp (option, "daemon") == 0) {
+				command |= DAEMON;
+				if (socket_path) {
+					command |= HELP;
+					break;
+				}
+				socket_path = strdup (optarg);
+				if (socket_path == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "generate-hash-batch") == 0) {
+				command |= GENERATE_PW_HASH_BATCH;
+				if (pw_batch_file) {
+					command |= HELP;
+					break;
+				}
+				pw_batch_file = strdup (optarg);
+				if (pw_batch_file == NULL) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+			} else if (strcmp (option, "hash-time") == 0) {
+				char *endp;
+
+				errno = 0;
+				hash_time = strtoul (optarg, &endp, 10);
+				if (errno || *endp != '\0' || hash_time == 0 ||
+				    hash_time > 60000) {
+					fprintf (stderr, "Invalid hash time: %s\n", optarg);
+					exit(1);
+				}
+			} else if (strcmp (option, "firmware-slowdown") == 0) {
+				char *endp;
+
+				errno = 0;
+				firmware_slowdown = strtod (optarg, &endp);
+				if (errno || *endp != '\0' || !(firmware_slowdown > 0)) {
+					fprintf (stderr, "Invalid firmware slowdown: %s\n", optarg);
+					exit(1);
+				}
+			} else if (strcmp (option, "trace-perf") == 0) {
+				if (trace_perf) {
+					command |= HELP;
+					break;
+				}
+				trace_perf = 1;
+				if (perf_enable (optarg) < 0) {
+					fprintf (stderr, "Could not allocate space: %m\n");
+					exit(1);
+				}
+				atexit (perf_report);
+			} else if (strcmp (option, "compact") == 0) {
+				command |= COMPACT;
+			} else if (strcmp (option, "json") == 0) {
+				json = 1;
+			} else if (strcmp (option, "check-expiry") == 0) {
+				command |= CHECK_EXPIRY;
+				if (optarg) {
+					char *end;
+
+					errno = 0;
+					expiry_days = strtol (optarg, &end, 10);
+					if (errno || *end != '\0' || end == optarg ||
+					    expiry_days < 0 || expiry_days > 36500)
+						command |= HELP;
+				}
 			}
 
 			break;
@@ -1995,28 +5510,9 @@ main (int argc, char *argv[])
 				break;
 			}
 
-			total = 0;
-			for (f_ind = optind - 1;
-			     f_ind < argc && *argv[f_ind] != '-';
-			     f_ind++) {
-				total++;
-			}
-
-			if (total == 0) {
+			files = collect_file_args (argc, argv, &total);
+			if (files == NULL)
 				command |= HELP;
-				break;
-			}
-
-			files = malloc (total * sizeof (char *));
-			if (files == NULL) {
-				fprintf (stderr, "Could not allocate space: %m\n");
-				exit(1);
-			}
-			for (i = 0; i < total; i++) {
-				f_ind = i + optind - 1;
-				files[i] = malloc (strlen(argv[f_ind]) + 1);
-				strcpy (files[i], argv[f_ind]);
-			}
 
 			break;
 		case 'f':
@@ -2056,17 +5552,17 @@ main (int argc, char *argv[])
 			use_root_pw = 1;
 			break;
 		case 't':
-			if (key_file) {
+			command |= TEST_KEY;
+
+			if (files) {
 				command |= HELP;
 				break;
 			}
-			key_file = strdup (optarg);
-			if (key_file == NULL) {
-				fprintf (stderr, "Could not allocate space: %m\n");
-				exit(1);
-			}
 
-			command |= TEST_KEY;
+			files = collect_file_args (argc, argv, &total);
+			if (files == NULL)
+				command |= HELP;
+
 			break;
 		case 'x':
 			command |= EXPORT;
@@ -2097,12 +5593,54 @@ main (int argc, char *argv[])
 	if (pw_hash_file && use_root_pw)
 		command |= HELP;
 
+	if (output_file && !(command & (DBX_UPDATE_CHECK | EXPORT)))
+		command |= HELP;
+
+	if (export_format_set && !(command & EXPORT))
+		command |= HELP;
+
+	/* The DER export writes one file per certificate */
+	if ((command & EXPORT) && output_file && !export_format_set)
+		command |= HELP;
+
+	if (json && !(command & (TEST_KEY | LIST_ALL | DIFF | AUDIT)))
+		command |= HELP;
+
+	if ((command & LIST_ALL) && db_name != MOK_LIST_RT)
+		command |= HELP;
+
+	/* --mokx only selects MokListXRT for --diff */
+	if (command & DIFF)
+		command &= ~MOKX;
+
 	if (db_name != MOK_LIST_RT && !(command & ~MOKX))
 		command |= LIST_ENROLLED;
 
-	sb_check = !(command & HELP || command & TEST_KEY ||
+	if (offline_file) {
+		/* Only listing and testing keys work on a file */
+		if (command == 0)
+			command |= LIST_ENROLLED;
+		if (command & ~(LIST_ENROLLED | TEST_KEY | MOKX |
+				DBX_UPDATE_CHECK) ||
+		    (db_name != MOK_LIST_RT && (command & ~MOKX) != LIST_ENROLLED))
+			command |= HELP;
+	} else if (!efi_variables_supported ()) {
+		fprintf (stderr, "EFI variables are not supported on this system\n");
+		exit (1);
+	}
+
+	/*
+	 * These commands skip the check for the SecureBoot variable: the
+	 * simple ones find out without the extra read, and --capture saves
+	 * the state of machines without Secure Boot too.
+	 */
+	sb_check = !(command & HELP || command & TEST_KEY || offline_file ||
+		     command & DAEMON || command & SB_STATE ||
+		     command & REVOKE_IMPORT || command & REVOKE_DELETE ||
 		     command & VERBOSITY || command & TIMEOUT ||
-		     command & FB_VERBOSITY || command & FB_NOREBOOT);
+		     command & FB_VERBOSITY || command & FB_NOREBOOT ||
+		     command & SET_SBAT || command & GENERATE_PW_HASH_BATCH ||
+		     command & CAPTURE);
 	if (sb_check) {
 		/* Check whether the machine supports Secure Boot or not */
 		int rc;
@@ -2110,7 +5648,7 @@ main (int argc, char *argv[])
 		size_t data_size;
 		uint32_t attributes;
 
-		rc = efi_get_variable (efi_guid_global, "SecureBoot",
+		rc = get_efi_variable (efi_guid_global, "SecureBoot",
 				       &data, &data_size, &attributes);
 		if (rc < 0) {
 			fprintf(stderr, "This system doesn't support Secure Boot\n");
@@ -2123,7 +5661,22 @@ main (int argc, char *argv[])
 	switch (command) {
 		case LIST_ENROLLED:
 		case LIST_ENROLLED | MOKX:
-			ret = list_db (db_name);
+			if (offline_file)
+				ret = list_keys_in_file (offline_file, db_name);
+			else
+				ret = list_db (db_name);
+			break;
+		case LIST_ALL:
+			ret = list_all_dbs (json);
+			break;
+		case DIFF:
+			ret = diff_dbs (files[0], files[1], db_name, json);
+			break;
+		case AUDIT:
+			ret = run_audit (audit_file, json);
+			break;
+		case CAPTURE:
+			ret = snapshot_capture (capture_file);
 			break;
 		case LIST_NEW:
 			ret = list_keys_in_var ("MokNew", efi_guid_shim);
@@ -2132,30 +5685,31 @@ main (int argc, char *argv[])
 			ret = list_keys_in_var ("MokDel", efi_guid_shim);
 			break;
 		case IMPORT:
-			ret = issue_mok_request (files, total, ENROLL_MOK,
+			ret = issue_mok_request (files, total, MOK_REQ_ENROLL_MOK,
 						 pw_hash_file, use_root_pw);
 			break;
 		case DELETE:
-			ret = issue_mok_request (files, total, DELETE_MOK,
+			ret = issue_mok_request (files, total, MOK_REQ_DELETE_MOK,
 						 pw_hash_file, use_root_pw);
 			break;
 		case IMPORT_HASH:
-			ret = issue_hash_request (hash_str, ENROLL_MOK,
+			ret = issue_hash_request (hash_str, MOK_REQ_ENROLL_MOK,
 						  pw_hash_file, use_root_pw);
 			break;
 		case DELETE_HASH:
-			ret = issue_hash_request (hash_str, DELETE_MOK,
+			ret = issue_hash_request (hash_str, MOK_REQ_DELETE_MOK,
 						  pw_hash_file, use_root_pw);
 			break;
 		case REVOKE_IMPORT:
-			ret = revoke_request (ENROLL_MOK);
+			ret = revoke_request (MOK_REQ_ENROLL_MOK);
 			break;
 		case REVOKE_DELETE:
-			ret = revoke_request (DELETE_MOK);
+			ret = revoke_request (MOK_REQ_DELETE_MOK);
 			break;
 		case EXPORT:
 		case EXPORT | MOKX:
-			ret = export_db_keys (db_name);
+			ret = export_db_keys (db_name, export_format,
+					      output_file);
 			break;
 		case PASSWORD:
 			ret = set_password (pw_hash_file, use_root_pw, 0);
@@ -2173,14 +5727,21 @@ main (int argc, char *argv[])
 			ret = sb_state ();
 			break;
 		case TEST_KEY:
-			ret = test_key (ENROLL_MOK, key_file);
+			ret = run_test_key (MOK_REQ_ENROLL_MOK, files, total,
+					    offline_file, json);
 			break;
 		case RESET:
-			ret = reset_moks (ENROLL_MOK, pw_hash_file, use_root_pw);
+			ret = reset_moks (MOK_REQ_ENROLL_MOK, pw_hash_file, use_root_pw);
 			break;
 		case GENERATE_PW_HASH:
 			ret = generate_pw_hash (input_pw);
 			break;
+		case GENERATE_PW_HASH_BATCH:
+			ret = generate_pw_hash_batch (pw_batch_file);
+			break;
+		case VERIFY_PASSWORD:
+			ret = verify_password ();
+			break;
 		case IGNORE_DB:
 			ret = disable_db ();
 			break;
@@ -2200,32 +5761,34 @@ main (int argc, char *argv[])
 			ret = list_keys_in_var ("MokXDel", efi_guid_shim);
 			break;
 		case IMPORT | MOKX:
-			ret = issue_mok_request (files, total, ENROLL_BLACKLIST,
+			ret = issue_mok_request (files, total, MOK_REQ_ENROLL_BLACKLIST,
 						 pw_hash_file, use_root_pw);
 			break;
 		case DELETE | MOKX:
-			ret = issue_mok_request (files, total, DELETE_BLACKLIST,
+			ret = issue_mok_request (files, total, MOK_REQ_DELETE_BLACKLIST,
 						 pw_hash_file, use_root_pw);
 			break;
 		case IMPORT_HASH | MOKX:
-			ret = issue_hash_request (hash_str, ENROLL_BLACKLIST,
+			ret = issue_hash_request (hash_str, MOK_REQ_ENROLL_BLACKLIST,
 						  pw_hash_file, use_root_pw);
 			break;
 		case DELETE_HASH | MOKX:
-			ret = issue_hash_request (hash_str, DELETE_BLACKLIST,
+			ret = issue_hash_request (hash_str, MOK_REQ_DELETE_BLACKLIST,
 						  pw_hash_file, use_root_pw);
 			break;
 		case REVOKE_IMPORT | MOKX:
-			ret = revoke_request (ENROLL_BLACKLIST);
+			ret = revoke_request (MOK_REQ_ENROLL_BLACKLIST);
 			break;
 		case REVOKE_DELETE | MOKX:
-			ret = revoke_request (DELETE_BLACKLIST);
+			ret = revoke_request (MOK_REQ_DELETE_BLACKLIST);
 			break;
 		case RESET | MOKX:
-			ret = reset_moks (ENROLL_BLACKLIST, pw_hash_file, use_root_pw);
+			ret = reset_moks (MOK_REQ_ENROLL_BLACKLIST, pw_hash_file,
+					  use_root_pw);
 			break;
 		case TEST_KEY | MOKX:
-			ret = test_key (ENROLL_BLACKLIST, key_file);
+			ret = run_test_key (MOK_REQ_ENROLL_BLACKLIST, files, total,
+					    offline_file, json);
 			break;
 		case VERBOSITY:
 			ret = set_verbosity (verbosity);
@@ -2245,6 +5808,30 @@ main (int argc, char *argv[])
 		case SET_SBAT:
 			ret = manage_sbat(sbat_policy);
 			break;
+		case CHECK_EXPIRY:
+			ret = check_cert_expiry (expiry_days);
+			break;
+		case DAEMON:
+			ret = run_daemon (socket_path, handle_daemon_request,
+					  NULL);
+			break;
+		case COMPACT:
+			ret = compact_request (MOK_REQ_ENROLL_MOK, MOK_REQ_DELETE_MOK);
+			break;
+		case COMPACT | MOKX:
+			ret = compact_request (MOK_REQ_ENROLL_BLACKLIST,
+					       MOK_REQ_DELETE_BLACKLIST);
+			break;
+		case DBX_UPDATE_CHECK:
+			ret = check_dbx_update (update_file, offline_file,
+						output_file);
+			break;
+		case CHECK_EVENTLOG:
+			ret = check_eventlog (eventlog_file);
+			break;
+		case PREDICT_PCR7:
+			ret = predict_pcr7 (eventlog_file);
+			break;
 		default:
 			print_help ();
 			break;
@@ -2260,8 +5847,29 @@ out:
 	if (timeout)
 		free (timeout);
 
-	if (key_file)
-		free (key_file);
+	if (offline_file)
+		free (offline_file);
+
+	if (update_file)
+		free (update_file);
+
+	if (output_file)
+		free (output_file);
+
+	if (socket_path)
+		free (socket_path);
+
+	if (pw_batch_file)
+		free (pw_batch_file);
+
+	if (eventlog_file)
+		free (eventlog_file);
+
+	if (audit_file)
+		free (audit_file);
+
+	if (capture_file)
+		free (capture_file);
 
 	if (pw_hash_file)
 		free (pw_hash_file);
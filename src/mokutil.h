@@ -35,19 +35,13 @@
 #include <ctype.h>
 #include <wchar.h>
 
+#include "libmokutil.h"
 #include "signature.h"
 
 typedef unsigned long efi_status_t;
 typedef uint8_t efi_bool_t;
 typedef wchar_t efi_char16_t;		/* UNICODE character */
 
-typedef enum {
-	DELETE_MOK = 0,
-	ENROLL_MOK,
-	DELETE_BLACKLIST,
-	ENROLL_BLACKLIST,
-} MokRequest;
-
 typedef enum {
 	MOK_LIST_RT = 0,
 	MOK_LIST_X_RT,
@@ -55,8 +49,25 @@ typedef enum {
 	KEK,
 	DB,
 	DBX,
+	DBR,
+	DBT,
+	PK_DEFAULT,
+	KEK_DEFAULT,
+	DB_DEFAULT,
+	DBX_DEFAULT,
+	DBR_DEFAULT,
+	DBT_DEFAULT,
+	DB_NAME_NUM,
 } DBName;
 
+typedef struct {
+	const char       *var_name;
+	const efi_guid_t *guid;
+	const char       *friendly_name;
+	const char       *option;	/* the long option selecting the database */
+	int               multi_part;	/* split into VarName, VarName1... */
+} DBInfo;
+
 typedef struct {
 	EFI_SIGNATURE_LIST *header;
 	uint32_t            mok_size;
@@ -30,7 +30,7 @@
  */
 #include <string.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <sys/random.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <openssl/md5.h>
@@ -67,15 +67,13 @@ static int restore_sha512_array (const char *string, uint8_t *hash);
 static uint16_t
 gen_salt_size (uint16_t min, uint16_t max)
 {
-	struct timeval tv;
-	uint16_t diff;
+	uint16_t rand_num;
 
-	(void) gettimeofday (&tv, NULL);
-	srandom (tv.tv_sec ^ tv.tv_usec ^ getpid ());
+	/* Fall back to the longest salt if the kernel CSPRNG fails */
+	if (getrandom (&rand_num, sizeof (rand_num), 0) != sizeof (rand_num))
+		return max;
 
-	diff = random () % (max - min + 1);
-
-	return (min + diff);
+	return (min + rand_num % (max - min + 1));
 }
 
 uint16_t
@@ -41,6 +41,10 @@
 #define SHA512_SALT_MAX 16
 #define BLOWFISH_SALT_MAX 22
 
+/* The rounds accepted by the SHA-256 and SHA-512 based methods */
+#define SHA_ROUNDS_MIN 1000
+#define SHA_ROUNDS_MAX 999999999
+
 typedef enum {
 	TRADITIONAL_DES = 0,
 	EXTEND_BSDI_DES,
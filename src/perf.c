@@ -0,0 +1,263 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "perf.h"
+#include "util.h"
+
+typedef struct {
+	PerfEvent     event;
+	uint64_t      start;
+	uint64_t      duration;
+	size_t        bytes;
+	unsigned long tid;
+	char         *detail;
+} PerfRecord;
+
+typedef struct {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t time;
+} PerfCounter;
+
+static const char *event_names[] = {
+	[PERF_VAR_READ]   = "var-read",
+	[PERF_VAR_WRITE]  = "var-write",
+	[PERF_BUILD_LIST] = "build-list",
+	[PERF_X509_PARSE] = "x509-parse",
+	[PERF_CA_CHECK]   = "ca-check",
+	[PERF_KEYRING]    = "keyring",
+	[PERF_CRYPT]      = "crypt",
+};
+
+static int perf_enabled;
+static uint64_t perf_origin;
+static char *perf_trace_file;
+static PerfCounter counters[PERF_EVENT_NUM];
+static PerfRecord *records;
+static size_t record_num;
+static size_t record_alloced;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t
+perf_clock (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Start counting. The trace file is written by perf_report() if given. */
+int
+perf_enable (const char *trace_file)
+{
+	if (trace_file) {
+		perf_trace_file = strdup (trace_file);
+		if (!perf_trace_file)
+			return -1;
+	}
+
+	perf_origin = perf_clock ();
+	perf_enabled = 1;
+
+	return 0;
+}
+
+/* Return 0 when disabled so that perf_stop() ignores the call */
+uint64_t
+perf_start (void)
+{
+	if (!perf_enabled)
+		return 0;
+
+	return perf_clock ();
+}
+
+static void
+add_record (const PerfEvent event, const uint64_t start,
+	    const uint64_t duration, const size_t bytes, const char *detail)
+{
+	PerfRecord *new_records;
+	PerfRecord *record;
+
+	pthread_mutex_lock (&record_lock);
+
+	if (record_num == record_alloced) {
+		size_t alloced = record_alloced ? record_alloced * 2 : 256;
+
+		new_records = realloc (records, alloced * sizeof(PerfRecord));
+		if (!new_records)
+			goto out;
+		records = new_records;
+		record_alloced = alloced;
+	}
+
+	record = &records[record_num++];
+	record->event = event;
+	record->start = start - perf_origin;
+	record->duration = duration;
+	record->bytes = bytes;
+	record->tid = syscall (SYS_gettid);
+	record->detail = detail ? strdup (detail) : NULL;
+out:
+	pthread_mutex_unlock (&record_lock);
+}
+
+void
+perf_stop (const PerfEvent event, const uint64_t start, const size_t bytes,
+	   const char *detail)
+{
+	uint64_t duration;
+
+	if (!perf_enabled || start == 0)
+		return;
+
+	duration = perf_clock () - start;
+
+	__atomic_fetch_add (&counters[event].calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&counters[event].bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&counters[event].time, duration, __ATOMIC_RELAXED);
+
+	if (perf_trace_file)
+		add_record (event, start, duration, bytes, detail);
+}
+
+static void
+print_summary (const uint64_t total)
+{
+	struct rusage usage;
+
+	fprintf (stderr, "\n%-12s %8s %12s %12s %12s\n",
+		 "Event", "Calls", "Bytes", "Time (ms)", "Avg (us)");
+	for (unsigned int i = 0; i < PERF_EVENT_NUM; i++) {
+		const PerfCounter *counter = &counters[i];
+
+		if (counter->calls == 0)
+			continue;
+
+		fprintf (stderr, "%-12s %8"PRIu64" %12"PRIu64" %12.3f %12.1f\n",
+			 event_names[i], counter->calls, counter->bytes,
+			 counter->time / 1e6,
+			 counter->time / 1e3 / counter->calls);
+	}
+
+	fprintf (stderr, "Wall time: %.3f ms\n", total / 1e6);
+
+	if (getrusage (RUSAGE_SELF, &usage) == 0) {
+		fprintf (stderr, "User time: %.3f ms, system time: %.3f ms\n",
+			 usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3,
+			 usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3);
+		fprintf (stderr, "Context switches: %ld voluntary, %ld involuntary\n",
+			 usage.ru_nvcsw, usage.ru_nivcsw);
+	}
+}
+
+/* Write the records in the Chrome trace event format */
+static int
+write_trace (const uint64_t total)
+{
+	FILE *out;
+	const pid_t pid = getpid ();
+
+	out = fopen (perf_trace_file, "w");
+	if (!out) {
+		fprintf (stderr, "Failed to open %s: %m\n", perf_trace_file);
+		return -1;
+	}
+
+	fprintf (out, "{\"traceEvents\": [\n");
+	fprintf (out, "{\"name\": \"mokutil\", \"cat\": \"mokutil\", \"ph\": \"X\", "
+		 "\"ts\": 0, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+		 total / 1e3, pid, pid);
+
+	for (size_t i = 0; i < record_num; i++) {
+		const PerfRecord *record = &records[i];
+
+		fprintf (out, ",\n{\"name\": \"%s\", \"cat\": \"mokutil\", "
+			 "\"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+			 "\"pid\": %d, \"tid\": %lu, \"args\": {\"bytes\": %zu",
+			 event_names[record->event], record->start / 1e3,
+			 record->duration / 1e3, pid, record->tid,
+			 record->bytes);
+		if (record->detail) {
+			fprintf (out, ", \"detail\": ");
+			json_print_string (out, record->detail);
+		}
+		fprintf (out, "}}");
+	}
+
+	fprintf (out, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+	if (fclose (out) != 0) {
+		fprintf (stderr, "Failed to write %s: %m\n", perf_trace_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Print the counters and write the trace. This is meant for atexit(). */
+void
+perf_report (void)
+{
+	uint64_t total;
+
+	if (!perf_enabled)
+		return;
+
+	perf_enabled = 0;
+	total = perf_clock () - perf_origin;
+
+	print_summary (total);
+
+	if (perf_trace_file)
+		write_trace (total);
+
+	for (size_t i = 0; i < record_num; i++)
+		free (records[i].detail);
+	free (records);
+	records = NULL;
+	record_num = 0;
+	record_alloced = 0;
+
+	free (perf_trace_file);
+	perf_trace_file = NULL;
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+	PERF_VAR_READ = 0,
+	PERF_VAR_WRITE,
+	PERF_BUILD_LIST,
+	PERF_X509_PARSE,
+	PERF_CA_CHECK,
+	PERF_KEYRING,
+	PERF_CRYPT,
+	PERF_EVENT_NUM,
+} PerfEvent;
+
+uint64_t perf_clock (void);
+int perf_enable (const char *trace_file);
+uint64_t perf_start (void);
+void perf_stop (const PerfEvent event, const uint64_t start,
+		const size_t bytes, const char *detail);
+void perf_report (void);
+
+#endif /* __PERF_H__ */
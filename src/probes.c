@@ -0,0 +1,46 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "probes.h"
+
+#ifdef HAVE_SYS_SDT_H
+
+/* The tracers count themselves in the semaphores of the enabled probes */
+#define DEFINE_SEMAPHORE(name) \
+	unsigned short PROBE_SEMAPHORE(name) __attribute__ ((section (".probes")))
+
+DEFINE_SEMAPHORE(var__read);
+DEFINE_SEMAPHORE(var__write);
+DEFINE_SEMAPHORE(esl__parse);
+DEFINE_SEMAPHORE(hash__match);
+DEFINE_SEMAPHORE(x509__verify);
+DEFINE_SEMAPHORE(keyring__lookup);
+
+#endif /* HAVE_SYS_SDT_H */
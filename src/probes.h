@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "perf.h"
+
+/*
+ * USDT probes of the "mokutil" provider, e.g. for bpftrace:
+ *
+ *   bpftrace -e 'usdt:/usr/bin/mokutil:mokutil:var-read
+ *                { printf("%s %d\n", str(arg0), arg3); }'
+ *
+ * Each probe is a nop until a tracer attaches. The latency arguments are
+ * only measured while the semaphore of the probe is set by the tracer.
+ */
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) mokutil_##name##_semaphore
+#define PROBE_ENABLED(name) __builtin_expect (PROBE_SEMAPHORE(name) != 0, 0)
+
+#define PROBE2(name, a, b) STAP_PROBE2(mokutil, name, a, b)
+#define PROBE4(name, a, b, c, d) STAP_PROBE4(mokutil, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) STAP_PROBE5(mokutil, name, a, b, c, d, e)
+
+extern unsigned short PROBE_SEMAPHORE(var__read);
+extern unsigned short PROBE_SEMAPHORE(var__write);
+extern unsigned short PROBE_SEMAPHORE(esl__parse);
+extern unsigned short PROBE_SEMAPHORE(hash__match);
+extern unsigned short PROBE_SEMAPHORE(x509__verify);
+extern unsigned short PROBE_SEMAPHORE(keyring__lookup);
+
+#else
+
+#define PROBE_ENABLED(name) 0
+
+#define PROBE2(name, a, b) \
+	do { if (0) { (void)(a); (void)(b); } } while (0)
+#define PROBE4(name, a, b, c, d) \
+	do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); } } while (0)
+#define PROBE5(name, a, b, c, d, e) \
+	do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); } } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+/* The start time for a latency argument, or 0 if nobody is listening */
+#define PROBE_START(name) (PROBE_ENABLED (name) ? perf_clock () : 0)
+#define PROBE_ELAPSED(start) ((start) ? perf_clock () - (start) : 0)
+
+#endif /* __PROBES_H__ */
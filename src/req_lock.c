@@ -0,0 +1,314 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "req_lock.h"
+
+/*
+ * Several mokutil instances may modify the request variables at the same
+ * time. The read-modify-write of a request variable is serialized with an
+ * advisory lock, and the additions waiting for the lock are queued in the
+ * spool directory so that the holder of the lock commits all of them in one
+ * write. A spool file is named after the variable, the time it was queued
+ * and the PID of the queuing process:
+ *
+ *     REQ_SPOOL_DIR/<variable>.<nanoseconds>.<pid>
+ */
+
+/* Take the lock for the request variables. Return the fd or -1. */
+int
+lock_requests (void)
+{
+	int fd;
+
+	fd = open (REQ_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC,
+		   S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to open %s: %m\n", REQ_LOCK_FILE);
+		return -1;
+	}
+
+	if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+		return fd;
+
+	if (errno == EWOULDBLOCK) {
+		fprintf (stderr, "Waiting for another mokutil to finish...\n");
+		if (flock (fd, LOCK_EX) == 0)
+			return fd;
+	}
+
+	fprintf (stderr, "Failed to lock %s: %m\n", REQ_LOCK_FILE);
+	close (fd);
+
+	return -1;
+}
+
+void
+unlock_requests (const int fd)
+{
+	if (fd < 0)
+		return;
+
+	flock (fd, LOCK_UN);
+	close (fd);
+}
+
+static int
+write_all (const int fd, const void *data, const size_t data_size)
+{
+	size_t offset = 0;
+	ssize_t write_size;
+
+	while (offset < data_size) {
+		write_size = write (fd, data + offset, data_size - offset);
+		if (write_size < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		offset += write_size;
+	}
+
+	return 0;
+}
+
+/* Queue the signature lists to add to the variable */
+int
+spool_add (const char *var_name, const void *data, const size_t data_size,
+	   char **pathp)
+{
+	char path[PATH_MAX], tmp_path[PATH_MAX + 4];
+	struct timespec now;
+	int fd;
+
+	if (mkdir (REQ_SPOOL_DIR, S_IRWXU) < 0 && errno != EEXIST) {
+		fprintf (stderr, "Failed to create %s: %m\n", REQ_SPOOL_DIR);
+		return -1;
+	}
+
+	clock_gettime (CLOCK_REALTIME, &now);
+	snprintf (path, sizeof(path), "%s/%s.%020llu.%d", REQ_SPOOL_DIR,
+		  var_name, (unsigned long long)now.tv_sec * 1000000000ULL +
+		  now.tv_nsec, (int)getpid ());
+	snprintf (tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		   S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to create %s: %m\n", tmp_path);
+		return -1;
+	}
+
+	if (write_all (fd, data, data_size) < 0) {
+		fprintf (stderr, "Failed to write %s: %m\n", tmp_path);
+		close (fd);
+		unlink (tmp_path);
+		return -1;
+	}
+	close (fd);
+
+	/* Only show complete files to the other instances */
+	if (rename (tmp_path, path) < 0) {
+		fprintf (stderr, "Failed to rename %s: %m\n", tmp_path);
+		unlink (tmp_path);
+		return -1;
+	}
+
+	*pathp = strdup (path);
+	if (!*pathp) {
+		unlink (path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+read_spool_file (const char *path, uint8_t **datap, size_t *data_sizep)
+{
+	struct stat buf;
+	uint8_t *data;
+	size_t offset = 0;
+	ssize_t read_size;
+	int fd;
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat (fd, &buf) < 0 || buf.st_size <= 0) {
+		close (fd);
+		return -1;
+	}
+
+	data = malloc (buf.st_size);
+	if (!data) {
+		close (fd);
+		return -1;
+	}
+
+	while (offset < (size_t)buf.st_size) {
+		read_size = read (fd, data + offset, buf.st_size - offset);
+		if (read_size < 0 && errno == EINTR)
+			continue;
+		if (read_size <= 0) {
+			free (data);
+			close (fd);
+			return -1;
+		}
+		offset += read_size;
+	}
+	close (fd);
+
+	*datap = data;
+	*data_sizep = offset;
+
+	return 0;
+}
+
+/* Whether the process which queued the spool file is still running */
+static int
+is_spool_alive (const char *name)
+{
+	const char *pid_str = strrchr (name, '.');
+	long pid;
+
+	if (!pid_str)
+		return 0;
+
+	pid = strtol (pid_str + 1, NULL, 10);
+	if (pid <= 0)
+		return 0;
+
+	return kill (pid, 0) == 0 || errno == EPERM;
+}
+
+/*
+ * Load the queued additions to the variable in the order they were queued.
+ * The spool files left by the processes which died are removed. The caller
+ * must hold the lock.
+ */
+int
+spool_collect (const char *var_name, SpoolEntry **entriesp,
+	       unsigned int *entry_nump)
+{
+	struct dirent **dents;
+	SpoolEntry *entries = NULL, *entries_new;
+	unsigned int entry_num = 0;
+	char path[PATH_MAX];
+	size_t name_len = strlen (var_name);
+	int dent_num, ret = 0;
+
+	*entriesp = NULL;
+	*entry_nump = 0;
+
+	dent_num = scandir (REQ_SPOOL_DIR, &dents, NULL, alphasort);
+	if (dent_num < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	for (int i = 0; i < dent_num; i++) {
+		const char *name = dents[i]->d_name;
+		SpoolEntry *entry;
+
+		if (ret < 0 || strncmp (name, var_name, name_len) != 0 ||
+		    name[name_len] != '.' ||
+		    strcmp (name + strlen (name) - 4, ".tmp") == 0)
+			goto next;
+
+		snprintf (path, sizeof(path), "%s/%s", REQ_SPOOL_DIR, name);
+		if (!is_spool_alive (name)) {
+			unlink (path);
+			goto next;
+		}
+
+		entries_new = realloc (entries, (entry_num + 1) * sizeof(SpoolEntry));
+		if (!entries_new) {
+			ret = -1;
+			goto next;
+		}
+		entries = entries_new;
+		entry = &entries[entry_num];
+
+		if (read_spool_file (path, &entry->data, &entry->data_size) < 0)
+			goto next;
+
+		entry->path = strdup (path);
+		if (!entry->path) {
+			free (entry->data);
+			ret = -1;
+			goto next;
+		}
+		entry_num++;
+next:
+		free (dents[i]);
+	}
+	free (dents);
+
+	if (ret < 0) {
+		spool_free (entries, entry_num);
+		return -1;
+	}
+
+	*entriesp = entries;
+	*entry_nump = entry_num;
+
+	return 0;
+}
+
+/* Drop the spool files after their content is committed */
+void
+spool_remove (SpoolEntry *entries, const unsigned int entry_num)
+{
+	for (unsigned int i = 0; i < entry_num; i++)
+		unlink (entries[i].path);
+}
+
+void
+spool_free (SpoolEntry *entries, const unsigned int entry_num)
+{
+	for (unsigned int i = 0; i < entry_num; i++) {
+		free (entries[i].path);
+		free (entries[i].data);
+	}
+	free (entries);
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __REQ_LOCK_H__
+#define __REQ_LOCK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REQ_LOCK_FILE "/run/mokutil.lock"
+#define REQ_SPOOL_DIR "/run/mokutil"
+
+typedef struct {
+	char    *path;
+	uint8_t *data;
+	size_t   data_size;
+} SpoolEntry;
+
+int lock_requests (void);
+void unlock_requests (const int fd);
+int spool_add (const char *var_name, const void *data, const size_t data_size,
+	       char **pathp);
+int spool_collect (const char *var_name, SpoolEntry **entriesp,
+		   unsigned int *entry_nump);
+void spool_remove (SpoolEntry *entries, const unsigned int entry_num);
+void spool_free (SpoolEntry *entries, const unsigned int entry_num);
+
+#endif /* __REQ_LOCK_H__ */
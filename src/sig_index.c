@@ -0,0 +1,371 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "efi_hash.h"
+#include "probes.h"
+#include "sig_index.h"
+#include "util.h"
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME        16777619U
+
+static uint32_t
+hash_signature (const efi_guid_t *type, const uint8_t *data,
+		const uint32_t data_size)
+{
+	const uint8_t *type_bytes = (const uint8_t *)type;
+	uint32_t hash = FNV_OFFSET_BASIS;
+
+	for (unsigned int i = 0; i < sizeof(efi_guid_t); i++)
+		hash = (hash ^ type_bytes[i]) * FNV_PRIME;
+	for (uint32_t i = 0; i < data_size; i++)
+		hash = (hash ^ data[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+void
+sig_index_init (SigIndex *index)
+{
+	memset (index, 0, sizeof(SigIndex));
+}
+
+void
+sig_index_free (SigIndex *index)
+{
+	free (index->entries);
+	free (index->slots);
+	memset (index, 0, sizeof(SigIndex));
+}
+
+static int
+lookup_slot (const SigIndex *index, const efi_guid_t *type,
+	     const void *data, const uint32_t data_size,
+	     const uint32_t hash, uint32_t *slot)
+{
+	const SigEntry *entry;
+	uint32_t i;
+
+	if (!index->slots)
+		return -1;
+
+	for (i = hash & index->slot_mask; index->slots[i] != 0;
+	     i = (i + 1) & index->slot_mask) {
+		entry = &index->entries[index->slots[i] - 1];
+		if (entry->hash == hash && entry->data_size == data_size &&
+		    efi_guid_cmp (&entry->type, type) == 0 &&
+		    memcmp (entry->data, data, data_size) == 0) {
+			*slot = i;
+			return index->slots[i] - 1;
+		}
+	}
+
+	*slot = i;
+	return -1;
+}
+
+static int
+fill_slots (SigIndex *index, const uint32_t slot_num)
+{
+	uint32_t *slots;
+	uint32_t i;
+
+	slots = calloc (slot_num, sizeof(uint32_t));
+	if (!slots)
+		return -1;
+
+	for (uint32_t n = 0; n < index->entry_num; n++) {
+		for (i = index->entries[n].hash & (slot_num - 1); slots[i] != 0;
+		     i = (i + 1) & (slot_num - 1));
+		slots[i] = n + 1;
+	}
+
+	free (index->slots);
+	index->slots = slots;
+	index->slot_mask = slot_num - 1;
+
+	return 0;
+}
+
+static int
+grow_slots (SigIndex *index)
+{
+	return fill_slots (index, index->slots ? (index->slot_mask + 1) * 2 : 64);
+}
+
+/**
+ * Add a signature to the index. The data is not copied, so it must stay
+ * valid as long as the index is used.
+ *
+ * Return value:
+ * -  1 : Added
+ * -  0 : Already in the index
+ * - -1 : Error
+ */
+int
+sig_index_add (SigIndex *index, const efi_guid_t *type,
+	       const efi_guid_t *owner, const void *data,
+	       const uint32_t data_size)
+{
+	SigEntry *entries, *entry;
+	uint32_t hash, slot;
+
+	hash = hash_signature (type, data, data_size);
+	if (lookup_slot (index, type, data, data_size, hash, &slot) >= 0)
+		return 0;
+
+	/* Keep the load factor under 1/2 */
+	if (!index->slots || (index->entry_num + 1) * 2 > index->slot_mask + 1) {
+		if (grow_slots (index) < 0)
+			return -1;
+		lookup_slot (index, type, data, data_size, hash, &slot);
+	}
+
+	if (index->entry_num == index->entry_alloced) {
+		index->entry_alloced = index->entry_alloced ?
+				       index->entry_alloced * 2 : 32;
+		entries = realloc (index->entries,
+				   index->entry_alloced * sizeof(SigEntry));
+		if (!entries)
+			return -1;
+		index->entries = entries;
+	}
+
+	entry = &index->entries[index->entry_num];
+	entry->type = *type;
+	entry->owner = *owner;
+	entry->data = data;
+	entry->data_size = data_size;
+	entry->hash = hash;
+	index->slots[slot] = ++index->entry_num;
+
+	return 1;
+}
+
+/* Index all certificates and hashes in the signature lists. Return the
+ * number of the new entries or -1 with errno set for error, EINVAL if the
+ * lists are corrupted */
+int
+sig_index_add_esl (SigIndex *index, const void *esl, const size_t esl_size)
+{
+	MokListNode *list;
+	uint32_t mok_num, sig_size;
+	efi_guid_t owner;
+	const uint8_t *sig;
+	int added = 0, ret;
+
+	if (!esl || esl_size == 0)
+		return 0;
+
+	list = build_mok_list (esl, esl_size, &mok_num);
+	if (list == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < mok_num; i++) {
+		efi_guid_t sigtype = list[i].header->SignatureType;
+
+		if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) == 0) {
+			sig = (const uint8_t *)list[i].mok - sizeof(efi_guid_t);
+			memcpy (&owner, sig, sizeof(efi_guid_t));
+			ret = sig_index_add (index, &sigtype, &owner,
+					     list[i].mok, list[i].mok_size);
+			if (ret < 0)
+				goto error;
+			added += ret;
+			continue;
+		}
+
+		/* The whole entry, which may hold more than the digest */
+		sig_size = signature_size (&sigtype);
+		sig = list[i].mok;
+		for (uint32_t n = 0; n < list[i].mok_size / sig_size; n++) {
+			memcpy (&owner, sig, sizeof(efi_guid_t));
+			ret = sig_index_add (index, &sigtype, &owner,
+					     sig + sizeof(efi_guid_t),
+					     sig_size - sizeof(efi_guid_t));
+			if (ret < 0)
+				goto error;
+			added += ret;
+			sig += sig_size;
+		}
+	}
+
+	free (list);
+	return added;
+error:
+	free (list);
+	return -1;
+}
+
+/* Return the index of the matched entry or -1 if not found */
+int
+sig_index_find (const SigIndex *index, const efi_guid_t *type,
+		const void *data, const uint32_t data_size)
+{
+	uint32_t slot;
+	int ret;
+
+	ret = lookup_slot (index, type, data, data_size,
+			   hash_signature (type, data, data_size), &slot);
+	PROBE4 (hash__match, type, data, data_size, ret);
+
+	return ret;
+}
+
+static int
+compare_entry (const void *a, const void *b)
+{
+	const SigEntry *entry_a = a;
+	const SigEntry *entry_b = b;
+	int ret;
+
+	ret = memcmp (&entry_a->type, &entry_b->type, sizeof(efi_guid_t));
+	if (ret != 0)
+		return ret;
+
+	if (entry_a->data_size != entry_b->data_size)
+		return entry_a->data_size < entry_b->data_size ? -1 : 1;
+
+	return memcmp (entry_a->data, entry_b->data, entry_a->data_size);
+}
+
+/* Sort the entries by the type and then the data to get a canonical order */
+int
+sig_index_sort (SigIndex *index)
+{
+	if (index->entry_num < 2)
+		return 0;
+
+	qsort (index->entries, index->entry_num, sizeof(SigEntry),
+	       compare_entry);
+
+	/* The slots point to the old positions */
+	return fill_slots (index, index->slot_mask + 1);
+}
+
+/**
+ * Serialize the index into signature lists
+ *
+ * Every certificate gets its own list while the hashes of the same type are
+ * gathered into one list at the position of the first hash of the type.
+ * The caller is responsible to free the buffer.
+ */
+int
+sig_index_to_esl (const SigIndex *index, uint8_t **eslp, size_t *esl_sizep)
+{
+	EFI_SIGNATURE_LIST *CertList;
+	const SigEntry *entry;
+	uint8_t *esl, *ptr, *done;
+	size_t esl_size = 0;
+
+	*eslp = NULL;
+	*esl_sizep = 0;
+
+	if (index->entry_num == 0)
+		return 0;
+
+	done = calloc (index->entry_num, 1);
+	if (!done)
+		return -1;
+
+	/* Calculate the size first to allocate the buffer only once */
+	for (uint32_t i = 0; i < index->entry_num; i++) {
+		entry = &index->entries[i];
+		esl_size += sizeof(efi_guid_t) + entry->data_size;
+		if (done[i])
+			continue;
+
+		/* Start a new signature list */
+		esl_size += sizeof(EFI_SIGNATURE_LIST);
+		if (efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0)
+			continue;
+
+		for (uint32_t n = i + 1; n < index->entry_num; n++) {
+			if (efi_guid_cmp (&index->entries[n].type,
+					  &entry->type) == 0)
+				done[n] = 1;
+		}
+	}
+
+	esl = malloc (esl_size);
+	if (!esl) {
+		free (done);
+		return -1;
+	}
+
+	memset (done, 0, index->entry_num);
+	ptr = esl;
+	for (uint32_t i = 0; i < index->entry_num; i++) {
+		entry = &index->entries[i];
+		if (done[i])
+			continue;
+
+		CertList = (EFI_SIGNATURE_LIST *)ptr;
+		CertList->SignatureType = entry->type;
+		CertList->SignatureHeaderSize = 0;
+		CertList->SignatureSize = sizeof(efi_guid_t) + entry->data_size;
+		CertList->SignatureListSize = sizeof(EFI_SIGNATURE_LIST);
+		ptr += sizeof(EFI_SIGNATURE_LIST);
+
+		for (uint32_t n = i; n < index->entry_num; n++) {
+			const SigEntry *sig = &index->entries[n];
+
+			if (efi_guid_cmp (&sig->type, &entry->type) != 0)
+				continue;
+
+			memcpy (ptr, &sig->owner, sizeof(efi_guid_t));
+			memcpy (ptr + sizeof(efi_guid_t), sig->data,
+				sig->data_size);
+			ptr += sizeof(efi_guid_t) + sig->data_size;
+			CertList->SignatureListSize += sizeof(efi_guid_t) +
+						       sig->data_size;
+			done[n] = 1;
+
+			/* A certificate list holds only one certificate */
+			if (efi_guid_cmp (&entry->type, &efi_guid_x509_cert) == 0)
+				break;
+		}
+	}
+
+	free (done);
+
+	*eslp = esl;
+	*esl_sizep = esl_size;
+
+	return 0;
+}
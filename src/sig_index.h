@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __SIG_INDEX_H__
+#define __SIG_INDEX_H__
+
+#include <stdint.h>
+#include <efivar.h>
+
+typedef struct {
+	efi_guid_t     type;
+	efi_guid_t     owner;
+	const uint8_t *data;		/* points into the indexed signature lists */
+	uint32_t       data_size;
+	uint32_t       hash;
+} SigEntry;
+
+typedef struct {
+	SigEntry *entries;
+	uint32_t  entry_num;
+	uint32_t  entry_alloced;
+	uint32_t *slots;		/* entry index + 1, or 0 for an empty slot */
+	uint32_t  slot_mask;
+} SigIndex;
+
+void sig_index_init (SigIndex *index);
+void sig_index_free (SigIndex *index);
+int sig_index_add (SigIndex *index, const efi_guid_t *type,
+		   const efi_guid_t *owner, const void *data,
+		   const uint32_t data_size);
+int sig_index_add_esl (SigIndex *index, const void *esl,
+		       const size_t esl_size);
+int sig_index_find (const SigIndex *index, const efi_guid_t *type,
+		    const void *data, const uint32_t data_size);
+int sig_index_sort (SigIndex *index);
+int sig_index_to_esl (const SigIndex *index, uint8_t **eslp,
+		      size_t *esl_sizep);
+
+#endif /* __SIG_INDEX_H__ */
@@ -0,0 +1,550 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "util.h"
+
+#define MOK_VARIABLES_PATH "/sys/firmware/efi/mok-variables"
+
+#define SNAPSHOT_ALIGN_UP(x) (((x) + SNAPSHOT_ALIGN - 1) & ~((uint64_t)SNAPSHOT_ALIGN - 1))
+
+typedef struct {
+	char       *name;
+	efi_guid_t  guid;
+	uint32_t    source;
+	uint32_t    attributes;
+	uint8_t    *data;
+	size_t      data_size;
+	int         error;		/* errno of the failed read, or 0 */
+} CapturedVar;
+
+typedef struct {
+	CapturedVar  *vars;
+	unsigned int  var_num;
+} Capture;
+
+static int
+compare_key (const char *name_a, const efi_guid_t *guid_a,
+	     const uint32_t source_a, const char *name_b,
+	     const efi_guid_t *guid_b, const uint32_t source_b)
+{
+	int ret;
+
+	ret = strcmp (name_a, name_b);
+	if (ret != 0)
+		return ret;
+	ret = memcmp (guid_a, guid_b, sizeof(efi_guid_t));
+	if (ret != 0)
+		return ret;
+
+	return (source_a > source_b) - (source_a < source_b);
+}
+
+static int
+compare_captured_var (const void *a, const void *b)
+{
+	const CapturedVar *va = a, *vb = b;
+
+	return compare_key (va->name, &va->guid, va->source,
+			    vb->name, &vb->guid, vb->source);
+}
+
+static int
+add_captured_var (Capture *cap, const char *name, const efi_guid_t *guid,
+		  const uint32_t source)
+{
+	CapturedVar *vars_new;
+
+	vars_new = realloc (cap->vars, (cap->var_num + 1) * sizeof(CapturedVar));
+	if (!vars_new)
+		return -1;
+	cap->vars = vars_new;
+
+	memset (&cap->vars[cap->var_num], 0, sizeof(CapturedVar));
+	cap->vars[cap->var_num].name = strdup (name);
+	if (!cap->vars[cap->var_num].name)
+		return -1;
+	cap->vars[cap->var_num].guid = *guid;
+	cap->vars[cap->var_num].source = source;
+	cap->var_num++;
+
+	return 0;
+}
+
+/* List the variables of shim and Secure Boot without reading them yet */
+static int
+enumerate_vars (Capture *cap)
+{
+	const efi_guid_t *vendors[] = {
+		&efi_guid_shim,
+		&efi_guid_global,
+		&efi_guid_security,
+	};
+	efi_guid_t *guid = NULL;
+	char *name = NULL;
+	struct dirent *entry;
+	DIR *dir;
+	int rc;
+
+	while ((rc = efi_get_next_variable_name (&guid, &name)) > 0) {
+		for (unsigned int i = 0; i < sizeof(vendors)/sizeof(vendors[0]); i++) {
+			if (efi_guid_cmp (guid, vendors[i]) != 0)
+				continue;
+			if (add_captured_var (cap, name, guid,
+					      SNAPSHOT_SRC_EFIVARFS) < 0)
+				return -1;
+			break;
+		}
+	}
+	if (rc < 0) {
+		fprintf (stderr, "Failed to list the EFI variables: %m\n");
+		return -1;
+	}
+
+	/* shim exports the complete MOK lists here since 15.3 */
+	dir = opendir (MOK_VARIABLES_PATH);
+	if (!dir)
+		return 0;
+
+	while ((entry = readdir (dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (add_captured_var (cap, entry->d_name, &efi_guid_shim,
+				      SNAPSHOT_SRC_MOK_SYSFS) < 0) {
+			closedir (dir);
+			return -1;
+		}
+	}
+	closedir (dir);
+
+	return 0;
+}
+
+static void
+read_captured_var (const unsigned int index, void *data)
+{
+	Capture *cap = data;
+	CapturedVar *var = &cap->vars[index];
+	int ret;
+
+	if (var->source == SNAPSHOT_SRC_MOK_SYSFS)
+		ret = mok_get_variable (var->name, &var->data,
+					&var->data_size);
+	else
+		ret = get_efi_variable (var->guid, var->name, &var->data,
+					&var->data_size, &var->attributes);
+	if (ret < 0) {
+		var->error = errno ? errno : EIO;
+		var->data = NULL;
+		var->data_size = 0;
+	}
+}
+
+static int
+write_padding (FILE *out, const uint64_t offset)
+{
+	static const uint8_t zero[SNAPSHOT_ALIGN];
+	size_t pad = SNAPSHOT_ALIGN_UP (offset) - offset;
+
+	return fwrite (zero, 1, pad, out) == pad ? 0 : -1;
+}
+
+static int
+write_snapshot (FILE *out, const Capture *cap, const unsigned int entry_num)
+{
+	SnapshotHeader header;
+	SnapshotEntry entry;
+	uint64_t name_offset, data_offset, offset;
+	const CapturedVar *var;
+
+	memset (&header, 0, sizeof(header));
+	memcpy (header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.entry_num = entry_num;
+	header.entry_size = sizeof(SnapshotEntry);
+	header.toc_offset = SNAPSHOT_ALIGN_UP (sizeof(SnapshotHeader));
+	header.created = time (NULL);
+
+	if (fwrite (&header, sizeof(header), 1, out) != 1 ||
+	    write_padding (out, sizeof(header)) < 0)
+		return -1;
+
+	/* The names follow the table, and the data follows the names */
+	name_offset = header.toc_offset + (uint64_t)entry_num * sizeof(SnapshotEntry);
+	data_offset = name_offset;
+	for (unsigned int i = 0; i < cap->var_num; i++) {
+		if (!cap->vars[i].error)
+			data_offset += strlen (cap->vars[i].name) + 1;
+	}
+	data_offset = SNAPSHOT_ALIGN_UP (data_offset);
+
+	for (unsigned int i = 0; i < cap->var_num; i++) {
+		var = &cap->vars[i];
+		if (var->error)
+			continue;
+
+		memset (&entry, 0, sizeof(entry));
+		entry.guid = var->guid;
+		entry.attributes = var->attributes;
+		entry.source = var->source;
+		entry.name_offset = name_offset;
+		entry.data_offset = data_offset;
+		entry.data_size = var->data_size;
+		if (fwrite (&entry, sizeof(entry), 1, out) != 1)
+			return -1;
+
+		name_offset += strlen (var->name) + 1;
+		data_offset = SNAPSHOT_ALIGN_UP (data_offset + var->data_size);
+	}
+
+	for (unsigned int i = 0; i < cap->var_num; i++) {
+		if (cap->vars[i].error)
+			continue;
+		if (fwrite (cap->vars[i].name, 1, strlen (cap->vars[i].name) + 1,
+			    out) != strlen (cap->vars[i].name) + 1)
+			return -1;
+	}
+	if (write_padding (out, name_offset) < 0)
+		return -1;
+
+	offset = SNAPSHOT_ALIGN_UP (name_offset);
+	for (unsigned int i = 0; i < cap->var_num; i++) {
+		var = &cap->vars[i];
+		if (var->error)
+			continue;
+		if (var->data_size &&
+		    fwrite (var->data, 1, var->data_size, out) != var->data_size)
+			return -1;
+		offset += var->data_size;
+		if (write_padding (out, offset) < 0)
+			return -1;
+		offset = SNAPSHOT_ALIGN_UP (offset);
+	}
+
+	return 0;
+}
+
+/**
+ * Capture the variables of shim and Secure Boot, and the MOK lists exported
+ * by shim, into a snapshot file. Each variable is read once, and the reads
+ * run concurrently. "-" writes to the standard output.
+ */
+int
+snapshot_capture (const char *path)
+{
+	Capture cap = { NULL, 0 };
+	unsigned int entry_num = 0, failed = 0;
+	FILE *out = NULL;
+	int ret = -1;
+
+	if (enumerate_vars (&cap) < 0)
+		goto error;
+
+	qsort (cap.vars, cap.var_num, sizeof(CapturedVar), compare_captured_var);
+	run_parallel (cap.var_num, read_captured_var, &cap);
+
+	for (unsigned int i = 0; i < cap.var_num; i++) {
+		/* The variable may be deleted after it's listed */
+		if (cap.vars[i].error == ENOENT)
+			continue;
+		if (cap.vars[i].error) {
+			errno = cap.vars[i].error;
+			fprintf (stderr, "Failed to read %s: %m\n",
+				 cap.vars[i].name);
+			failed++;
+			continue;
+		}
+		entry_num++;
+	}
+
+	/* A snapshot without a variable would pass for a state without it */
+	if (failed)
+		goto error;
+
+	if (strcmp (path, "-") == 0) {
+		out = stdout;
+	} else {
+		out = fopen (path, "w");
+		if (!out) {
+			fprintf (stderr, "Failed to open %s: %m\n", path);
+			goto error;
+		}
+	}
+	setvbuf (out, NULL, _IOFBF, 1024 * 1024);
+
+	if (write_snapshot (out, &cap, entry_num) < 0 || fflush (out) != 0) {
+		fprintf (stderr, "Failed to write %s: %m\n", path);
+		goto error;
+	}
+
+	ret = 0;
+error:
+	if (out && out != stdout && fclose (out) != 0 && ret == 0) {
+		fprintf (stderr, "Failed to write %s: %m\n", path);
+		ret = -1;
+	}
+	for (unsigned int i = 0; i < cap.var_num; i++) {
+		free (cap.vars[i].name);
+		free (cap.vars[i].data);
+	}
+	free (cap.vars);
+
+	return ret;
+}
+
+int
+is_snapshot (const uint8_t *data, const size_t data_size)
+{
+	return data_size >= sizeof(SnapshotHeader) &&
+	       memcmp (data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+}
+
+/*
+ * Check the bounds of the table and of every entry so that the lookups
+ * can use the data in place.
+ */
+int
+snapshot_load (const uint8_t *data, const size_t data_size, Snapshot *snap)
+{
+	const SnapshotHeader *header = (const SnapshotHeader *)data;
+	const SnapshotEntry *entry;
+
+	memset (snap, 0, sizeof(Snapshot));
+
+	if (!is_snapshot (data, data_size) ||
+	    header->version != SNAPSHOT_VERSION || header->flags != 0 ||
+	    header->entry_size < sizeof(SnapshotEntry) ||
+	    header->toc_offset > data_size ||
+	    (data_size - header->toc_offset) / header->entry_size <
+	    header->entry_num)
+		goto corrupted;
+
+	snap->header = header;
+	snap->toc = data + header->toc_offset;
+
+	for (uint32_t i = 0; i < header->entry_num; i++) {
+		entry = snapshot_entry (snap, i);
+		if (entry->name_offset >= data_size ||
+		    !memchr (data + entry->name_offset, '\0',
+			     data_size - entry->name_offset) ||
+		    entry->data_offset > data_size ||
+		    entry->data_size > data_size - entry->data_offset)
+			goto corrupted;
+	}
+
+	return 0;
+corrupted:
+	fprintf (stderr, "Corrupted or unsupported snapshot\n");
+	memset (snap, 0, sizeof(Snapshot));
+	return -1;
+}
+
+int
+snapshot_open (const char *path, Snapshot *snap)
+{
+	struct stat sb;
+	void *map;
+	int fd;
+
+	memset (snap, 0, sizeof(Snapshot));
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		fprintf (stderr, "Failed to open %s: %m\n", path);
+		return -1;
+	}
+
+	if (fstat (fd, &sb) < 0 || sb.st_size == 0) {
+		fprintf (stderr, "Failed to read %s\n", path);
+		close (fd);
+		return -1;
+	}
+
+	map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) {
+		fprintf (stderr, "Failed to map %s: %m\n", path);
+		return -1;
+	}
+
+	if (snapshot_load (map, sb.st_size, snap) < 0) {
+		munmap (map, sb.st_size);
+		return -1;
+	}
+	snap->map = map;
+	snap->map_size = sb.st_size;
+
+	return 0;
+}
+
+void
+snapshot_close (Snapshot *snap)
+{
+	if (snap->map)
+		munmap (snap->map, snap->map_size);
+	memset (snap, 0, sizeof(Snapshot));
+}
+
+const SnapshotEntry *
+snapshot_entry (const Snapshot *snap, const uint32_t index)
+{
+	return (const SnapshotEntry *)(snap->toc +
+				       (size_t)index * snap->header->entry_size);
+}
+
+const char *
+snapshot_entry_name (const Snapshot *snap, const SnapshotEntry *entry)
+{
+	return (const char *)snap->header + entry->name_offset;
+}
+
+const uint8_t *
+snapshot_entry_data (const Snapshot *snap, const SnapshotEntry *entry)
+{
+	return (const uint8_t *)snap->header + entry->data_offset;
+}
+
+/* Binary search of the table, which is sorted when captured */
+const SnapshotEntry *
+snapshot_find (const Snapshot *snap, const char *name,
+	       const efi_guid_t *guid, const uint32_t source)
+{
+	const SnapshotEntry *entry;
+	efi_guid_t entry_guid;
+	uint32_t low = 0, high = snap->header->entry_num, mid;
+	int cmp;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		entry = snapshot_entry (snap, mid);
+		memcpy (&entry_guid, &entry->guid, sizeof(efi_guid_t));
+
+		cmp = compare_key (name, guid, source,
+				   snapshot_entry_name (snap, entry),
+				   &entry_guid, entry->source);
+		if (cmp == 0)
+			return entry;
+		if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
+
+/*
+ * Get a key database from the snapshot the way get_db_variable() reads it:
+ * the copy exported by shim first, otherwise the variable and its numbered
+ * continuations. The data points into the snapshot unless the parts are
+ * joined into *bufp, which the caller frees.
+ */
+int
+snapshot_get_db (const Snapshot *snap, const char *var_name,
+		 const uint8_t **datap, size_t *data_sizep, uint8_t **bufp)
+{
+	const DBInfo *info = find_db_info (var_name);
+	const efi_guid_t *guid = find_sig_db_var (var_name);
+	const SnapshotEntry *entry, *part;
+	char part_name[64];
+	uint8_t *buf, *buf_new;
+	size_t size;
+
+	*bufp = NULL;
+
+	if (!guid)
+		guid = &efi_guid_shim;
+
+	entry = snapshot_find (snap, var_name, &efi_guid_shim,
+			       SNAPSHOT_SRC_MOK_SYSFS);
+	if (!entry)
+		entry = snapshot_find (snap, var_name, guid,
+				       SNAPSHOT_SRC_EFIVARFS);
+	if (!entry) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	*datap = snapshot_entry_data (snap, entry);
+	*data_sizep = entry->data_size;
+
+	if (entry->source == SNAPSHOT_SRC_MOK_SYSFS ||
+	    (info && !info->multi_part))
+		return 0;
+
+	snprintf (part_name, sizeof(part_name), "%s1", var_name);
+	if (!snapshot_find (snap, part_name, guid, SNAPSHOT_SRC_EFIVARFS))
+		return 0;
+
+	buf = malloc (entry->data_size);
+	if (!buf && entry->data_size)
+		return -1;
+	if (entry->data_size)
+		memcpy (buf, *datap, entry->data_size);
+	size = entry->data_size;
+
+	for (unsigned int i = 1; ; i++) {
+		snprintf (part_name, sizeof(part_name), "%s%u", var_name, i);
+		part = snapshot_find (snap, part_name, guid,
+				      SNAPSHOT_SRC_EFIVARFS);
+		if (!part)
+			break;
+		if (part->data_size == 0)
+			continue;
+
+		buf_new = realloc (buf, size + part->data_size);
+		if (!buf_new) {
+			free (buf);
+			return -1;
+		}
+		buf = buf_new;
+		memcpy (buf + size, snapshot_entry_data (snap, part),
+			part->data_size);
+		size += part->data_size;
+	}
+
+	*bufp = buf;
+	*datap = buf;
+	*data_sizep = size;
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <efivar.h>
+
+/*
+ * A snapshot file starts with the header, followed by the table of
+ * contents sorted by name, GUID and source, the NUL-terminated names and
+ * the variable data. All the offsets are from the start of the file and
+ * aligned to SNAPSHOT_ALIGN, so the file can be mapped and used in place.
+ */
+#define SNAPSHOT_MAGIC   "MOKSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN   8
+
+/* Where the variable was read */
+#define SNAPSHOT_SRC_EFIVARFS  0
+#define SNAPSHOT_SRC_MOK_SYSFS 1	/* the complete copy exported by shim */
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t flags;		/* reserved, e.g. for compression */
+	uint32_t entry_num;
+	uint32_t entry_size;	/* sizeof(SnapshotEntry) of the writer */
+	uint64_t toc_offset;
+	uint64_t created;	/* seconds since the epoch */
+} __attribute__((packed)) SnapshotHeader;
+
+typedef struct {
+	efi_guid_t guid;
+	uint32_t   attributes;
+	uint32_t   source;
+	uint64_t   name_offset;
+	uint64_t   data_offset;
+	uint64_t   data_size;
+} __attribute__((packed)) SnapshotEntry;
+
+typedef struct {
+	uint8_t              *map;
+	size_t                map_size;
+	const SnapshotHeader *header;
+	const uint8_t        *toc;
+} Snapshot;
+
+int is_snapshot (const uint8_t *data, const size_t data_size);
+int snapshot_capture (const char *path);
+int snapshot_load (const uint8_t *data, const size_t data_size,
+		   Snapshot *snap);
+int snapshot_open (const char *path, Snapshot *snap);
+void snapshot_close (Snapshot *snap);
+const SnapshotEntry *snapshot_entry (const Snapshot *snap,
+				     const uint32_t index);
+const char *snapshot_entry_name (const Snapshot *snap,
+				 const SnapshotEntry *entry);
+const uint8_t *snapshot_entry_data (const Snapshot *snap,
+				    const SnapshotEntry *entry);
+const SnapshotEntry *snapshot_find (const Snapshot *snap, const char *name,
+				    const efi_guid_t *guid,
+				    const uint32_t source);
+int snapshot_get_db (const Snapshot *snap, const char *var_name,
+		     const uint8_t **datap, size_t *data_sizep,
+		     uint8_t **bufp);
+
+#endif /* __SNAPSHOT_H__ */
@@ -29,15 +29,22 @@
  * files in the program, then also delete it here.
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <termios.h>
+#include <sys/statfs.h>
 
 #include "efi_hash.h"
+#include "perf.h"
+#include "probes.h"
+#include "req_lock.h"
+#include "sig_index.h"
 #include "util.h"
 
-int
-mok_get_variable(const char *name, uint8_t **datap, size_t *data_sizep)
+static int
+read_mok_variable(const char *name, uint8_t **datap, size_t *data_sizep)
 {
 	char filename[] = "/sys/firmware/efi/mok-variables/implausibly-long-mok-variable-name";
 	size_t filename_sz = sizeof(filename);
@@ -93,8 +100,139 @@ err_close:
 	return 0;
 }
 
-MokListNode*
-build_mok_list (const void *data, const uintptr_t data_size,
+int
+mok_get_variable (const char *name, uint8_t **datap, size_t *data_sizep)
+{
+	const uint64_t start = perf_start ();
+	const uint64_t probe_start = PROBE_START (var__read);
+	int ret;
+
+	ret = read_mok_variable (name, datap, data_sizep);
+	perf_stop (PERF_VAR_READ, start, ret < 0 ? 0 : *data_sizep, name);
+	PROBE5 (var__read, name, &efi_guid_shim, ret < 0 ? 0 : *data_sizep,
+		PROBE_ELAPSED (probe_start), ret);
+
+	return ret;
+}
+
+/* The libefivar calls with the time taken counted for --trace-perf */
+int
+get_efi_variable (const efi_guid_t guid, const char *name, uint8_t **datap,
+		  size_t *data_sizep, uint32_t *attributesp)
+{
+	const uint64_t start = perf_start ();
+	const uint64_t probe_start = PROBE_START (var__read);
+	int ret;
+
+	ret = efi_get_variable (guid, name, datap, data_sizep, attributesp);
+	perf_stop (PERF_VAR_READ, start, ret < 0 ? 0 : *data_sizep, name);
+	PROBE5 (var__read, name, &guid, ret < 0 ? 0 : *data_sizep,
+		PROBE_ELAPSED (probe_start), ret);
+
+	return ret;
+}
+
+int
+set_efi_variable (const efi_guid_t guid, const char *name, uint8_t *data,
+		  const size_t data_size, const uint32_t attributes,
+		  const mode_t mode)
+{
+	const uint64_t start = perf_start ();
+	const uint64_t probe_start = PROBE_START (var__write);
+	int ret;
+
+	ret = efi_set_variable (guid, name, data, data_size, attributes, mode);
+	perf_stop (PERF_VAR_WRITE, start, data_size, name);
+	PROBE5 (var__write, name, &guid, data_size,
+		PROBE_ELAPSED (probe_start), ret);
+
+	return ret;
+}
+
+int
+del_efi_variable (const efi_guid_t guid, const char *name)
+{
+	const uint64_t start = perf_start ();
+	const uint64_t probe_start = PROBE_START (var__write);
+	int ret;
+
+	ret = efi_del_variable (guid, name);
+	perf_stop (PERF_VAR_WRITE, start, 0, name);
+	PROBE5 (var__write, name, &guid, 0, PROBE_ELAPSED (probe_start), ret);
+
+	return ret;
+}
+
+/*
+ * Read a key database variable. The sysfs copy exported by shim is preferred
+ * since it always holds the complete list. Otherwise the variable and its
+ * numbered continuations (e.g. MokListRT1, MokListRT2...) are concatenated.
+ */
+int
+get_db_variable (const char *var_name, const efi_guid_t guid,
+		 uint8_t **datap, size_t *data_sizep)
+{
+	char varname[] = "implausibly-long-mok-variable-name";
+	size_t varname_sz = sizeof(varname);
+	uint8_t *data = NULL, *part, *data_new;
+	size_t data_size = 0, part_size;
+	uint32_t attributes;
+	const DBInfo *info = find_db_info (var_name);
+	size_t part_num = SIZE_MAX;
+	int err;
+
+	if (mok_get_variable (var_name, datap, data_sizep) >= 0)
+		return 0;
+
+	/* Only shim splits a variable, so don't probe for the others */
+	if (info && !info->multi_part)
+		part_num = 1;
+
+	for (size_t i = 0; i < part_num; i++) {
+		if (i == 0) {
+			snprintf (varname, varname_sz, "%s", var_name);
+		} else {
+			snprintf (varname, varname_sz, "%s%zu", var_name, i);
+		}
+
+		if (get_efi_variable (guid, varname, &part, &part_size,
+				      &attributes) < 0) {
+			if (i == 0)
+				return -1;
+			if (errno == ENOENT)
+				break;
+			/* Don't return a list cut short at the failed part */
+			err = errno;
+			free (data);
+			errno = err;
+			return -1;
+		}
+
+		if (part_size == 0) {
+			free (part);
+			continue;
+		}
+
+		data_new = realloc (data, data_size + part_size);
+		if (!data_new) {
+			free (part);
+			free (data);
+			return -1;
+		}
+		data = data_new;
+		memcpy (data + data_size, part, part_size);
+		data_size += part_size;
+		free (part);
+	}
+
+	*datap = data;
+	*data_sizep = data_size;
+
+	return 0;
+}
+
+static MokListNode*
+parse_mok_list (const void *data, const uintptr_t data_size,
 		uint32_t *mok_num)
 {
 	MokListNode *list = NULL;
@@ -116,21 +254,17 @@ build_mok_list (const void *data, const uintptr_t data_size,
 		}
 
 		efi_guid_t sigtype = CertList->SignatureType;
+		const SigType *info = find_sig_type (&sigtype);
 
-		if ((efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0) &&
-		    (efi_guid_cmp (&sigtype, &efi_guid_sha1) != 0) &&
-		    (efi_guid_cmp (&sigtype, &efi_guid_sha224) != 0) &&
-		    (efi_guid_cmp (&sigtype, &efi_guid_sha256) != 0) &&
-		    (efi_guid_cmp (&sigtype, &efi_guid_sha384) != 0) &&
-		    (efi_guid_cmp (&sigtype, &efi_guid_sha512) != 0)) {
+		if (!info) {
 			dbsize -= CertList->SignatureListSize;
 			CertList = (EFI_SIGNATURE_LIST *)((uint8_t *) CertList +
 						  CertList->SignatureListSize);
 			continue;
 		}
 
-		if ((efi_guid_cmp (&sigtype, &efi_guid_x509_cert) != 0) &&
-		    (CertList->SignatureSize != signature_size (&sigtype))) {
+		if (info->data_size &&
+		    (CertList->SignatureSize != info->data_size + sizeof(efi_guid_t))) {
 			dbsize -= CertList->SignatureListSize;
 			CertList = (EFI_SIGNATURE_LIST *)((uint8_t *) CertList +
 						  CertList->SignatureListSize);
@@ -159,7 +293,7 @@ build_mok_list (const void *data, const uintptr_t data_size,
 		}
 
 		list[count].header = CertList;
-		if (efi_guid_cmp (&sigtype, &efi_guid_x509_cert) == 0) {
+		if (!info->data_size) {
 			/* X509 certificate */
 			list[count].mok_size = CertList->SignatureSize -
 					       sizeof(efi_guid_t);
@@ -190,6 +324,123 @@ build_mok_list (const void *data, const uintptr_t data_size,
 	return list;
 }
 
+MokListNode*
+build_mok_list (const void *data, const uintptr_t data_size,
+		uint32_t *mok_num)
+{
+	const uint64_t start = perf_start ();
+	const uint64_t probe_start = PROBE_START (esl__parse);
+	MokListNode *list;
+
+	list = parse_mok_list (data, data_size, mok_num);
+	perf_stop (PERF_BUILD_LIST, start, data_size, NULL);
+	PROBE4 (esl__parse, data, data_size, list ? *mok_num : 0,
+		PROBE_ELAPSED (probe_start));
+
+	return list;
+}
+
+/*
+ * Call func for every signature in the signature lists. Unlike
+ * build_mok_list(), every signature type is included, and every hash of
+ * a list is passed on its own.
+ */
+int
+walk_signatures (const void *data, const size_t data_size,
+		 SignatureFunc func, void *user_data)
+{
+	const uint8_t *ptr = data;
+	size_t remain = data_size;
+
+	while (remain > 0) {
+		const EFI_SIGNATURE_LIST *list = (const EFI_SIGNATURE_LIST *)ptr;
+		const uint8_t *sig;
+		uint32_t sigs_size;
+		efi_guid_t type, owner;
+
+		if (remain < sizeof(EFI_SIGNATURE_LIST) ||
+		    list->SignatureListSize > remain ||
+		    list->SignatureListSize < sizeof(EFI_SIGNATURE_LIST) ||
+		    list->SignatureHeaderSize > list->SignatureListSize -
+						sizeof(EFI_SIGNATURE_LIST) ||
+		    list->SignatureSize <= sizeof(efi_guid_t)) {
+			fprintf (stderr, "Corrupted signature list\n");
+			return -1;
+		}
+
+		sigs_size = list->SignatureListSize - sizeof(EFI_SIGNATURE_LIST) -
+			    list->SignatureHeaderSize;
+		if (sigs_size % list->SignatureSize != 0) {
+			fprintf (stderr, "Corrupted signature list\n");
+			return -1;
+		}
+
+		memcpy (&type, &list->SignatureType, sizeof(type));
+		sig = ptr + sizeof(EFI_SIGNATURE_LIST) + list->SignatureHeaderSize;
+		for (uint32_t off = 0; off < sigs_size; off += list->SignatureSize) {
+			memcpy (&owner, sig + off, sizeof(owner));
+			if (func (&type, &owner, sig + off + sizeof(efi_guid_t),
+				  list->SignatureSize - sizeof(efi_guid_t),
+				  user_data) < 0)
+				return -1;
+		}
+
+		remain -= list->SignatureListSize;
+		ptr += list->SignatureListSize;
+	}
+
+	return 0;
+}
+
+/* The bytes a variable takes in the variable store of the firmware */
+size_t
+nvram_var_cost (const char *var_name, const size_t data_size)
+{
+	return VAR_HEADER_SIZE + (strlen (var_name) + 1) * sizeof(uint16_t) +
+	       data_size;
+}
+
+/* The storage taken by the variable, or 0 if it doesn't exist */
+size_t
+nvram_var_usage (const efi_guid_t guid, const char *var_name)
+{
+	size_t size;
+
+	if (efi_get_variable_size (guid, var_name, &size) < 0)
+		return 0;
+
+	return nvram_var_cost (var_name, size);
+}
+
+/**
+ * Estimate the variable storage from efivarfs. The kernel fills statfs with
+ * the result of QueryVariableInfo() for non-volatile variables.
+ *
+ * Return value:
+ * -  1 : Got the storage info
+ * -  0 : The kernel doesn't report the storage
+ * - -1 : Error
+ */
+int
+get_nvram_space (uint64_t *total, uint64_t *remain)
+{
+	struct statfs buf;
+
+	*total = 0;
+	*remain = 0;
+
+	if (statfs (EFIVARFS_PATH, &buf) < 0)
+		return -1;
+
+	if (buf.f_blocks == 0)
+		return 0;
+
+	*total = (uint64_t)buf.f_blocks * buf.f_bsize;
+	*remain = (uint64_t)buf.f_bavail * buf.f_bsize;
+
+	return 1;
+}
+
 int
 test_and_delete_mok_var (const char *var_name)
 {
@@ -207,116 +458,210 @@ test_and_delete_mok_var (const char *var_name)
 	/* Attempt to delete it no matter what, problem efi_get_variable_size()
 	 * had, unless it just doesn't exist anyway. */
 	if (!(ret < 0 && errno == ENOENT)) {
-		if (efi_del_variable (efi_guid_shim, var_name) < 0)
+		if (del_efi_variable (efi_guid_shim, var_name) < 0)
 			fprintf (stderr, "Failed to unset \"%s\": %m\n", var_name);
 	}
 
 	return ret;
 }
 
+/* Whether the variable still holds the data read before. A NULL data
+ * means the variable didn't exist. */
 int
-delete_data_from_req_var (const MokRequest req, const efi_guid_t *type,
-			  const void *data, const uint32_t data_size)
+is_variable_unchanged (const efi_guid_t guid, const char *var_name,
+		       const uint8_t *data, const size_t data_size)
+{
+	uint8_t *cur_data = NULL;
+	size_t cur_size = 0;
+	uint32_t attributes;
+	int ret;
+
+	if (get_efi_variable (guid, var_name, &cur_data, &cur_size,
+			      &attributes) < 0) {
+		if (errno != ENOENT)
+			return -1;
+		return data == NULL;
+	}
+
+	ret = data && cur_size == data_size &&
+	      memcmp (cur_data, data, data_size) == 0;
+	free (cur_data);
+
+	return ret;
+}
+
+/*
+ * Drop the signatures in the set from the signature lists in place. Return
+ * the number of the dropped signatures, or -1 if the lists are corrupted.
+ */
+static int
+drop_sigs (uint8_t *data, size_t *data_sizep, const SigIndex *set,
+	   uint8_t *removed)
+{
+	uint8_t *src, *dst, *end;
+	int del_num = 0;
+
+	src = dst = data;
+	end = data + *data_sizep;
+	while (src < end) {
+		EFI_SIGNATURE_LIST *list = (EFI_SIGNATURE_LIST *)src;
+		efi_guid_t sigtype;
+		uint32_t list_size, hdr_size, sig_size, keep = 0;
+		uint8_t *sig, *list_dst;
+
+		if ((size_t)(end - src) < sizeof(EFI_SIGNATURE_LIST))
+			return -1;
+		list_size = list->SignatureListSize;
+		hdr_size = sizeof(EFI_SIGNATURE_LIST) + list->SignatureHeaderSize;
+		sig_size = list->SignatureSize;
+		if (list_size < hdr_size || list_size > (size_t)(end - src) ||
+		    sig_size <= sizeof(efi_guid_t) ||
+		    (list_size - hdr_size) % sig_size != 0)
+			return -1;
+		sigtype = list->SignatureType;
+
+		list_dst = dst;
+		memmove (dst, src, hdr_size);
+		dst += hdr_size;
+
+		for (sig = src + hdr_size; sig < src + list_size; sig += sig_size) {
+			int idx;
+
+			idx = sig_index_find (set, &sigtype,
+					      sig + sizeof(efi_guid_t),
+					      sig_size - sizeof(efi_guid_t));
+			if (idx >= 0) {
+				if (removed)
+					removed[idx] = 1;
+				del_num++;
+				continue;
+			}
+
+			memmove (dst, sig, sig_size);
+			dst += sig_size;
+			keep++;
+		}
+
+		if (keep == 0)
+			dst = list_dst;
+		else
+			((EFI_SIGNATURE_LIST *)list_dst)->SignatureListSize =
+				hdr_size + keep * sig_size;
+
+		src += list_size;
+	}
+
+	*data_sizep = dst - data;
+
+	return del_num;
+}
+
+/*
+ * Remove every signature found in the set from the request variable in one
+ * pass and write the variable back once. The signature lists left empty are
+ * dropped, and the variable and its Auth variable are deleted if nothing is
+ * left. If "removed" is given, removed[i] is set for each entry of the set
+ * found in the variable.
+ *
+ * The variable is modified with the request lock held, and it is read again
+ * right before the write. If somebody else changed it meanwhile, the removal
+ * starts over with the new content.
+ *
+ * Return the number of signatures removed, or -1 on error.
+ */
+int
+delete_sigs_from_req_var (const MokRequest req, const SigIndex *set,
+			  uint8_t *removed)
 {
 	const efi_guid_t *var_guid = &efi_guid_shim;
 	const char *var_name = get_req_var_name (req);
 	const char *authvar_name = get_req_auth_var_name (req);
-	uint8_t *var_data = NULL;
-	size_t var_data_size = 0;
+	uint8_t *var_data = NULL, *new_data = NULL;
+	size_t var_data_size = 0, new_size;
 	uint32_t attributes;
-	MokListNode *list;
-	uint32_t mok_num, total, remain;
-	void *end, *start = NULL;
-	int del_ind, ret = 0;
-	uint32_t sig_list_size, sig_size;
+	int lock_fd, del_num = 0;
+	int ret = -1;
+
+	if (removed && set->entry_num > 0)
+		memset (removed, 0, set->entry_num);
 
-	if (!var_name || !data || data_size == 0)
+	if (!var_name || set->entry_num == 0)
 		return 0;
 
-	ret = efi_get_variable (*var_guid, var_name, &var_data, &var_data_size,
-				&attributes);
-	if (ret < 0) {
-		if (errno == ENOENT)
-			return 0;
-		fprintf (stderr, "Failed to read variable \"%s\": %m\n",
-			 var_name);
+	lock_fd = lock_requests ();
+	if (lock_fd < 0)
 		return -1;
-	}
-
-	total = var_data_size;
-
-	list = build_mok_list (var_data, var_data_size, &mok_num);
-	if (list == NULL)
-		goto done;
-
-	remain = total;
-	for (unsigned int i = 0; i < mok_num; i++) {
-		remain -= list[i].header->SignatureListSize;
-		efi_guid_t sigtype = list[i].header->SignatureType;
-		if (efi_guid_cmp (&sigtype, type) != 0)
-			continue;
 
-		sig_list_size = list[i].header->SignatureListSize;
+	for (unsigned int retry = 0; retry < MAX_COMMIT_RETRIES; retry++) {
+		free (var_data);
+		free (new_data);
+		var_data = new_data = NULL;
+
+		if (get_efi_variable (*var_guid, var_name, &var_data,
+				      &var_data_size, &attributes) < 0) {
+			if (errno == ENOENT)
+				ret = 0;
+			else
+				fprintf (stderr, "Failed to read variable \"%s\": %m\n",
+					 var_name);
+			goto done;
+		}
 
-		if (efi_guid_cmp (type, &efi_guid_x509_cert) == 0) {
-			if (list[i].mok_size != data_size)
-				continue;
+		new_data = malloc (var_data_size);
+		if (!new_data) {
+			fprintf (stderr, "Failed to allocate memory\n");
+			goto done;
+		}
+		memcpy (new_data, var_data, var_data_size);
+		new_size = var_data_size;
 
-			if (memcmp (list[i].mok, data, data_size) == 0) {
-				/* Remove this key */
-				start = (void *)list[i].header;
-				end = start + sig_list_size;
-				total -= sig_list_size;
-				break;
-			}
-		} else {
-			del_ind = match_hash_array (type, data, list[i].mok,
-						    list[i].mok_size);
-			if (del_ind < 0)
-				continue;
+		del_num = drop_sigs (new_data, &new_size, set, removed);
+		if (del_num < 0) {
+			fprintf (stderr, "Corrupted request \"%s\"\n", var_name);
+			goto done;
+		}
+		if (del_num == 0) {
+			ret = 0;
+			goto done;
+		}
 
-			start = (void *)list[i].header;
-			sig_size = signature_size (type);
-			if (sig_list_size == (sizeof(EFI_SIGNATURE_LIST) + sig_size)) {
-				/* Only one hash in the list */
-				end = start + sig_list_size;
-				total -= sig_list_size;
-			} else {
-				/* More than one hash in the list */
-				start += sizeof(EFI_SIGNATURE_LIST) + sig_size * del_ind;
-				end = start + sig_size;
-				total -= sig_size;
-				list[i].header->SignatureListSize -= sig_size;
-				remain += sig_list_size - sizeof(EFI_SIGNATURE_LIST) -
-					  (del_ind + 1) * sig_size;
-			}
-			break;
+		ret = is_variable_unchanged (*var_guid, var_name, var_data,
+					     var_data_size);
+		if (ret < 0) {
+			fprintf (stderr, "Failed to read variable \"%s\": %m\n",
+				 var_name);
+			goto done;
 		}
+		if (ret > 0)
+			break;
+
+		if (removed)
+			memset (removed, 0, set->entry_num);
+		ret = -1;
 	}
 
-	/* the key or hash is not in this list */
-	if (start == NULL)
-		return 0;
+	if (ret <= 0) {
+		fprintf (stderr, "%s keeps changing, give up\n", var_name);
+		ret = -1;
+		goto done;
+	}
+	ret = -1;
 
 	/* all keys are removed */
-	if (total == 0) {
+	if (new_size == 0) {
 		if (test_and_delete_mok_var (var_name) != 0)
 			goto done;
 		if (test_and_delete_mok_var (authvar_name) != 0)
 			goto done;
-		ret = 1;
+		ret = del_num;
 		goto done;
 	}
 
-	/* remove the key or hash  */
-	if (remain > 0)
-		memmove (start, end, remain);
-
 	attributes = EFI_VARIABLE_NON_VOLATILE
 		     | EFI_VARIABLE_BOOTSERVICE_ACCESS
 		     | EFI_VARIABLE_RUNTIME_ACCESS;
-	ret = efi_set_variable (*var_guid, var_name,
-				var_data, total, attributes,
+	ret = set_efi_variable (*var_guid, var_name,
+				new_data, new_size, attributes,
 				S_IRUSR | S_IWUSR);
 	if (ret < 0) {
 		fprintf (stderr, "Failed to write variable \"%s\": %m\n",
@@ -325,15 +670,53 @@ delete_data_from_req_var (const MokRequest req, const efi_guid_t *type,
 	}
 	efi_chmod_variable(*var_guid, var_name, S_IRUSR | S_IWUSR);
 
-	ret = 1;
+	ret = del_num;
 done:
-	if (list)
-		free (list);
+	unlock_requests (lock_fd);
 	free (var_data);
+	free (new_data);
 
 	return ret;
 }
 
+int
+delete_data_from_req_var (const MokRequest req, const efi_guid_t *type,
+			  const void *data, const uint32_t data_size)
+{
+	SigIndex set;
+	int ret;
+
+	if (!data || data_size == 0)
+		return 0;
+
+	sig_index_init (&set);
+	if (sig_index_add (&set, type, &efi_guid_shim, data, data_size) < 0) {
+		fprintf (stderr, "Failed to allocate memory\n");
+		return -1;
+	}
+
+	ret = delete_sigs_from_req_var (req, &set, NULL);
+	sig_index_free (&set);
+
+	return ret > 0 ? 1 : ret;
+}
+
+/* Print the string as a JSON string with the quotes */
+void
+json_print_string (FILE *out, const char *str)
+{
+	fputc ('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf (out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf (out, "\\u%04x", (unsigned char)*str);
+		else
+			fputc (*str, out);
+	}
+	fputc ('"', out);
+}
+
 unsigned long
 efichar_from_char (efi_char16_t *dest, const char *src, size_t dest_len)
 {
@@ -372,50 +755,114 @@ read_hidden_line (char **line, size_t *n)
 		(void) tcsetattr (fileno (stdin), TCSAFLUSH, &old);
 	}
 
+	if (nread <= 0)
+		return -1;
+
 	/* Remove the newline */
 	(*line)[nread-1] = '\0';
 
 	return nread-1;
 }
 
+static const DBInfo db_info[DB_NAME_NUM] = {
+	[MOK_LIST_RT]   = { "MokListRT",  &efi_guid_shim,     "MOK",  NULL,      1 },
+	[MOK_LIST_X_RT] = { "MokListXRT", &efi_guid_shim,     "MOKX", NULL,      1 },
+	[PK]            = { "PK",         &efi_guid_global,   "PK",   "pk",      0 },
+	[KEK]           = { "KEK",        &efi_guid_global,   "KEK",  "kek",     0 },
+	[DB]            = { "db",         &efi_guid_security, "DB",   "db",      0 },
+	[DBX]           = { "dbx",        &efi_guid_security, "DBX",  "dbx",     0 },
+	[DBR]           = { "dbr",        &efi_guid_security, "DBR",  "dbr",     0 },
+	[DBT]           = { "dbt",        &efi_guid_security, "DBT",  "dbt",     0 },
+	[PK_DEFAULT]    = { "PKDefault",  &efi_guid_global,   "PKDefault",
+			    "pk-default", 0 },
+	[KEK_DEFAULT]   = { "KEKDefault", &efi_guid_global,   "KEKDefault",
+			    "kek-default", 0 },
+	[DB_DEFAULT]    = { "dbDefault",  &efi_guid_global,   "DBDefault",
+			    "db-default", 0 },
+	[DBX_DEFAULT]   = { "dbxDefault", &efi_guid_global,   "DBXDefault",
+			    "dbx-default", 0 },
+	[DBR_DEFAULT]   = { "dbrDefault", &efi_guid_global,   "DBRDefault",
+			    "dbr-default", 0 },
+	[DBT_DEFAULT]   = { "dbtDefault", &efi_guid_global,   "DBTDefault",
+			    "dbt-default", 0 },
+};
+
+const DBInfo *
+get_db_info (const DBName db_name)
+{
+	return &db_info[db_name];
+}
+
+const DBInfo *
+find_db_info (const char *var_name)
+{
+	for (unsigned int i = 0; i < DB_NAME_NUM; i++) {
+		if (strcmp (db_info[i].var_name, var_name) == 0)
+			return &db_info[i];
+	}
+
+	return NULL;
+}
+
 const char *
 get_db_var_name (const DBName db_name)
 {
-	const char *db_var_names[] = {
-		[MOK_LIST_RT]   = "MokListRT",
-		[MOK_LIST_X_RT] = "MokListXRT",
-		[PK]            = "PK",
-		[KEK]           = "KEK",
-		[DB]            = "db",
-		[DBX]           = "dbx",
-	};
-
-	return db_var_names[db_name];
+	return db_info[db_name].var_name;
 }
 
 const char *
 get_db_friendly_name (const DBName db_name)
 {
-	const char *db_friendly_names[] = {
-		[MOK_LIST_RT]   = "MOK",
-		[MOK_LIST_X_RT] = "MOKX",
-		[PK]            = "PK",
-		[KEK]           = "KEK",
-		[DB]            = "DB",
-		[DBX]           = "DBX",
-	};
+	return db_info[db_name].friendly_name;
+}
+
+/* The request variables which can be looked up along with the databases */
+static const char *req_db_vars[] = {
+	"MokNew",
+	"MokDel",
+	"MokXNew",
+	"MokXDel",
+};
+
+const char *
+get_sig_db_var (const unsigned int index, const efi_guid_t **guid)
+{
+	if (index < DB_NAME_NUM) {
+		*guid = db_info[index].guid;
+		return db_info[index].var_name;
+	}
 
-	return db_friendly_names[db_name];
+	if (index - DB_NAME_NUM >= sizeof(req_db_vars)/sizeof(req_db_vars[0]))
+		return NULL;
+
+	*guid = &efi_guid_shim;
+	return req_db_vars[index - DB_NAME_NUM];
+}
+
+const efi_guid_t *
+find_sig_db_var (const char *name)
+{
+	const DBInfo *info = find_db_info (name);
+
+	if (info)
+		return info->guid;
+
+	for (unsigned int i = 0; i < sizeof(req_db_vars)/sizeof(req_db_vars[0]); i++) {
+		if (strcmp (req_db_vars[i], name) == 0)
+			return &efi_guid_shim;
+	}
+
+	return NULL;
 }
 
 const char *
 get_req_var_name (const MokRequest req)
 {
 	const char *var_names[] = {
-		[DELETE_MOK] = "MokDel",
-		[ENROLL_MOK] = "MokNew",
-		[DELETE_BLACKLIST] = "MokXDel",
-		[ENROLL_BLACKLIST] = "MokXNew"
+		[MOK_REQ_DELETE_MOK] = "MokDel",
+		[MOK_REQ_ENROLL_MOK] = "MokNew",
+		[MOK_REQ_DELETE_BLACKLIST] = "MokXDel",
+		[MOK_REQ_ENROLL_BLACKLIST] = "MokXNew"
 	};
 
 	return var_names[req];
@@ -425,10 +872,10 @@ const char *
 get_req_auth_var_name (const MokRequest req)
 {
 	const char *auth_var_names[] = {
-		[DELETE_MOK] = "MokDelAuth",
-		[ENROLL_MOK] = "MokAuth",
-		[DELETE_BLACKLIST] = "MokXDelAuth",
-		[ENROLL_BLACKLIST] = "MokXAuth"
+		[MOK_REQ_DELETE_MOK] = "MokDelAuth",
+		[MOK_REQ_ENROLL_MOK] = "MokAuth",
+		[MOK_REQ_DELETE_BLACKLIST] = "MokXDelAuth",
+		[MOK_REQ_ENROLL_BLACKLIST] = "MokXAuth"
 	};
 
 	return auth_var_names[req];
@@ -438,10 +885,10 @@ MokRequest
 get_reverse_req (const MokRequest req)
 {
 	const MokRequest reverse_reqs[] = {
-		[DELETE_MOK] = ENROLL_MOK,
-		[ENROLL_MOK] = DELETE_MOK,
-		[DELETE_BLACKLIST] = ENROLL_BLACKLIST,
-		[ENROLL_BLACKLIST] = DELETE_BLACKLIST,
+		[MOK_REQ_DELETE_MOK] = MOK_REQ_ENROLL_MOK,
+		[MOK_REQ_ENROLL_MOK] = MOK_REQ_DELETE_MOK,
+		[MOK_REQ_DELETE_BLACKLIST] = MOK_REQ_ENROLL_BLACKLIST,
+		[MOK_REQ_ENROLL_BLACKLIST] = MOK_REQ_DELETE_BLACKLIST,
 	};
 
 	return reverse_reqs[req];
@@ -454,3 +901,62 @@ get_reverse_req_var_name (const MokRequest req)
 
 	return get_req_var_name (reverse_req);
 }
+
+#define MAX_WORKERS 32
+
+typedef struct {
+	unsigned int  count;
+	unsigned int  next;
+	void        (*func)(const unsigned int index, void *data);
+	void         *data;
+} ParallelJob;
+
+static void *
+parallel_worker (void *arg)
+{
+	ParallelJob *job = arg;
+	unsigned int index;
+
+	while ((index = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED))
+	       < job->count)
+		job->func (index, job->data);
+
+	return NULL;
+}
+
+/*
+ * Call func for every index in [0, count) across a pool of worker threads.
+ * The calls happen in no particular order, so func should store its result
+ * by index and let the caller consume the results in order.
+ */
+void
+run_parallel (const unsigned int count,
+	      void (*func)(const unsigned int index, void *data), void *data)
+{
+	ParallelJob job = {
+		.count = count,
+		.next  = 0,
+		.func  = func,
+		.data  = data,
+	};
+	pthread_t threads[MAX_WORKERS];
+	unsigned int thread_num = 0;
+	long cpu_num;
+
+	cpu_num = sysconf (_SC_NPROCESSORS_ONLN);
+	if (cpu_num > MAX_WORKERS)
+		cpu_num = MAX_WORKERS;
+
+	/* The calling thread works as well */
+	for (long i = 1; i < cpu_num && i < (long)count; i++) {
+		if (pthread_create (&threads[thread_num], NULL,
+				    parallel_worker, &job) != 0)
+			break;
+		thread_num++;
+	}
+
+	parallel_worker (&job);
+
+	for (unsigned int i = 0; i < thread_num; i++)
+		pthread_join (threads[i], NULL);
+}
@@ -34,25 +34,68 @@
 
 #include <efivar.h>
 #include "mokutil.h"
+#include "sig_index.h"
 
+#include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#define EFIVARFS_PATH "/sys/firmware/efi/efivars"
+
+/* The header of an authenticated variable in the EDK2 variable store */
+#define VAR_HEADER_SIZE 60
+
+/* Many firmwares reject a variable larger than this */
+#define VAR_SIZE_LIMIT_HINT (64 * 1024)
+
+/* How many times to redo a request when the variable changes under us */
+#define MAX_COMMIT_RETRIES 5
+
+/* Return a negative value to stop walking */
+typedef int (*SignatureFunc)(const efi_guid_t *type, const efi_guid_t *owner,
+			     const uint8_t *data, const uint32_t data_size,
+			     void *user_data);
+
 int mok_get_variable(const char *name, uint8_t **datap, size_t *data_sizep);
+int get_efi_variable (const efi_guid_t guid, const char *name, uint8_t **datap,
+		      size_t *data_sizep, uint32_t *attributesp);
+int set_efi_variable (const efi_guid_t guid, const char *name, uint8_t *data,
+		      const size_t data_size, const uint32_t attributes,
+		      const mode_t mode);
+int del_efi_variable (const efi_guid_t guid, const char *name);
+int get_db_variable (const char *var_name, const efi_guid_t guid,
+		     uint8_t **datap, size_t *data_sizep);
 MokListNode *build_mok_list (const void *data, const uintptr_t data_size,
 			     uint32_t *mok_num);
+int walk_signatures (const void *data, const size_t data_size,
+		     SignatureFunc func, void *user_data);
+size_t nvram_var_cost (const char *var_name, const size_t data_size);
+size_t nvram_var_usage (const efi_guid_t guid, const char *var_name);
+int get_nvram_space (uint64_t *total, uint64_t *remain);
 int test_and_delete_mok_var (const char *var_name);
+int is_variable_unchanged (const efi_guid_t guid, const char *var_name,
+			   const uint8_t *data, const size_t data_size);
+int delete_sigs_from_req_var (const MokRequest req, const SigIndex *set,
+			      uint8_t *removed);
 int delete_data_from_req_var (const MokRequest req, const efi_guid_t *type,
 			      const void *data, const uint32_t data_size);
+void json_print_string (FILE *out, const char *str);
 unsigned long efichar_from_char (efi_char16_t *dest, const char *src,
 				 size_t dest_len);
 int read_hidden_line (char **line, size_t *n);
+const DBInfo *get_db_info (const DBName db);
+const DBInfo *find_db_info (const char *var_name);
 const char *get_db_var_name (const DBName db);
 const char *get_db_friendly_name (const DBName db);
+const char *get_sig_db_var (const unsigned int index, const efi_guid_t **guid);
+const efi_guid_t *find_sig_db_var (const char *name);
 const char *get_req_var_name (const MokRequest req);
 const char *get_req_auth_var_name (const MokRequest req);
 MokRequest get_reverse_req (const MokRequest req);
 const char *get_reverse_req_var_name (const MokRequest req);
+void run_parallel (const unsigned int count,
+		   void (*func)(const unsigned int index, void *data),
+		   void *data);
 
 #endif /* __UTIL_H__ */
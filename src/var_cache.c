@@ -0,0 +1,277 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "var_cache.h"
+
+/*
+ * The key databases are read and indexed once per process. The lookups only
+ * read the cached data, so worker threads may share the cache as long as
+ * nobody invalidates it meanwhile.
+ */
+static CachedVar **cached_vars;
+static unsigned int cached_var_num;
+static unsigned long cache_generation;	/* bumped when copies are dropped */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+get_var_stamp (const char *name, const efi_guid_t *guid, VarStamp *stamp)
+{
+	char path[PATH_MAX];
+	char *guid_str = NULL;
+	struct stat buf;
+
+	memset (stamp, 0, sizeof(VarStamp));
+
+	if (efi_guid_to_str (guid, &guid_str) < 0)
+		return;
+	snprintf (path, sizeof(path), "%s/%s-%s", EFIVARFS_PATH, name,
+		  guid_str);
+	free (guid_str);
+
+	if (stat (path, &buf) < 0)
+		return;
+
+	stamp->exists = 1;
+	stamp->ino = buf.st_ino;
+	stamp->size = buf.st_size;
+	stamp->mtime = buf.st_mtim;
+	stamp->ctime = buf.st_ctim;
+}
+
+static int
+is_same_stamp (const VarStamp *a, const VarStamp *b)
+{
+	return a->exists == b->exists && a->ino == b->ino &&
+	       a->size == b->size &&
+	       a->mtime.tv_sec == b->mtime.tv_sec &&
+	       a->mtime.tv_nsec == b->mtime.tv_nsec &&
+	       a->ctime.tv_sec == b->ctime.tv_sec &&
+	       a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+static void
+free_var (CachedVar *var)
+{
+	sig_index_free (&var->index);
+	free (var->data);
+	free (var->name);
+	free (var);
+}
+
+static CachedVar *
+load_var (const char *name, const efi_guid_t guid)
+{
+	CachedVar *var;
+	int err;
+
+	var = calloc (1, sizeof(CachedVar));
+	if (!var)
+		return NULL;
+
+	var->name = strdup (name);
+	if (!var->name) {
+		free (var);
+		return NULL;
+	}
+	var->guid = guid;
+	sig_index_init (&var->index);
+
+	/* Take the stamp first so that a write during the read is noticed */
+	get_var_stamp (name, &guid, &var->stamp);
+
+	if (get_db_variable (name, guid, &var->data, &var->data_size) < 0) {
+		var->data = NULL;
+		var->data_size = 0;
+		if (errno == ENOENT)
+			return var;
+
+		/* Don't take a failed read for an empty database */
+		err = errno;
+		free_var (var);
+		errno = err;
+		return NULL;
+	}
+
+	/* A corrupted list isn't an empty database either */
+	if (sig_index_add_esl (&var->index, var->data, var->data_size) < 0) {
+		err = errno;
+		free_var (var);
+		errno = err;
+		return NULL;
+	}
+
+	return var;
+}
+
+static CachedVar *
+find_cached_var (const char *name, const efi_guid_t *guid)
+{
+	for (unsigned int i = 0; i < cached_var_num; i++) {
+		if (strcmp (cached_vars[i]->name, name) == 0 &&
+		    efi_guid_cmp (&cached_vars[i]->guid, guid) == 0)
+			return cached_vars[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the cached variable, reading it on the first access. A variable
+ * which doesn't exist is cached as an empty one; any other read error
+ * returns NULL with errno set, and nothing is cached. The variable is read
+ * without holding the lock so that threads can load different variables
+ * at the same time; if two threads race for the same one, the first copy
+ * wins. A copy read while the cache was invalidated may be stale, so it is
+ * read again.
+ */
+const CachedVar *
+var_cache_get (const char *name, const efi_guid_t guid)
+{
+	CachedVar **vars_new, *var, *loaded;
+	unsigned long generation;
+
+	for (;;) {
+		pthread_mutex_lock (&cache_lock);
+		var = find_cached_var (name, &guid);
+		generation = cache_generation;
+		pthread_mutex_unlock (&cache_lock);
+		if (var)
+			return var;
+
+		loaded = load_var (name, guid);
+		if (!loaded)
+			return NULL;
+
+		pthread_mutex_lock (&cache_lock);
+		if (generation == cache_generation)
+			break;
+		pthread_mutex_unlock (&cache_lock);
+		free_var (loaded);
+	}
+
+	var = find_cached_var (name, &guid);
+	if (var)
+		goto out;
+
+	vars_new = realloc (cached_vars,
+			    (cached_var_num + 1) * sizeof(CachedVar *));
+	if (!vars_new)
+		goto out;
+	cached_vars = vars_new;
+
+	var = loaded;
+	cached_vars[cached_var_num++] = var;
+	loaded = NULL;
+out:
+	pthread_mutex_unlock (&cache_lock);
+
+	if (loaded)
+		free_var (loaded);
+
+	return var;
+}
+
+/* Drop the cached copy after the variable is changed */
+void
+var_cache_invalidate (const char *name)
+{
+	pthread_mutex_lock (&cache_lock);
+
+	cache_generation++;
+	for (unsigned int i = 0; i < cached_var_num;) {
+		if (strcmp (cached_vars[i]->name, name) != 0) {
+			i++;
+			continue;
+		}
+
+		free_var (cached_vars[i]);
+		cached_vars[i] = cached_vars[--cached_var_num];
+	}
+
+	pthread_mutex_unlock (&cache_lock);
+}
+
+void
+var_cache_clear (void)
+{
+	pthread_mutex_lock (&cache_lock);
+
+	cache_generation++;
+	for (unsigned int i = 0; i < cached_var_num; i++)
+		free_var (cached_vars[i]);
+	free (cached_vars);
+	cached_vars = NULL;
+	cached_var_num = 0;
+
+	pthread_mutex_unlock (&cache_lock);
+}
+
+/*
+ * Drop the cached variables whose files in efivarfs changed since they were
+ * read, so that a long-running process sees the updates. Return the number
+ * of the dropped variables.
+ */
+unsigned int
+var_cache_refresh (void)
+{
+	unsigned int dropped = 0;
+	VarStamp stamp;
+
+	pthread_mutex_lock (&cache_lock);
+
+	for (unsigned int i = 0; i < cached_var_num;) {
+		get_var_stamp (cached_vars[i]->name, &cached_vars[i]->guid,
+			       &stamp);
+		if (is_same_stamp (&stamp, &cached_vars[i]->stamp)) {
+			i++;
+			continue;
+		}
+
+		free_var (cached_vars[i]);
+		cached_vars[i] = cached_vars[--cached_var_num];
+		dropped++;
+	}
+	if (dropped)
+		cache_generation++;
+
+	pthread_mutex_unlock (&cache_lock);
+
+	return dropped;
+}
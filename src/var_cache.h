@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef __VAR_CACHE_H__
+#define __VAR_CACHE_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <efivar.h>
+
+#include "sig_index.h"
+
+/* What efivarfs tells about the variable file, to notice changes */
+typedef struct {
+	int             exists;
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+	struct timespec ctime;
+} VarStamp;
+
+typedef struct {
+	char       *name;
+	efi_guid_t  guid;
+	uint8_t    *data;		/* NULL if the variable doesn't exist */
+	size_t      data_size;
+	SigIndex    index;
+	VarStamp    stamp;
+} CachedVar;
+
+const CachedVar *var_cache_get (const char *name, const efi_guid_t guid);
+void var_cache_invalidate (const char *name);
+void var_cache_clear (void);
+unsigned int var_cache_refresh (void);
+
+#endif /* __VAR_CACHE_H__ */